@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "ac4_frame_parse.h"
 
 #define MAX_FRAME_RATE_INDEX 13
@@ -41,7 +42,7 @@ static uint16_t table_83[14] =
     2048
 };
 
-static uint8_t syncframe_header[7] =
+static const uint8_t syncframe_header[AC4_SYNCFRAME_HEADER_LEN] =
 {0xac, 0x40, 0xff, 0xff, 0, 0, 0};
 
 static uint16_t read_bit(int32_t start, int32_t len, uint8_t* data, int32_t data_len)
@@ -180,12 +181,12 @@ int ac4_toc_parse (uint8_t* data, int32_t len, struct ac4_info* info)
 }
 
 
-uint8_t * ac4_syncframe_header(int32_t len, int32_t *header_len)
+int32_t ac4_syncframe_header(uint8_t *header, int32_t len)
 {
-    syncframe_header[4] = (len >> 16) & 0xff;
-    syncframe_header[5] = (len >> 8) & 0xff;
-    syncframe_header[6] = len & 0xff;
-    *header_len = 7;
+    memcpy(header, syncframe_header, sizeof(syncframe_header));
+    header[4] = (len >> 16) & 0xff;
+    header[5] = (len >> 8) & 0xff;
+    header[6] = len & 0xff;
 
-    return syncframe_header;
+    return AC4_SYNCFRAME_HEADER_LEN;
 }
@@ -30,6 +30,9 @@ struct ac4_info {
 };
 
 int ac4_toc_parse(uint8_t* data, int32_t len, struct ac4_info* info);
-uint8_t * ac4_syncframe_header(int32_t len, int32_t *header_len);
+#define AC4_SYNCFRAME_HEADER_LEN 7
+/* write the sync frame header of a @len byte frame into @header, which
+ * takes AC4_SYNCFRAME_HEADER_LEN bytes. Returns the header length */
+int32_t ac4_syncframe_header(uint8_t *header, int32_t len);
 
 #endif
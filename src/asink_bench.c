@@ -0,0 +1,633 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+/* End to end benchmark: appsrc ! amlhalasink with synthetic input for each
+ * format against the mock HAL, results as one JSON object per format.
+ *
+ *   amlasink_bench --format=all --seconds=10 --seeks=5 --output=bench.json
+ *
+ * Chain latency is the gap between two buffers leaving appsrc while its
+ * queue is never empty, so it covers the whole sink chain call.
+ *
+ * With --instances=N each format also runs once alone and then as N
+ * pipelines at the same time, reporting how throughput scales and whether
+ * any instance stalled or posted an error. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+/* count allocations made by the streaming thread, glibc only */
+static __thread gboolean count_allocs;
+static gint64 n_allocs;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t align, size_t size);
+
+void *
+malloc (size_t size)
+{
+  if (count_allocs)
+    __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+  if (count_allocs)
+    __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  if (count_allocs)
+    __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc (ptr, size);
+}
+
+int
+posix_memalign (void **ptr, size_t align, size_t size)
+{
+  if (count_allocs)
+    __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  *ptr = __libc_memalign (align, size);
+  return *ptr ? 0 : 12 /* ENOMEM */;
+}
+#endif
+
+typedef struct
+{
+  const gchar *name;
+  const gchar *caps;
+  /* fill one buffer, returns its duration */
+  GstClockTime (*fill) (GstMapInfo * map, guint64 index);
+  gsize size;
+} BenchFormat;
+
+#define PCM_FRAMES 1024
+
+static GstClockTime
+fill_pcm (GstMapInfo * map, guint64 index)
+{
+  gint16 *s = (gint16 *) map->data;
+  guint i;
+
+  /* 1 kHz tone, both channels */
+  for (i = 0; i < PCM_FRAMES; i++) {
+    gint16 v = (gint16) (8000 * sin (2 * G_PI * 1000 *
+            (index * PCM_FRAMES + i) / 48000.0));
+    s[2 * i] = s[2 * i + 1] = v;
+  }
+  return gst_util_uint64_scale_int (PCM_FRAMES, GST_SECOND, 48000);
+}
+
+/* AC-3 48 kHz 192 kbps, 768 byte frames of 1536 samples */
+static GstClockTime
+fill_ac3 (GstMapInfo * map, guint64 index)
+{
+  guint8 *d = map->data;
+
+  memset (d, 0, map->size);
+  d[0] = 0x0b;
+  d[1] = 0x77;
+  d[4] = (0 << 6) | 20;         /* fscod 48k, frmsizecod 192 kbps */
+  d[5] = 8 << 3;                /* bsid */
+  d[6] = 2 << 5;                /* acmod 2/0 */
+  return gst_util_uint64_scale_int (1536, GST_SECOND, 48000);
+}
+
+/* E-AC-3 48 kHz, 6 blocks, 768 byte frames */
+static GstClockTime
+fill_eac3 (GstMapInfo * map, guint64 index)
+{
+  guint8 *d = map->data;
+  guint frmsiz = map->size / 2 - 1;
+
+  memset (d, 0, map->size);
+  d[0] = 0x0b;
+  d[1] = 0x77;
+  d[2] = (frmsiz >> 8) & 0x7;
+  d[3] = frmsiz & 0xff;
+  d[4] = (0 << 6) | (3 << 4) | (2 << 1);        /* fscod, numblkscod, acmod */
+  d[5] = 16 << 3;               /* bsid */
+  return gst_util_uint64_scale_int (1536, GST_SECOND, 48000);
+}
+
+/* AC-4 sync frame, 48 kHz, frame rate index 0 (1920 samples) */
+static GstClockTime
+fill_ac4 (GstMapInfo * map, guint64 index)
+{
+  guint8 *d = map->data;
+  guint len = map->size - 4;
+  guint seq = index & 0x3ff;
+
+  memset (d, 0, map->size);
+  d[0] = 0xac;
+  d[1] = 0x40;
+  d[2] = (len >> 8) & 0xff;
+  d[3] = len & 0xff;
+  /* version 0, sequence_count, b_wait_frames 0, fs_index 1, rate idx 0 */
+  d[4] = (seq >> 4) & 0x3f;
+  d[5] = ((seq & 0xf) << 4) | (0 << 3) | (1 << 2);
+  return gst_util_uint64_scale_int (1920, GST_SECOND, 48000);
+}
+
+/* TrueHD, 24 access units of 40 samples with a major sync in front */
+#define TRUEHD_AUS 24
+static GstClockTime
+fill_truehd (GstMapInfo * map, guint64 index)
+{
+  guint au = map->size / TRUEHD_AUS;
+  guint i;
+
+  memset (map->data, 0, map->size);
+  for (i = 0; i < TRUEHD_AUS; i++) {
+    guint8 *d = map->data + i * au;
+    guint words = au / 2;
+
+    d[0] = (words >> 8) & 0x0f;
+    d[1] = words & 0xff;
+    if (i == 0) {
+      d[4] = 0xf8;
+      d[5] = 0x72;
+      d[6] = 0x6f;
+      d[7] = 0xba;
+    }
+  }
+  return gst_util_uint64_scale_int (40 * TRUEHD_AUS, GST_SECOND, 48000);
+}
+
+static const BenchFormat formats[] = {
+  {"pcm", "audio/x-raw,format=S16LE,rate=48000,channels=2,layout=interleaved,"
+        "channel-mask=(bitmask)0x3", fill_pcm, PCM_FRAMES * 4},
+  {"ac3", "audio/x-ac3,rate=48000,channels=2,framed=true,alignment=frame",
+      fill_ac3, 768},
+  {"eac3", "audio/x-eac3,rate=48000,channels=2,framed=true,alignment=frame",
+      fill_eac3, 768},
+  {"ac4", "audio/x-ac4,framed=true", fill_ac4, 512},
+  {"truehd", "audio/x-true-hd,framed=true", fill_truehd, 64 * TRUEHD_AUS},
+};
+
+typedef struct
+{
+  const BenchFormat *fmt;
+  GstElement *pipeline;
+  GstElement *src;
+  GstElement *sink;
+
+  /* generator thread */
+  GThread *feeder;
+  volatile gint quit;
+  guint64 index;
+  GstClockTime ts;
+  GMutex lock;
+  GstClockTime seek_to;         /* restart point after a seek */
+  gboolean seeked;
+
+  /* streaming thread stats */
+  gint64 last_push;
+  GArray *chain_us;
+  guint64 buffers;
+} Bench;
+
+static gpointer
+feeder_func (gpointer data)
+{
+  Bench *b = data;
+
+  while (!g_atomic_int_get (&b->quit)) {
+    GstBuffer *buf = gst_buffer_new_allocate (NULL, b->fmt->size, NULL);
+    GstMapInfo map;
+    GstClockTime dur;
+
+    gst_buffer_map (buf, &map, GST_MAP_WRITE);
+    dur = b->fmt->fill (&map, b->index++);
+    gst_buffer_unmap (buf, &map);
+
+    g_mutex_lock (&b->lock);
+    if (b->seeked) {
+      b->ts = b->seek_to;
+      b->seeked = FALSE;
+    }
+    GST_BUFFER_PTS (buf) = b->ts;
+    GST_BUFFER_DURATION (buf) = dur;
+    b->ts += dur;
+    g_mutex_unlock (&b->lock);
+
+    /* blocks while the appsrc queue is full */
+    if (gst_app_src_push_buffer (GST_APP_SRC (b->src), buf) != GST_FLOW_OK) {
+      if (g_atomic_int_get (&b->quit))
+        break;
+      g_usleep (1000);
+    }
+  }
+  return NULL;
+}
+
+/* appsrc asks for data from @offset, in time format for us */
+static gboolean
+seek_data (GstAppSrc * src, guint64 offset, gpointer data)
+{
+  Bench *b = data;
+
+  g_mutex_lock (&b->lock);
+  b->seek_to = offset;
+  b->seeked = TRUE;
+  g_mutex_unlock (&b->lock);
+  return TRUE;
+}
+
+static GstPadProbeReturn
+push_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  Bench *b = data;
+  gint64 now = g_get_monotonic_time ();
+
+  count_allocs = TRUE;
+  /* the previous chain call returned right before this push */
+  if (b->last_push && b->chain_us->len < (1 << 18) &&
+      gst_app_src_get_current_level_bytes (GST_APP_SRC (b->src))) {
+    gint64 d = now - b->last_push;
+
+    g_array_append_val (b->chain_us, d);
+  }
+  b->last_push = now;
+  b->buffers++;
+  return GST_PAD_PROBE_OK;
+}
+
+static guint64
+sink_rendered (Bench * b)
+{
+  GstStructure *s = NULL;
+  guint64 rendered = 0;
+
+  g_object_get (b->sink, "stats", &s, NULL);
+  if (s) {
+    gst_structure_get_uint64 (s, "rendered", &rendered);
+    gst_structure_free (s);
+  }
+  return rendered;
+}
+
+/* ms until the sink renders, -1 on timeout */
+static gdouble
+wait_first_render (Bench * b, gint64 start, gint64 timeout_us)
+{
+  while (g_get_monotonic_time () - start < timeout_us) {
+    if (sink_rendered (b) > 0)
+      return (g_get_monotonic_time () - start) / 1000.0;
+    g_usleep (500);
+  }
+  return -1;
+}
+
+static gdouble
+cpu_seconds (void)
+{
+  struct rusage ru;
+
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+      ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static gint
+cmp_i64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static gint64
+percentile (GArray * a, gdouble p)
+{
+  guint i;
+
+  if (!a->len)
+    return 0;
+  i = (guint) (p * (a->len - 1));
+  return g_array_index (a, gint64, i);
+}
+
+/* build appsrc ! amlhalasink and start feeding, still in NULL state */
+static gboolean
+bench_setup (Bench * b, const BenchFormat * fmt, gboolean direct)
+{
+  GstCaps *caps;
+  GstPad *pad;
+
+  b->fmt = fmt;
+  /* sized up front so the probe does not allocate */
+  b->chain_us = g_array_sized_new (FALSE, FALSE, sizeof (gint64), 1 << 18);
+  g_mutex_init (&b->lock);
+
+  b->pipeline = gst_pipeline_new ("bench");
+  b->src = gst_element_factory_make ("appsrc", NULL);
+  b->sink = gst_element_factory_make ("amlhalasink", NULL);
+  if (!b->pipeline || !b->src || !b->sink) {
+    g_printerr ("missing appsrc or amlhalasink\n");
+    return FALSE;
+  }
+  caps = gst_caps_from_string (fmt->caps);
+  g_object_set (b->src, "caps", caps, "format", GST_FORMAT_TIME,
+      "block", TRUE, "max-bytes", (guint64) fmt->size * 8,
+      "stream-type", GST_APP_STREAM_TYPE_SEEKABLE, NULL);
+  g_signal_connect (b->src, "seek-data", G_CALLBACK (seek_data), b);
+  gst_caps_unref (caps);
+  g_object_set (b->sink, "direct-mode", direct, NULL);
+  gst_bin_add_many (GST_BIN (b->pipeline), b->src, b->sink, NULL);
+  gst_element_link (b->src, b->sink);
+
+  pad = gst_element_get_static_pad (b->src, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, push_probe, b, NULL);
+  gst_object_unref (pad);
+
+  b->feeder = g_thread_new ("bench_feed", feeder_func, b);
+  return TRUE;
+}
+
+static void
+bench_stop (Bench * b)
+{
+  g_atomic_int_set (&b->quit, 1);
+  gst_element_set_state (b->pipeline, GST_STATE_NULL);
+  g_thread_join (b->feeder);
+}
+
+static void
+bench_free (Bench * b)
+{
+  if (b->pipeline)
+    gst_object_unref (b->pipeline);
+  else if (b->src)
+    gst_object_unref (b->src);
+  if (!b->pipeline && b->sink)
+    gst_object_unref (b->sink);
+  g_array_free (b->chain_us, TRUE);
+  g_mutex_clear (&b->lock);
+}
+
+static gboolean
+run_format (const BenchFormat * fmt, gint seconds, gint seeks,
+    gboolean direct, GString * out)
+{
+  Bench b = { 0, };
+  GstStateChangeReturn ret;
+  gdouble first_ms, cpu0 = 0, cpu1 = 0, seek_sum = 0, seek_max = 0;
+  gint64 start, allocs0 = 0;
+  guint64 buffers0 = 0;
+  gint i, seeks_done = 0;
+
+  if (!bench_setup (&b, fmt, direct)) {
+    bench_free (&b);
+    return FALSE;
+  }
+
+  start = g_get_monotonic_time ();
+  ret = gst_element_set_state (b.pipeline, GST_STATE_PLAYING);
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("%s: failed to start\n", fmt->name);
+    first_ms = -1;
+    goto stop;
+  }
+  first_ms = wait_first_render (&b, start, 5 * G_USEC_PER_SEC);
+
+  /* steady state */
+  cpu0 = cpu_seconds ();
+  allocs0 = __atomic_load_n (&n_allocs, __ATOMIC_RELAXED);
+  buffers0 = b.buffers;
+  g_usleep ((gulong) seconds * G_USEC_PER_SEC);
+  cpu1 = cpu_seconds ();
+
+  for (i = 0; i < seeks; i++) {
+    GstClockTime pos = (i + 1) * 10 * GST_SECOND;
+    gdouble ms;
+
+    start = g_get_monotonic_time ();
+    if (!gst_element_seek_simple (b.pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH, pos))
+      continue;
+    ms = wait_first_render (&b, start, 5 * G_USEC_PER_SEC);
+    if (ms < 0)
+      continue;
+    seek_sum += ms;
+    seek_max = MAX (seek_max, ms);
+    seeks_done++;
+    g_usleep (200 * 1000);
+  }
+
+stop:
+  bench_stop (&b);
+
+  g_array_sort (b.chain_us, cmp_i64);
+  g_string_append_printf (out,
+      "{\"format\":\"%s\",\"direct\":%s,\"audio_seconds\":%d,"
+      "\"cpu_ms_per_audio_s\":%.3f,\"allocs_per_buffer\":%.2f,"
+      "\"chain_us\":{\"samples\":%u,\"p50\":%" G_GINT64_FORMAT
+      ",\"p90\":%" G_GINT64_FORMAT ",\"p99\":%" G_GINT64_FORMAT
+      ",\"max\":%" G_GINT64_FORMAT "},"
+      "\"first_commit_ms\":%.2f,"
+      "\"seek_ms\":{\"count\":%d,\"avg\":%.2f,\"max\":%.2f}}\n",
+      fmt->name, direct ? "true" : "false", seconds,
+      ret == GST_STATE_CHANGE_FAILURE ? 0 : (cpu1 - cpu0) * 1000 / seconds,
+      b.buffers > buffers0 ?
+      (gdouble) (__atomic_load_n (&n_allocs, __ATOMIC_RELAXED) - allocs0) /
+      (b.buffers - buffers0) : 0,
+      b.chain_us->len, percentile (b.chain_us, 0.5),
+      percentile (b.chain_us, 0.9), percentile (b.chain_us, 0.99),
+      percentile (b.chain_us, 1.0), first_ms, seeks_done,
+      seeks_done ? seek_sum / seeks_done : 0, seek_max);
+
+  bench_free (&b);
+  return ret != GST_STATE_CHANGE_FAILURE;
+}
+
+/* rendered buffers per second of @n pipelines running side by side,
+ * written to @rate, @stalled and @errors count instances that never
+ * rendered or posted an error */
+static gboolean
+run_concurrent (const BenchFormat * fmt, gint seconds, gint n,
+    gboolean direct, gdouble * rate, gint * stalled, gint * errors)
+{
+  Bench *b = g_new0 (Bench, n);
+  guint64 *rendered0 = g_new0 (guint64, n);
+  gboolean ok = TRUE;
+  gint64 start;
+  gint i;
+
+  *stalled = *errors = 0;
+  for (i = 0; i < n && ok; i++)
+    ok = bench_setup (&b[i], fmt, direct);
+  if (!ok) {
+    n = i;
+    goto done;
+  }
+
+  /* start all of them before waiting so the opens overlap */
+  for (i = 0; i < n; i++) {
+    if (gst_element_set_state (b[i].pipeline, GST_STATE_PLAYING) ==
+        GST_STATE_CHANGE_FAILURE) {
+      g_printerr ("%s: instance %d failed to start\n", fmt->name, i);
+      ok = FALSE;
+    }
+  }
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n; i++)
+    wait_first_render (&b[i], start, 5 * G_USEC_PER_SEC);
+
+  for (i = 0; i < n; i++)
+    rendered0[i] = sink_rendered (&b[i]);
+  start = g_get_monotonic_time ();
+  g_usleep ((gulong) seconds * G_USEC_PER_SEC);
+  for (i = 0; i < n; i++) {
+    gdouble secs = (g_get_monotonic_time () - start) / 1e6;
+
+    rate[i] = (sink_rendered (&b[i]) - rendered0[i]) / secs;
+    if (rate[i] <= 0)
+      (*stalled)++;
+  }
+
+done:
+  for (i = 0; i < n; i++) {
+    GstBus *bus;
+    GstMessage *msg;
+
+    if (b[i].feeder)
+      bench_stop (&b[i]);
+    if (b[i].pipeline) {
+      bus = gst_element_get_bus (b[i].pipeline);
+      while ((msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR))) {
+        (*errors)++;
+        gst_message_unref (msg);
+      }
+      gst_object_unref (bus);
+    }
+    bench_free (&b[i]);
+  }
+  g_free (rendered0);
+  g_free (b);
+  return ok;
+}
+
+static gboolean
+run_stress (const BenchFormat * fmt, gint seconds, gint instances,
+    gboolean direct, GString * out)
+{
+  gdouble single = 0, total = 0;
+  gdouble *rate = g_new0 (gdouble, instances);
+  gint stalled, errors, i;
+  gboolean ok;
+
+  ok = run_concurrent (fmt, seconds, 1, direct, &single, &stalled, &errors);
+  ok &= run_concurrent (fmt, seconds, instances, direct, rate, &stalled,
+      &errors);
+
+  g_string_append_printf (out,
+      "{\"format\":\"%s\",\"direct\":%s,\"instances\":%d,"
+      "\"single_buffers_per_s\":%.1f,\"buffers_per_s\":[",
+      fmt->name, direct ? "true" : "false", instances, single);
+  for (i = 0; i < instances; i++) {
+    total += rate[i];
+    g_string_append_printf (out, "%s%.1f", i ? "," : "", rate[i]);
+  }
+  g_string_append_printf (out,
+      "],\"aggregate_buffers_per_s\":%.1f,\"scaling\":%.3f,"
+      "\"stalled\":%d,\"errors\":%d}\n", total,
+      single > 0 ? total / (single * instances) : 0, stalled, errors);
+
+  g_free (rate);
+  return ok && !stalled && !errors;
+}
+
+int
+main (int argc, char **argv)
+{
+  gchar *format = NULL, *output = NULL, *plugin_path = NULL;
+  gint seconds = 5, seeks = 3, instances = 0;
+  gboolean direct = FALSE, ok = TRUE;
+  GOptionEntry entries[] = {
+    {"format", 'f', 0, G_OPTION_ARG_STRING, &format,
+        "pcm, ac3, eac3, ac4, truehd or all (default)", NULL},
+    {"seconds", 's', 0, G_OPTION_ARG_INT, &seconds,
+        "steady state run time per format", NULL},
+    {"seeks", 'n', 0, G_OPTION_ARG_INT, &seeks, "flushing seeks", NULL},
+    {"direct", 'd', 0, G_OPTION_ARG_NONE, &direct,
+        "use direct-mode, needs the avsync simulation", NULL},
+    {"instances", 'i', 0, G_OPTION_ARG_INT, &instances,
+        "also run N pipelines at once and report scaling", NULL},
+    {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+        "write JSON lines here instead of stdout", NULL},
+    {"plugin-path", 'p', 0, G_OPTION_ARG_FILENAME, &plugin_path,
+        "directory holding libgstamlhalasink.so", NULL},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GString *out;
+  guint i;
+
+  ctx = g_option_context_new ("- amlhalasink benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  /* the stand-ins, unless the caller configured them. write() pacing
+   * would hold every instance at real time, the stress run wants to see
+   * how far the sink itself scales */
+  g_setenv ("AMLASINK_MOCK_HAL", instances > 1 ? "block=0" : "1", FALSE);
+  g_setenv ("AMLASINK_AVSYNC_SIM", "1", FALSE);
+  if (plugin_path)
+    gst_registry_scan_path (gst_registry_get (), plugin_path);
+
+  out = g_string_new (NULL);
+  for (i = 0; i < G_N_ELEMENTS (formats); i++) {
+    if (format && g_strcmp0 (format, "all") && g_strcmp0 (format, formats[i].name))
+      continue;
+    ok &= run_format (&formats[i], seconds, seeks, direct, out);
+    if (instances > 1)
+      ok &= run_stress (&formats[i], seconds, instances, direct, out);
+  }
+
+  if (output) {
+    if (!g_file_set_contents (output, out->str, out->len, &err)) {
+      g_printerr ("%s\n", err->message);
+      ok = FALSE;
+    }
+  } else {
+    fputs (out->str, stdout);
+  }
+  g_string_free (out, TRUE);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,368 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+/* Feed a trace recorded by amlhalasink (trace-location property or env
+ * AMLASINK_TRACE) back into a fresh sink with the recorded timing, so a
+ * field underrun can be chased on a desk against the mock HAL.
+ *
+ *   amlasink_replay --output=replay.json capture.abtr
+ *
+ * Buffers and serialized events go through a streaming thread, flush start
+ * and state changes are done from the main thread at their own times, the
+ * same way upstream and the application did them. */
+
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+#include "buf_trace.h"
+
+typedef struct
+{
+  GPtrArray *recs;
+  GstElement *pipeline;
+  GstElement *sink;
+  GstPad *src;
+  gint64 base;                  /* monotonic time of trace t 0 */
+  gboolean payload;
+
+  /* index of the first out of band record not done yet */
+  gint oob_next;
+  GMutex lock;
+  GCond cond;
+
+  gint xruns;
+  guint buffers;
+  guint flow_errors;
+} Replay;
+
+static gboolean
+is_oob (const struct buf_trace_rec *rec)
+{
+  return rec->type == BUF_TRACE_FLUSH_START || rec->type == BUF_TRACE_STATE ||
+      rec->type == BUF_TRACE_XRUN;
+}
+
+static void
+wait_until (Replay * r, gint64 t_us)
+{
+  gint64 d = r->base + t_us - g_get_monotonic_time ();
+
+  if (d > 0)
+    g_usleep (d);
+}
+
+static void
+xrun_cb (GstElement * sink, guint arg, gpointer ptr, gpointer data)
+{
+  Replay *r = data;
+
+  g_atomic_int_inc (&r->xruns);
+}
+
+static GstBuffer *
+make_buffer (Replay * r, const struct buf_trace_rec *rec)
+{
+  GstBuffer *buf;
+
+  if (rec->payload) {
+    buf = gst_buffer_new_allocate (NULL, rec->size, NULL);
+    gst_buffer_fill (buf, 0, rec->payload, rec->size);
+  } else {
+    GstMapInfo map;
+
+    /* silence for PCM, garbage for the decoders */
+    buf = gst_buffer_new_allocate (NULL, rec->size, NULL);
+    gst_buffer_map (buf, &map, GST_MAP_WRITE);
+    memset (map.data, 0, map.size);
+    gst_buffer_unmap (buf, &map);
+  }
+  GST_BUFFER_PTS (buf) = rec->pts;
+  GST_BUFFER_DURATION (buf) = rec->duration;
+  GST_BUFFER_FLAGS (buf) = rec->flags;
+  return buf;
+}
+
+static gpointer
+stream_func (gpointer data)
+{
+  Replay *r = data;
+  gboolean started = FALSE;
+  guint i;
+
+  for (i = 0; i < r->recs->len; i++) {
+    struct buf_trace_rec *rec = g_ptr_array_index (r->recs, i);
+    GstEvent *event = NULL;
+
+    if (is_oob (rec))
+      continue;
+
+    /* keep the order against flush start and state changes */
+    g_mutex_lock (&r->lock);
+    while (r->oob_next < (gint) i)
+      g_cond_wait (&r->cond, &r->lock);
+    g_mutex_unlock (&r->lock);
+    wait_until (r, rec->t_us);
+
+    if (!started) {
+      gst_pad_push_event (r->src, gst_event_new_stream_start ("replay"));
+      started = TRUE;
+    }
+
+    switch (rec->type) {
+      case BUF_TRACE_BUFFER:
+      {
+        GstFlowReturn ret = gst_pad_push (r->src, make_buffer (r, rec));
+
+        r->buffers++;
+        if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING) {
+          g_printerr ("buffer %u pts %" GST_TIME_FORMAT " flow %s\n",
+              r->buffers, GST_TIME_ARGS (rec->pts), gst_flow_get_name (ret));
+          r->flow_errors++;
+        }
+        break;
+      }
+      case BUF_TRACE_CAPS:
+      {
+        GstCaps *caps = gst_caps_from_string (rec->caps);
+
+        if (caps) {
+          event = gst_event_new_caps (caps);
+          gst_caps_unref (caps);
+        } else {
+          g_printerr ("bad caps %s\n", rec->caps);
+        }
+        break;
+      }
+      case BUF_TRACE_SEGMENT:
+        event = gst_event_new_segment (&rec->segment);
+        break;
+      case BUF_TRACE_FLUSH_STOP:
+        event = gst_event_new_flush_stop (rec->reset_time);
+        break;
+      case BUF_TRACE_GAP:
+        event = gst_event_new_gap (rec->pts, rec->duration);
+        break;
+      case BUF_TRACE_EOS:
+        event = gst_event_new_eos ();
+        break;
+      default:
+        break;
+    }
+    if (event)
+      gst_pad_push_event (r->src, event);
+  }
+  return NULL;
+}
+
+/* first pass, count what was recorded and warn about missing payload */
+static guint
+scan (Replay * r)
+{
+  gboolean compressed = FALSE;
+  guint i, xruns = 0;
+
+  r->payload = FALSE;
+  for (i = 0; i < r->recs->len; i++) {
+    struct buf_trace_rec *rec = g_ptr_array_index (r->recs, i);
+
+    if (rec->type == BUF_TRACE_XRUN)
+      xruns++;
+    else if (rec->type == BUF_TRACE_CAPS && !g_str_has_prefix (rec->caps,
+            "audio/x-raw"))
+      compressed = TRUE;
+    else if (rec->type == BUF_TRACE_BUFFER && rec->payload)
+      r->payload = TRUE;
+  }
+  if (compressed && !r->payload)
+    g_printerr ("compressed stream recorded without trace-payload, "
+        "decoder side results are meaningless\n");
+  return xruns;
+}
+
+static void
+free_rec (gpointer data)
+{
+  struct buf_trace_rec *rec = data;
+
+  buf_trace_rec_clear (rec);
+  g_free (rec);
+}
+
+static GPtrArray *
+load (const gchar * path, GError ** err)
+{
+  struct buf_trace_reader *rd;
+  struct buf_trace_rec *rec;
+  GPtrArray *recs;
+
+  rd = buf_trace_reader_open (path, err);
+  if (!rd)
+    return NULL;
+  recs = g_ptr_array_new_with_free_func (free_rec);
+  rec = g_new0 (struct buf_trace_rec, 1);
+  while (buf_trace_read (rd, rec)) {
+    g_ptr_array_add (recs, rec);
+    rec = g_new0 (struct buf_trace_rec, 1);
+  }
+  g_free (rec);
+  buf_trace_reader_close (rd);
+  return recs;
+}
+
+static void
+report_bus (Replay * r)
+{
+  GstBus *bus = gst_element_get_bus (r->pipeline);
+  GstMessage *msg;
+
+  while ((msg = gst_bus_pop_filtered (bus,
+              GST_MESSAGE_ERROR | GST_MESSAGE_WARNING))) {
+    GError *e = NULL;
+
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+      gst_message_parse_error (msg, &e, NULL);
+    else
+      gst_message_parse_warning (msg, &e, NULL);
+    g_printerr ("%s: %s\n", GST_MESSAGE_SRC_NAME (msg), e->message);
+    g_error_free (e);
+    gst_message_unref (msg);
+  }
+  gst_object_unref (bus);
+}
+
+int
+main (int argc, char **argv)
+{
+  gchar *output = NULL, *plugin_path = NULL;
+  gint tail_ms = 1000;
+  GOptionEntry entries[] = {
+    {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+        "write the JSON result here instead of stdout", NULL},
+    {"tail", 't', 0, G_OPTION_ARG_INT, &tail_ms,
+        "ms to keep running after the last record", NULL},
+    {"plugin-path", 'p', 0, G_OPTION_ARG_FILENAME, &plugin_path,
+        "directory holding libgstamlhalasink.so", NULL},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  Replay r;
+  GThread *stream;
+  GstPad *sinkpad;
+  gchar *json;
+  guint recorded_xruns, i;
+  gint64 duration = 0;
+  gboolean ok = TRUE;
+
+  /* the stand-ins, unless the caller configured them */
+  g_setenv ("AMLASINK_MOCK_HAL", "1", FALSE);
+  g_setenv ("AMLASINK_AVSYNC_SIM", "1", FALSE);
+  /* never record the replay over the input */
+  g_unsetenv ("AMLASINK_TRACE");
+
+  ctx = g_option_context_new ("TRACE - replay an amlhalasink buffer trace");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  if (argc != 2) {
+    g_printerr ("need exactly one trace file\n");
+    return 1;
+  }
+  if (plugin_path)
+    gst_registry_scan_path (gst_registry_get (), plugin_path);
+
+  memset (&r, 0, sizeof (r));
+  g_mutex_init (&r.lock);
+  g_cond_init (&r.cond);
+  r.recs = load (argv[1], &err);
+  if (!r.recs) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  recorded_xruns = scan (&r);
+
+  r.pipeline = gst_pipeline_new ("replay");
+  r.sink = gst_element_factory_make ("amlhalasink", NULL);
+  if (!r.sink) {
+    g_printerr ("amlhalasink not found, try --plugin-path\n");
+    return 1;
+  }
+  gst_bin_add (GST_BIN (r.pipeline), r.sink);
+  g_signal_connect (r.sink, "underrun-callback", G_CALLBACK (xrun_cb), &r);
+
+  r.src = gst_pad_new ("src", GST_PAD_SRC);
+  sinkpad = gst_element_get_static_pad (r.sink, "sink");
+  gst_pad_set_active (r.src, TRUE);
+  gst_pad_link (r.src, sinkpad);
+  gst_object_unref (sinkpad);
+
+  r.base = g_get_monotonic_time ();
+  if (r.recs->len)
+    r.base -= ((struct buf_trace_rec *) g_ptr_array_index (r.recs, 0))->t_us;
+  stream = g_thread_new ("replay_stream", stream_func, &r);
+
+  for (i = 0; i < r.recs->len; i++) {
+    struct buf_trace_rec *rec = g_ptr_array_index (r.recs, i);
+
+    if (is_oob (rec)) {
+      wait_until (&r, rec->t_us);
+      if (rec->type == BUF_TRACE_FLUSH_START)
+        gst_pad_push_event (r.src, gst_event_new_flush_start ());
+      else if (rec->type == BUF_TRACE_STATE)
+        gst_element_set_state (r.pipeline,
+            GST_STATE_TRANSITION_NEXT (rec->transition));
+    }
+    g_mutex_lock (&r.lock);
+    r.oob_next = i + 1;
+    g_cond_broadcast (&r.cond);
+    g_mutex_unlock (&r.lock);
+  }
+
+  g_thread_join (stream);
+  if (r.recs->len)
+    duration = ((struct buf_trace_rec *) g_ptr_array_index (r.recs,
+            r.recs->len - 1))->t_us;
+  g_usleep ((gulong) tail_ms * 1000);
+  report_bus (&r);
+  gst_element_set_state (r.pipeline, GST_STATE_NULL);
+
+  json = g_strdup_printf ("{\"trace\":\"%s\",\"records\":%u,\"buffers\":%u,"
+      "\"payload\":%s,\"duration_ms\":%.1f,\"recorded_xruns\":%u,"
+      "\"replayed_xruns\":%d,\"flow_errors\":%u}\n", argv[1], r.recs->len,
+      r.buffers, r.payload ? "true" : "false", duration / 1000.0,
+      recorded_xruns, g_atomic_int_get (&r.xruns), r.flow_errors);
+  if (output) {
+    if (!g_file_set_contents (output, json, -1, &err)) {
+      g_printerr ("%s\n", err->message);
+      ok = FALSE;
+    }
+  } else {
+    fputs (json, stdout);
+  }
+
+  g_free (json);
+  gst_object_unref (r.src);
+  gst_object_unref (r.pipeline);
+  g_ptr_array_free (r.recs, TRUE);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,774 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <aml_avsync.h>
+#include <aml_avsync_log.h>
+#include "mediasync_wrap.h"
+#include "avsync_sim.h"
+
+/* anchors queued ahead of their presentation time */
+#define ANCHORS 16
+#define PTS_INVALID ((uint64_t)-1)
+
+struct anchor {
+    uint64_t pts_ns;
+    int64_t at_us;
+};
+
+struct sim_session {
+    int used;
+    int refs;
+    enum sync_mode mode;
+    struct start_policy policy;
+    float speed;
+    bool audio_switch;
+
+    /* audio position model */
+    struct anchor anchors[ANCHORS];
+    int n_anchors;
+    struct anchor cur;          /* newest anchor already presented */
+    bool have_audio;
+    bool paused;
+    uint64_t paused_pts;
+
+    /* first audio, start of the simulated video and PCR */
+    uint64_t first_pts_ns;
+    int64_t first_us;
+};
+
+struct sim_sync {
+    int session;
+    enum sync_type type;
+};
+
+struct sim_opts {
+    int manual;
+    int64_t video_delay_us;
+    int64_t pcr_offset_us;
+    int drift_ppm;
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static struct sim_opts g_opts;
+static struct sim_session g_sessions[AVSYNC_SIM_MAX_SESSIONS];
+static int64_t g_base_us;
+static int64_t g_manual_us;
+
+static int64_t mono_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sim_init(void)
+{
+    const char *env = getenv("AMLASINK_AVSYNC_SIM");
+    char *dup, *tok, *save = NULL;
+
+    g_opts.video_delay_us = 40000;
+    g_base_us = mono_us();
+    if (!env || !strchr(env, '='))
+        return;
+    dup = strdup(env);
+    if (!dup)
+        return;
+    for (tok = strtok_r(dup, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        long v;
+
+        if (!eq)
+            continue;
+        *eq = 0;
+        v = strtol(eq + 1, NULL, 0);
+        if (!strcmp(tok, "clock"))
+            g_opts.manual = !strcmp(eq + 1, "manual");
+        else if (!strcmp(tok, "video_delay"))
+            g_opts.video_delay_us = (int64_t)v * 1000;
+        else if (!strcmp(tok, "pcr_offset"))
+            g_opts.pcr_offset_us = (int64_t)v * 1000;
+        else if (!strcmp(tok, "drift_ppm"))
+            g_opts.drift_ppm = v;
+    }
+    free(dup);
+}
+
+int avsync_sim_enabled(void)
+{
+#ifdef AVSYNC_SIM_ONLY
+    return 1;
+#else
+    const char *env = getenv("AMLASINK_AVSYNC_SIM");
+
+    return env && *env && strcmp(env, "0");
+#endif
+}
+
+int64_t avsync_sim_now_us(void)
+{
+    pthread_once(&g_once, sim_init);
+    if (g_opts.manual)
+        return __atomic_load_n(&g_manual_us, __ATOMIC_ACQUIRE);
+    return mono_us() - g_base_us;
+}
+
+void avsync_sim_advance(int64_t us)
+{
+    pthread_once(&g_once, sim_init);
+    if (g_opts.manual && us > 0)
+        __atomic_add_fetch(&g_manual_us, us, __ATOMIC_RELEASE);
+}
+
+static struct sim_session * session_get(int id)
+{
+    if (id < 0 || id >= AVSYNC_SIM_MAX_SESSIONS || !g_sessions[id].used)
+        return NULL;
+    return &g_sessions[id];
+}
+
+static int session_open(void)
+{
+    int i;
+
+    pthread_once(&g_once, sim_init);
+    for (i = 0; i < AVSYNC_SIM_MAX_SESSIONS; i++) {
+        struct sim_session *s = &g_sessions[i];
+
+        if (!s->used) {
+            memset(s, 0, sizeof(*s));
+            s->used = 1;
+            s->speed = 1.0f;
+            s->mode = AV_SYNC_MODE_FREE_RUN;
+            s->policy.policy = AV_SYNC_START_ASAP;
+            s->policy.timeout = -1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void audio_reset(struct sim_session *s)
+{
+    s->n_anchors = 0;
+    s->have_audio = false;
+    s->paused = false;
+    s->first_pts_ns = PTS_INVALID;
+}
+
+/* promote anchors whose presentation time passed, lock held */
+static void session_update(struct sim_session *s, int64_t now)
+{
+    int i, n = 0;
+
+    for (i = 0; i < s->n_anchors && s->anchors[i].at_us <= now; i++)
+        n = i + 1;
+    if (!n)
+        return;
+    s->cur = s->anchors[n - 1];
+    if (!s->have_audio) {
+        s->have_audio = true;
+        s->first_pts_ns = s->anchors[0].pts_ns;
+        s->first_us = s->anchors[0].at_us;
+    }
+    memmove(s->anchors, s->anchors + n, (s->n_anchors - n) * sizeof(s->anchors[0]));
+    s->n_anchors -= n;
+}
+
+static uint64_t audio_pos_ns(struct sim_session *s, int64_t now)
+{
+    if (!s->have_audio)
+        return PTS_INVALID;
+    if (s->paused)
+        return s->paused_pts;
+    return s->cur.pts_ns + (uint64_t)((now - s->cur.at_us) * 1000 * (double)s->speed);
+}
+
+static bool session_started(struct sim_session *s, int64_t now)
+{
+    if (!s->have_audio)
+        return false;
+    if (s->policy.policy != AV_SYNC_START_ALIGN)
+        return true;
+    /* align waits for the simulated first video frame or the timeout */
+    if (now - s->first_us >= g_opts.video_delay_us)
+        return true;
+    return s->policy.timeout >= 0 &&
+        now - s->first_us >= (int64_t)s->policy.timeout * 1000;
+}
+
+static uint64_t video_pos_ns(struct sim_session *s, int64_t now)
+{
+    int64_t vstart;
+
+    if (!s->have_audio)
+        return PTS_INVALID;
+    vstart = s->first_us + g_opts.video_delay_us;
+    if (now < vstart)
+        return PTS_INVALID;
+    return s->first_pts_ns + (uint64_t)((now - vstart) * 1000 * (double)s->speed);
+}
+
+static uint64_t pcr_ns(struct sim_session *s, int64_t now)
+{
+    int64_t el;
+
+    if (!s->have_audio)
+        return PTS_INVALID;
+    el = now - s->first_us + g_opts.pcr_offset_us;
+    el += el * g_opts.drift_ppm / 1000000;
+    return s->first_pts_ns + (uint64_t)(el * 1000);
+}
+
+/* system clock of the session, lock held */
+static uint64_t clock_ns(struct sim_session *s, int64_t now)
+{
+    session_update(s, now);
+    if (!session_started(s, now))
+        return PTS_INVALID;
+    switch (s->mode) {
+    case AV_SYNC_MODE_VMASTER:
+        return video_pos_ns(s, now);
+    case AV_SYNC_MODE_PCR_MASTER:
+        return pcr_ns(s, now);
+    default:
+        return audio_pos_ns(s, now);
+    }
+}
+
+static pts90K to_90k(uint64_t ns)
+{
+    if (ns == PTS_INVALID)
+        return (pts90K)-1;
+    return (pts90K)(ns * 9 / 100000);
+}
+
+void avsync_sim_audio_pts(int session, uint64_t pts_ns, int64_t present_us)
+{
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(session);
+    if (s) {
+        session_update(s, avsync_sim_now_us());
+        if (s->n_anchors == ANCHORS) {
+            memmove(s->anchors, s->anchors + 1, (ANCHORS - 1) * sizeof(s->anchors[0]));
+            s->n_anchors--;
+        }
+        s->anchors[s->n_anchors].pts_ns = pts_ns;
+        s->anchors[s->n_anchors].at_us = present_us;
+        s->n_anchors++;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void avsync_sim_audio_pause(int session, int pause)
+{
+    struct sim_session *s;
+    int64_t now = avsync_sim_now_us();
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(session);
+    if (s && s->paused != !!pause) {
+        session_update(s, now);
+        if (pause) {
+            s->paused_pts = audio_pos_ns(s, now);
+            s->paused = true;
+        } else {
+            /* continue from where it froze */
+            s->paused = false;
+            s->cur.pts_ns = s->paused_pts;
+            s->cur.at_us = now;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void avsync_sim_audio_flush(int session)
+{
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(session);
+    if (s)
+        audio_reset(s);
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* MediaSync, handles are bound to a session by bindInstance */
+struct sim_mediasync {
+    int session;
+    float rate;
+};
+
+static void * sim_MediaSync_create(void)
+{
+    struct sim_mediasync *ms = calloc(1, sizeof(*ms));
+
+    if (ms) {
+        ms->session = -1;
+        ms->rate = 1.0f;
+    }
+    return ms;
+}
+
+static mediasync_result sim_MediaSync_allocInstance(void *handle,
+        int32_t DemuxId, int32_t PcrPid, int32_t *SyncInsId)
+{
+    struct sim_mediasync *ms = handle;
+    int id;
+
+    (void)DemuxId;
+    (void)PcrPid;
+    pthread_mutex_lock(&g_lock);
+    id = session_open();
+    if (id >= 0) {
+        g_sessions[id].refs = 1;
+        g_sessions[id].mode = PcrPid > 0 ? AV_SYNC_MODE_PCR_MASTER : AV_SYNC_MODE_AMASTER;
+        audio_reset(&g_sessions[id]);
+    }
+    pthread_mutex_unlock(&g_lock);
+    if (id < 0)
+        return AM_MEDIASYNC_ERROR_BUSY;
+    ms->session = id;
+    *SyncInsId = id;
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_bindInstance(void *handle,
+        uint32_t SyncInsId, sync_stream_type streamtype)
+{
+    struct sim_mediasync *ms = handle;
+    mediasync_result ret = AM_MEDIASYNC_ERROR_INVALID_PARAMS;
+
+    (void)streamtype;
+    pthread_mutex_lock(&g_lock);
+    if (session_get(SyncInsId)) {
+        ms->session = SyncInsId;
+        ret = AM_MEDIASYNC_OK;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+static mediasync_result sim_MediaSync_setPlaybackRate(void *handle, float rate)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+    int64_t now = avsync_sim_now_us();
+
+    if (rate <= 0)
+        return AM_MEDIASYNC_ERROR_INVALID_PARAMS;
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s) {
+        /* re-anchor so the position stays continuous */
+        session_update(s, now);
+        if (s->have_audio && !s->paused) {
+            s->cur.pts_ns = audio_pos_ns(s, now);
+            s->cur.at_us = now;
+        }
+        s->speed = rate;
+    }
+    ms->rate = rate;
+    pthread_mutex_unlock(&g_lock);
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_getPlaybackRate(void *handle, float *rate)
+{
+    *rate = ((struct sim_mediasync *)handle)->rate;
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_getMediaTime(void *handle, int64_t realUs,
+        int64_t *outMediaUs, bool allowPastMaxTime)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+    mediasync_result ret = AM_MEDIASYNC_ERROR_INVALID_OPERATION;
+
+    (void)allowPastMaxTime;
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s) {
+        uint64_t ns = clock_ns(s, realUs);
+
+        if (ns != PTS_INVALID) {
+            *outMediaUs = ns / 1000;
+            ret = AM_MEDIASYNC_OK;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+static mediasync_result sim_MediaSync_getRealTimeFor(void *handle,
+        int64_t targetMediaUs, int64_t *outRealUs)
+{
+    struct sim_mediasync *ms = handle;
+    int64_t now = avsync_sim_now_us();
+    int64_t media;
+
+    if (sim_MediaSync_getMediaTime(handle, now, &media, false) != AM_MEDIASYNC_OK)
+        return AM_MEDIASYNC_ERROR_INVALID_OPERATION;
+    *outRealUs = now + (int64_t)((targetMediaUs - media) / (double)ms->rate);
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_getRealTimeForNextVsync(void *handle,
+        int64_t *outRealUs)
+{
+    int64_t now = avsync_sim_now_us();
+
+    (void)handle;
+    /* 60 Hz display */
+    *outRealUs = now + 16667 - now % 16667;
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_getTrackMediaTime(void *handle,
+        int64_t *outMediaUs)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+    uint64_t ns = PTS_INVALID;
+    int64_t now = avsync_sim_now_us();
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s) {
+        session_update(s, now);
+        ns = audio_pos_ns(s, now);
+    }
+    pthread_mutex_unlock(&g_lock);
+    if (ns == PTS_INVALID)
+        return AM_MEDIASYNC_ERROR_INVALID_OPERATION;
+    *outMediaUs = ns / 1000;
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_GetMediaTimeByType(void *handle,
+        media_time_type mediaTimeType, mediasync_time_unit tunit,
+        int64_t *mediaTime)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+    uint64_t ns = PTS_INVALID;
+    int64_t now = avsync_sim_now_us();
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s) {
+        session_update(s, now);
+        switch (mediaTimeType) {
+        case MEDIA_VIDEO_TIME:
+            ns = video_pos_ns(s, now);
+            break;
+        case MEDIA_AUDIO_TIME:
+            ns = audio_pos_ns(s, now);
+            break;
+        case MEDIA_DMXPCR_TIME:
+            ns = pcr_ns(s, now);
+            break;
+        default:
+            ns = clock_ns(s, now);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (ns == PTS_INVALID)
+        *mediaTime = -1;
+    else if (tunit == MEDIASYNC_UNIT_MS)
+        *mediaTime = ns / 1000000;
+    else if (tunit == MEDIASYNC_UNIT_PTS)
+        *mediaTime = ns * 9 / 100000;
+    else
+        *mediaTime = ns / 1000;
+    return s ? AM_MEDIASYNC_OK : AM_MEDIASYNC_ERROR_INVALID_OBJECT;
+}
+
+static mediasync_result sim_MediaSync_audioSwitch(void *handle, bool start,
+        int64_t pts)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+
+    (void)pts;
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s)
+        s->audio_switch = start;
+    pthread_mutex_unlock(&g_lock);
+    return AM_MEDIASYNC_OK;
+}
+
+static mediasync_result sim_MediaSync_reset(void *handle)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s)
+        audio_reset(s);
+    pthread_mutex_unlock(&g_lock);
+    return AM_MEDIASYNC_OK;
+}
+
+static void sim_MediaSync_destroy(void *handle)
+{
+    struct sim_mediasync *ms = handle;
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ms->session);
+    if (s && --s->refs <= 0)
+        s->used = 0;
+    pthread_mutex_unlock(&g_lock);
+    free(ms);
+}
+
+void * avsync_sim_mediasync_sym(const char *name)
+{
+    static const struct {
+        const char *name;
+        void *func;
+    } syms[] = {
+        { "MediaSync_create", (void *)sim_MediaSync_create },
+        { "MediaSync_allocInstance", (void *)sim_MediaSync_allocInstance },
+        { "MediaSync_bindInstance", (void *)sim_MediaSync_bindInstance },
+        { "MediaSync_setPlaybackRate", (void *)sim_MediaSync_setPlaybackRate },
+        { "MediaSync_getPlaybackRate", (void *)sim_MediaSync_getPlaybackRate },
+        { "MediaSync_getMediaTime", (void *)sim_MediaSync_getMediaTime },
+        { "MediaSync_getRealTimeFor", (void *)sim_MediaSync_getRealTimeFor },
+        { "MediaSync_getRealTimeForNextVsync", (void *)sim_MediaSync_getRealTimeForNextVsync },
+        { "MediaSync_getTrackMediaTime", (void *)sim_MediaSync_getTrackMediaTime },
+        { "MediaSync_GetMediaTimeByType", (void *)sim_MediaSync_GetMediaTimeByType },
+        { "MediaSync_audioSwitch", (void *)sim_MediaSync_audioSwitch },
+        { "MediaSync_reset", (void *)sim_MediaSync_reset },
+        { "MediaSync_destroy", (void *)sim_MediaSync_destroy },
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(syms) / sizeof(syms[0]); i++)
+        if (!strcmp(syms[i].name, name))
+            return syms[i].func;
+    return NULL;
+}
+
+#ifdef AVSYNC_SIM_ONLY
+/* libamlavsync API, the sync handle carries the session id */
+
+void log_set_level(int level)
+{
+    (void)level;
+}
+
+int av_sync_open_session(int *session_id)
+{
+    int id;
+
+    pthread_mutex_lock(&g_lock);
+    id = session_open();
+    if (id >= 0)
+        g_sessions[id].refs = 1;
+    pthread_mutex_unlock(&g_lock);
+    if (id < 0)
+        return -1;
+    *session_id = id;
+    return id;
+}
+
+void av_sync_close_session(int session)
+{
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(session);
+    if (s && --s->refs <= 0)
+        s->used = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void * sync_new(int session_id, enum sync_type type, int create,
+        enum sync_mode mode)
+{
+    struct sim_session *s;
+    struct sim_sync *sync = NULL;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(session_id);
+    if (s) {
+        sync = calloc(1, sizeof(*sync));
+        if (sync) {
+            sync->session = session_id;
+            sync->type = type;
+            s->refs++;
+            if (create) {
+                s->mode = mode;
+                audio_reset(s);
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return sync;
+}
+
+void * av_sync_create(int session_id, enum sync_mode mode, enum sync_type type,
+        int start_thres)
+{
+    (void)start_thres;
+    return sync_new(session_id, type, 1, mode);
+}
+
+void * av_sync_attach(int session_id, enum sync_type type)
+{
+    return sync_new(session_id, type, 0, AV_SYNC_MODE_FREE_RUN);
+}
+
+void av_sync_destroy(void *sync)
+{
+    struct sim_sync *ss = sync;
+
+    if (!ss)
+        return;
+    av_sync_close_session(ss->session);
+    free(ss);
+}
+
+int av_sync_get_clock(void *sync, pts90K *pts)
+{
+    struct sim_sync *ss = sync;
+    struct sim_session *s;
+    int ret = -1;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ss->session);
+    if (s) {
+        *pts = to_90k(clock_ns(s, avsync_sim_now_us()));
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+int av_sync_get_pos(void *sync, pts90K *pts, uint64_t *mono_clock)
+{
+    struct sim_sync *ss = sync;
+    struct sim_session *s;
+    int64_t now = avsync_sim_now_us();
+    int ret = -1;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(ss->session);
+    if (s) {
+        session_update(s, now);
+        *pts = to_90k(audio_pos_ns(s, now));
+        if (mono_clock)
+            *mono_clock = (uint64_t)now * 1000;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+int av_sync_set_speed(void *sync, float speed)
+{
+    struct sim_mediasync ms;
+
+    ms.session = ((struct sim_sync *)sync)->session;
+    return sim_MediaSync_setPlaybackRate(&ms, speed) == AM_MEDIASYNC_OK ? 0 : -1;
+}
+
+int av_sync_change_mode_by_id(int id, enum sync_mode mode)
+{
+    struct sim_session *s;
+    int ret = -1;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(id);
+    if (s) {
+        s->mode = mode;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+int av_sync_change_mode(void *sync, enum sync_mode mode)
+{
+    return av_sync_change_mode_by_id(((struct sim_sync *)sync)->session, mode);
+}
+
+int avs_sync_set_start_policy(void *sync, struct start_policy *st_policy)
+{
+    struct sim_session *s;
+    int ret = -1;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(((struct sim_sync *)sync)->session);
+    if (s) {
+        s->policy = *st_policy;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+int avs_sync_stop_audio(void *sync)
+{
+    /* nothing in the simulation blocks on the audio start */
+    (void)sync;
+    return 0;
+}
+
+int av_sync_set_audio_switch(void *sync, bool start)
+{
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(((struct sim_sync *)sync)->session);
+    if (s)
+        s->audio_switch = start;
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+int av_sync_get_audio_switch(void *sync, bool *start)
+{
+    struct sim_session *s;
+
+    pthread_mutex_lock(&g_lock);
+    s = session_get(((struct sim_sync *)sync)->session);
+    /* the simulated video side switches over right away */
+    if (s && s->audio_switch && session_started(s, avsync_sim_now_us()))
+        s->audio_switch = false;
+    *start = s ? s->audio_switch : false;
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+#endif
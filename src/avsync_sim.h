@@ -0,0 +1,57 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef AVSYNC_SIM_H_
+#define AVSYNC_SIM_H_
+
+#include <stdint.h>
+
+/* In-process stand-in for libamlavsync and libmediahal_mediasync.so.
+ *
+ * Sessions run on a simulated clock fed with audio positions by the mock
+ * HAL (see mock_hal.h) from the hw sync headers the sink writes. Start
+ * policies, sync modes, PCR master and playback rate are modelled so sync
+ * behaviour can be measured without a device.
+ *
+ * With --enable-avsync-sim the av_sync_* API is provided from here and
+ * libamlavsync is not linked. The MediaSync dlopen path is redirected here
+ * by env AMLASINK_AVSYNC_SIM as well, "1" for defaults or options:
+ *   clock=manual       time only moves by avsync_sim_advance()
+ *   video_delay=<ms>   first video frame after first audio (default 40)
+ *   pcr_offset=<ms>    PCR lead over first audio pts (default 0)
+ *   drift_ppm=<n>      PCR drift against the local clock (default 0) */
+
+#define AVSYNC_SIM_MAX_SESSIONS 8
+
+/* nonzero when the simulation is built in or selected by env */
+int avsync_sim_enabled(void);
+
+/* simulated monotonic time in us */
+int64_t avsync_sim_now_us(void);
+/* move the manual clock forward, no-op for the real time clock */
+void avsync_sim_advance(int64_t us);
+
+/* audio of @session with @pts_ns becomes audible at @present_us */
+void avsync_sim_audio_pts(int session, uint64_t pts_ns, int64_t present_us);
+void avsync_sim_audio_pause(int session, int pause);
+void avsync_sim_audio_flush(int session);
+
+/* stand-in for dlsym() on libmediahal_mediasync.so */
+void * avsync_sim_mediasync_sym(const char *name);
+
+#endif
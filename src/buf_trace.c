@@ -0,0 +1,352 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "buf_trace.h"
+
+#define BUF_TRACE_MAGIC "ABTR"
+
+struct buf_trace
+{
+  GMutex lock;
+  FILE *fp;
+  gboolean payload;
+  gint64 start;
+};
+
+struct buf_trace_reader
+{
+  FILE *fp;
+  guint32 flags;
+};
+
+struct seg_body
+{
+  guint32 format;
+  guint32 flags;
+  gdouble rate;
+  gdouble applied_rate;
+  guint64 base, offset, start, stop, time, position, duration;
+};
+
+struct buf_trace *
+buf_trace_open (const gchar * path, gboolean payload)
+{
+  struct buf_trace *bt;
+  guint32 hdr[2] = { BUF_TRACE_VERSION, payload ? BUF_TRACE_FLAG_PAYLOAD : 0 };
+  FILE *fp;
+
+  fp = fopen (path, "wb");
+  if (!fp)
+    return NULL;
+  /* records are small, a big stdio buffer keeps fwrite off the disk */
+  setvbuf (fp, NULL, _IOFBF, 256 * 1024);
+  fwrite (BUF_TRACE_MAGIC, 1, 4, fp);
+  fwrite (hdr, sizeof (hdr), 1, fp);
+
+  bt = g_new0 (struct buf_trace, 1);
+  g_mutex_init (&bt->lock);
+  bt->fp = fp;
+  bt->payload = payload;
+  bt->start = g_get_monotonic_time ();
+  return bt;
+}
+
+void
+buf_trace_close (struct buf_trace *bt)
+{
+  if (!bt)
+    return;
+  fclose (bt->fp);
+  g_mutex_clear (&bt->lock);
+  g_free (bt);
+}
+
+static void
+put_rec (struct buf_trace *bt, enum buf_trace_type type, const void *body,
+    guint32 len, const void *extra, guint32 extra_len)
+{
+  guint8 head[16] = { 0, };
+  gint64 t = g_get_monotonic_time () - bt->start;
+  guint32 total = len + extra_len;
+
+  head[0] = type;
+  memcpy (head + 4, &total, 4);
+  memcpy (head + 8, &t, 8);
+
+  g_mutex_lock (&bt->lock);
+  fwrite (head, sizeof (head), 1, bt->fp);
+  if (len)
+    fwrite (body, len, 1, bt->fp);
+  if (extra_len)
+    fwrite (extra, extra_len, 1, bt->fp);
+  g_mutex_unlock (&bt->lock);
+}
+
+void
+buf_trace_buffer (struct buf_trace *bt, GstBuffer * buf)
+{
+  guint8 body[24];
+  guint64 pts = GST_BUFFER_PTS (buf), dur = GST_BUFFER_DURATION (buf);
+  guint32 flags = GST_BUFFER_FLAGS (buf);
+  guint32 size = gst_buffer_get_size (buf);
+
+  if (!bt)
+    return;
+  memcpy (body, &pts, 8);
+  memcpy (body + 8, &dur, 8);
+  memcpy (body + 16, &flags, 4);
+  memcpy (body + 20, &size, 4);
+
+  if (bt->payload) {
+    GstMapInfo map;
+
+    if (gst_buffer_map (buf, &map, GST_MAP_READ)) {
+      put_rec (bt, BUF_TRACE_BUFFER, body, sizeof (body), map.data, map.size);
+      gst_buffer_unmap (buf, &map);
+      return;
+    }
+  }
+  put_rec (bt, BUF_TRACE_BUFFER, body, sizeof (body), NULL, 0);
+}
+
+void
+buf_trace_event (struct buf_trace *bt, GstEvent * event)
+{
+  if (!bt)
+    return;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+    {
+      GstCaps *caps;
+      gchar *str;
+
+      gst_event_parse_caps (event, &caps);
+      str = gst_caps_to_string (caps);
+      put_rec (bt, BUF_TRACE_CAPS, str, strlen (str), NULL, 0);
+      g_free (str);
+      break;
+    }
+    case GST_EVENT_SEGMENT:
+    {
+      const GstSegment *seg;
+      struct seg_body b;
+
+      gst_event_parse_segment (event, &seg);
+      b.format = seg->format;
+      b.flags = seg->flags;
+      b.rate = seg->rate;
+      b.applied_rate = seg->applied_rate;
+      b.base = seg->base;
+      b.offset = seg->offset;
+      b.start = seg->start;
+      b.stop = seg->stop;
+      b.time = seg->time;
+      b.position = seg->position;
+      b.duration = seg->duration;
+      put_rec (bt, BUF_TRACE_SEGMENT, &b, sizeof (b), NULL, 0);
+      break;
+    }
+    case GST_EVENT_FLUSH_START:
+      put_rec (bt, BUF_TRACE_FLUSH_START, NULL, 0, NULL, 0);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+    {
+      gboolean reset;
+      guint32 v;
+
+      gst_event_parse_flush_stop (event, &reset);
+      v = reset;
+      put_rec (bt, BUF_TRACE_FLUSH_STOP, &v, sizeof (v), NULL, 0);
+      break;
+    }
+    case GST_EVENT_GAP:
+    {
+      guint64 v[2];
+
+      gst_event_parse_gap (event, &v[0], &v[1]);
+      put_rec (bt, BUF_TRACE_GAP, v, sizeof (v), NULL, 0);
+      break;
+    }
+    case GST_EVENT_EOS:
+      put_rec (bt, BUF_TRACE_EOS, NULL, 0, NULL, 0);
+      break;
+    default:
+      break;
+  }
+}
+
+void
+buf_trace_state (struct buf_trace *bt, GstStateChange transition)
+{
+  guint32 v = transition;
+
+  if (bt)
+    put_rec (bt, BUF_TRACE_STATE, &v, sizeof (v), NULL, 0);
+}
+
+void
+buf_trace_xrun (struct buf_trace *bt)
+{
+  if (bt)
+    put_rec (bt, BUF_TRACE_XRUN, NULL, 0, NULL, 0);
+}
+
+struct buf_trace_reader *
+buf_trace_reader_open (const gchar * path, GError ** error)
+{
+  struct buf_trace_reader *r;
+  gchar magic[4];
+  guint32 hdr[2];
+  FILE *fp;
+
+  fp = fopen (path, "rb");
+  if (!fp) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "can not open %s", path);
+    return NULL;
+  }
+  if (fread (magic, 4, 1, fp) != 1 || memcmp (magic, BUF_TRACE_MAGIC, 4) ||
+      fread (hdr, sizeof (hdr), 1, fp) != 1 || hdr[0] != BUF_TRACE_VERSION) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "%s is not a version %d buffer trace", path, BUF_TRACE_VERSION);
+    fclose (fp);
+    return NULL;
+  }
+  r = g_new0 (struct buf_trace_reader, 1);
+  r->fp = fp;
+  r->flags = hdr[1];
+  return r;
+}
+
+void
+buf_trace_reader_close (struct buf_trace_reader *r)
+{
+  if (!r)
+    return;
+  fclose (r->fp);
+  g_free (r);
+}
+
+gboolean
+buf_trace_read (struct buf_trace_reader *r, struct buf_trace_rec *rec)
+{
+  guint8 head[16];
+  guint32 len;
+  guint8 *body;
+  gboolean ok = TRUE;
+
+  memset (rec, 0, sizeof (*rec));
+  if (fread (head, sizeof (head), 1, r->fp) != 1)
+    return FALSE;
+  rec->type = head[0];
+  memcpy (&len, head + 4, 4);
+  memcpy (&rec->t_us, head + 8, 8);
+
+  body = g_malloc (len + 1);
+  if (len && fread (body, len, 1, r->fp) != 1) {
+    g_free (body);
+    return FALSE;
+  }
+  body[len] = 0;
+
+  switch (rec->type) {
+    case BUF_TRACE_BUFFER:
+      if (len < 24) {
+        ok = FALSE;
+        break;
+      }
+      memcpy (&rec->pts, body, 8);
+      memcpy (&rec->duration, body + 8, 8);
+      memcpy (&rec->flags, body + 16, 4);
+      memcpy (&rec->size, body + 20, 4);
+      if (len > 24) {
+        rec->payload = g_malloc (len - 24);
+        memcpy (rec->payload, body + 24, len - 24);
+      }
+      break;
+    case BUF_TRACE_CAPS:
+      rec->caps = g_strndup ((const gchar *) body, len);
+      break;
+    case BUF_TRACE_SEGMENT:
+    {
+      struct seg_body b;
+
+      if (len < sizeof (b)) {
+        ok = FALSE;
+        break;
+      }
+      memcpy (&b, body, sizeof (b));
+      gst_segment_init (&rec->segment, b.format);
+      rec->segment.flags = b.flags;
+      rec->segment.rate = b.rate;
+      rec->segment.applied_rate = b.applied_rate;
+      rec->segment.base = b.base;
+      rec->segment.offset = b.offset;
+      rec->segment.start = b.start;
+      rec->segment.stop = b.stop;
+      rec->segment.time = b.time;
+      rec->segment.position = b.position;
+      rec->segment.duration = b.duration;
+      break;
+    }
+    case BUF_TRACE_FLUSH_STOP:
+    {
+      guint32 v = 0;
+
+      memcpy (&v, body, MIN (len, sizeof (v)));
+      rec->reset_time = v;
+      break;
+    }
+    case BUF_TRACE_GAP:
+      if (len < 16) {
+        ok = FALSE;
+        break;
+      }
+      memcpy (&rec->pts, body, 8);
+      memcpy (&rec->duration, body + 8, 8);
+      break;
+    case BUF_TRACE_STATE:
+    {
+      guint32 v = 0;
+
+      memcpy (&v, body, MIN (len, sizeof (v)));
+      rec->transition = v;
+      break;
+    }
+    default:
+      /* unknown records are skipped by length, newer writers may add some */
+      break;
+  }
+  g_free (body);
+  if (!ok)
+    buf_trace_rec_clear (rec);
+  return ok;
+}
+
+void
+buf_trace_rec_clear (struct buf_trace_rec *rec)
+{
+  g_free (rec->payload);
+  g_free (rec->caps);
+  rec->payload = NULL;
+  rec->caps = NULL;
+}
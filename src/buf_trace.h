@@ -0,0 +1,88 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef BUF_TRACE_H_
+#define BUF_TRACE_H_
+
+#include <gst/gst.h>
+
+/* Compact record of what reaches the sink pad: buffers with arrival time,
+ * serialized and flush events, state changes and xrun signals, so a field
+ * capture can be fed back with the same timing (see asink_replay.c).
+ *
+ * File: "ABTR", u32 version, u32 flags, then records of u8 type, 3 pad
+ * bytes, u32 body length, i64 us since the trace started, body. Fields are
+ * native endian. */
+
+#define BUF_TRACE_VERSION 1
+/* header flag, buffer records carry their payload */
+#define BUF_TRACE_FLAG_PAYLOAD 1
+
+enum buf_trace_type
+{
+  BUF_TRACE_BUFFER = 1,
+  BUF_TRACE_CAPS,
+  BUF_TRACE_SEGMENT,
+  BUF_TRACE_FLUSH_START,
+  BUF_TRACE_FLUSH_STOP,
+  BUF_TRACE_GAP,
+  BUF_TRACE_EOS,
+  BUF_TRACE_STATE,
+  BUF_TRACE_XRUN,
+};
+
+struct buf_trace;
+
+struct buf_trace_rec
+{
+  enum buf_trace_type type;
+  gint64 t_us;
+
+  /* buffer and gap */
+  GstClockTime pts;
+  GstClockTime duration;
+  guint32 flags;
+  guint32 size;
+  guint8 *payload;              /* NULL when not recorded */
+
+  gchar *caps;
+  GstSegment segment;
+  gboolean reset_time;
+  GstStateChange transition;
+};
+
+/* writer, all calls are thread safe and no-ops on NULL */
+struct buf_trace *buf_trace_open (const gchar * path, gboolean payload);
+void buf_trace_close (struct buf_trace *bt);
+void buf_trace_buffer (struct buf_trace *bt, GstBuffer * buf);
+/* records the events listed in buf_trace_type, ignores the rest */
+void buf_trace_event (struct buf_trace *bt, GstEvent * event);
+void buf_trace_state (struct buf_trace *bt, GstStateChange transition);
+void buf_trace_xrun (struct buf_trace *bt);
+
+/* reader, returns records in file order */
+struct buf_trace_reader;
+
+struct buf_trace_reader *buf_trace_reader_open (const gchar * path,
+    GError ** error);
+void buf_trace_reader_close (struct buf_trace_reader *r);
+/* FALSE at end of file or on a truncated record */
+gboolean buf_trace_read (struct buf_trace_reader *r, struct buf_trace_rec *rec);
+void buf_trace_rec_clear (struct buf_trace_rec *rec);
+
+#endif
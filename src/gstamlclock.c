@@ -110,14 +110,11 @@ gst_aml_clock_init (GstAmlClock * clock)
       return;
     }
     priv->session = mediasync_wrap_allocInstance(clock->handle, 0, 0, &priv->session_id);
-    FILE * fp;
-    fp = fopen("/data/MediaSyncId", "w");
-    if (fp == NULL) {
-      GST_ERROR("could not open file:/data/MediaSyncId failed");
-    } else {
-      fwrite(&priv->session_id, sizeof(int), 1, fp);
-      fclose(fp);
-    }
+    /* other processes read the latest id from here, replace the file
+     * atomically so concurrent clocks never leave a torn write behind */
+    if (!g_file_set_contents ("/data/MediaSyncId",
+          (const gchar *) &priv->session_id, sizeof (int), NULL))
+      GST_ERROR("could not write /data/MediaSyncId");
   } else {
     clock->handle = NULL;
     priv->session = av_sync_open_session(&priv->session_id);
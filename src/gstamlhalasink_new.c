@@ -36,7 +36,7 @@
 #include <pthread.h>
 #include <math.h>
 #include <gst/audio/audio.h>
-#include <sys/prctl.h>
+#include <gst/base/gstadapter.h>
 #include <stdlib.h>
 #include <time.h>
 #include <audio_if_client.h>
@@ -44,6 +44,16 @@
 #include "gstamlclock.h"
 #include "ac4_frame_parse.h"
 #include "scaletempo.h"
+#include "pcm_convert.h"
+#include "pcm_resample.h"
+#include "pcm_process.h"
+#include "pcm_mix.h"
+#include "lock_prof.h"
+#include "thread_sched.h"
+#include "mock_hal.h"
+#include "buf_trace.h"
+#include "hal_param.h"
+#include "hal_caps.h"
 #include "aml_avsync.h"
 #include "aml_avsync_log.h"
 #include "aml_version.h"
@@ -67,6 +77,26 @@ GST_DEBUG_CATEGORY (gst_aml_hal_asink_debug_category);
 #define GST_AML_HAL_ASINK_GET_PRIVATE(obj)  \
    (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GST_TYPE_AML_HAL_ASINK, GstAmlHalAsinkPrivate))
 
+/* profiled locking, see lock_prof.h */
+#define FEED_LOCK(priv) \
+  lock_prof_lock (&(priv)->lprof, LOCK_PROF_FEED, &(priv)->feed_lock, G_STRFUNC)
+#define FEED_UNLOCK(priv) \
+  lock_prof_unlock (&(priv)->lprof, LOCK_PROF_FEED, &(priv)->feed_lock)
+#define FEED_COND_WAIT(priv, cond) \
+  lock_prof_cond_wait (&(priv)->lprof, LOCK_PROF_FEED, cond, \
+      &(priv)->feed_lock, -1, G_STRFUNC)
+#define FEED_COND_WAIT_UNTIL(priv, cond, end) \
+  lock_prof_cond_wait (&(priv)->lprof, LOCK_PROF_FEED, cond, \
+      &(priv)->feed_lock, end, G_STRFUNC)
+#define SINK_OBJECT_LOCK(sink) \
+  lock_prof_lock (&(sink)->priv->lprof, LOCK_PROF_OBJECT, \
+      GST_OBJECT_GET_LOCK (sink), G_STRFUNC)
+#define SINK_OBJECT_UNLOCK(sink) \
+  lock_prof_unlock (&(sink)->priv->lprof, LOCK_PROF_OBJECT, \
+      GST_OBJECT_GET_LOCK (sink))
+
+#define SCHED_PRIORITY_DEFAULT 30
+
 //#define DUMP_TO_FILE
 #define DEFAULT_VOLUME          1.0
 #define MAX_VOLUME              1.0
@@ -76,6 +106,10 @@ GST_DEBUG_CATEGORY (gst_aml_hal_asink_debug_category);
 //32KB
 #define TRANS_DATA_SIZE        (MAX_TRANS_BUF_SIZE - TRANS_DATA_OFFSET)
 
+/* PCM gap silence is committed from a shared zero page, never written */
+#define SILENCE_BUF_SIZE       0x10000
+static const guint8 pcm_silence[SILENCE_BUF_SIZE];
+
 #define is_raw_type(type) (type == GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW)
 #define EXTEND_BUF_SIZE (4096*2*2)
 #define DEFAULT_BUFFER_TIME     ((200 * GST_MSECOND) / GST_USECOND)
@@ -89,18 +123,105 @@ GST_DEBUG_CATEGORY (gst_aml_hal_asink_debug_category);
 #define GST_AUDIO_FORMAT_TYPE_TRUE_HD 105
 #define MAX_COMMIT_BYTES 30*1024
 #define MAX_COMMIT_COUNT 70
+/* pcr master start queue, ms12 2.4 needs 2 frames to decode immediately */
+#define START_FRAMES_DEFAULT 2
+#define START_FRAMES_MAX 32
+#define START_MS_MAX 1000
 
 #define PTS_90K 90000
 #define HAL_INVALID_PTS (GST_CLOCK_TIME_NONE - 1)
 static const char kCustomInstantRateChangeEventName[] = "custom-instant-rate-change";
+/* sent by the application on an HDMI hotplug or any other change of what
+ * is behind the output port, the HAL caps cache is asked again */
+static const char kCustomOutputChangedEventName[] = "custom-output-device-changed";
 
-#ifdef DUMP_TO_FILE
-static guint file_index;
+/* request pads carry a per input volume for the mix */
+#define GST_TYPE_AML_HAL_ASINK_MIX_PAD (gst_aml_hal_asink_mix_pad_get_type ())
+#define GST_AML_HAL_ASINK_MIX_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AML_HAL_ASINK_MIX_PAD, GstAmlHalAsinkMixPad))
+
+typedef struct
+{
+  GstPad parent;
+  gint volume;                  /* Q14, atomic */
+  gint mute;                    /* atomic */
+} GstAmlHalAsinkMixPad;
+
+typedef struct
+{
+  GstPadClass parent_class;
+} GstAmlHalAsinkMixPadClass;
+
+GType gst_aml_hal_asink_mix_pad_get_type (void);
+
+/* what the main stream can do with request pad PCM, see mix_main_sync */
+typedef enum
+{
+  MIX_MAIN_NONE,                /* no stream yet */
+  MIX_MAIN_PAUSED,              /* mixable, render does not drain now */
+  MIX_MAIN_PLAYING,             /* render drains the queues */
+  MIX_MAIN_UNMIXABLE,           /* compressed or too many channels */
+  MIX_MAIN_EOS
+} MixMain;
+
+/* PCM from a request pad waiting to be mixed into the main stream */
+typedef struct
+{
+  GstAmlHalAsinkMixPad *pad;
+  GstAdapter *adapter;
+  GstAudioInfo info;
+  GstSegment segment;
+  GstClockTime head_rt;         /* running time of the first queued frame */
+  gboolean flushing;
+  gboolean eos;
+  gboolean rate_warned;
+  /* layout gains for inputs other than AD, Q14 */
+  gint gain_out_ch;
+  gint16 gain[PCM_MIX_MAX_CH];
+#ifdef SUPPORT_AD
+  struct ad_des_cache des_cache;
+  struct ad_des des;            /* next descriptor, due at des_rt */
+  GstClockTime des_rt;
+  gboolean des_pending;
 #endif
+} MixInput;
+
+/* start-up milestones, see startup_mark */
+enum
+{
+  STARTUP_HAL_LOAD,
+  STARTUP_READY,
+  STARTUP_STREAM_OPEN,
+  STARTUP_AVSYNC,
+  STARTUP_FIRST_BUFFER,
+  STARTUP_FIRST_COMMIT,
+  STARTUP_FIRST_POSITION,
+  STARTUP_NUM
+};
+
+static const gchar *startup_names[STARTUP_NUM] = {
+  "hal-load-us",
+  "ready-us",
+  "stream-open-us",
+  "avsync-us",
+  "first-buffer-us",
+  "first-commit-us",
+  "first-position-us",
+};
 
 struct _GstAmlHalAsinkPrivate
 {
   audio_hw_device_t *hw_dev_;
+  /* HAL is loaded on hal_loader from construction or NULL to READY and
+   * handed over to hw_dev_ by hal_join at first use */
+  GMutex hal_load_lock;
+  GThread *hal_loader;
+  gboolean hal_load_pending;    /* result below not taken yet */
+  audio_hw_device_t *hal_load_dev;
+  int hal_load_ret;
+  int hal_load_ms12;
+  gboolean async_hal_load;
+  gint64 hal_wait_us;
   uint32_t output_port_;
   uint32_t direct_mode_;
   gboolean tts_mode_;
@@ -122,6 +243,83 @@ struct _GstAmlHalAsinkPrivate
   audio_format_t format_;
   uint32_t sr_;
   audio_channel_mask_t channel_mask_;
+  /* what stream_ was opened with, hal_acquire reuses stream_ for a spec
+   * that asks for the same in warm switch mode */
+  audio_format_t open_format;
+  uint32_t open_sr;             /* input rate, open_hw_sr if resampled */
+  uint32_t open_hw_sr;
+  audio_channel_mask_t open_mask;
+  audio_output_flags_t open_flags;
+  audio_devices_t open_device;
+#ifdef SUPPORT_AD
+  gboolean open_dual;
+#endif
+  gboolean warm_switch;
+  guint64 warm_switches;
+
+  /* raw input is converted to S16LE before reaching HAL */
+  GstAudioInfo hal_info;
+  pcm_convert_func pcm_convert;
+  guint8 *conv_buf;
+  gsize conv_buf_size;
+
+  /* rates HAL can not take are resampled to 48K */
+  struct pcm_resample *resampler;
+  gint resample_quality;
+  guint8 *rs_buf;
+  gsize rs_buf_size;
+
+  /* small contiguous PCM buffers held back and written to HAL as one
+   * coalesce_ms block, guarded by feed_lock */
+  gint coalesce_ms;
+  guint8 *coal_buf;
+  gsize coal_buf_size;
+  gsize coal_size;
+  GstClockTime coal_time;       /* pts of coal_buf[0] */
+  gint64 coal_start;            /* monotonic time of the first append */
+  gint coal_ms;                 /* coalesce_ms the held block started with */
+  guint64 coal_saved;           /* HAL writes avoided */
+  /* writes out a block upstream stopped adding to once coalesce_ms
+   * passed, started with the first held block */
+  GThread *coal_thread;
+  GCond coal_cond;
+  gboolean coal_quit;
+
+  /* raw write size in hal_commit follows HAL back pressure between
+   * chunk_min and chunk_max, streaming thread only */
+  gboolean chunk_adapt;
+  guint chunk_size;
+  guint chunk_min;
+  guint chunk_max;
+  guint chunk_align;
+  gint64 chunk_block_us;        /* EWMA of write() blocking time */
+
+  /* request pad PCM mixed into main in render, one commit per period,
+   * or by mix_ui_thread into its own stream while main does not render.
+   * mix_inputs, ad_in (the ad_sink one among them) and the queues are
+   * guarded by mix_lock, the gains below belong to the streaming thread.
+   * mix_gain[0] is main, then AD per output channel, Q14 */
+  GMutex mix_lock;
+  GCond mix_cond;
+  GList *mix_inputs;
+  MixInput *ad_in;
+  guint mix_next_id;
+  gint16 *mix_buf;
+  gsize mix_buf_size;
+  gint mix_ad_ch;
+  gint mix_out_ch;
+  gint mix_from[PCM_MIX_MAX_CH + 1];
+  gint mix_to[PCM_MIX_MAX_CH + 1];
+  gint mix_gain[PCM_MIX_MAX_CH + 1];
+  GstClockTime mix_ramp_start;
+  guint64 mix_frames;
+  /* main stream state for the request pads, under mix_lock */
+  MixMain mix_main;
+  gint mix_main_rate;           /* 0 unless main is mixable PCM */
+  /* sink_%u while main render does not drain them, under mix_lock */
+  GThread *mix_ui_thread;
+  gboolean mix_ui_quit;
+  gboolean mix_ui_active;       /* mix_ui_thread drains the queues */
 
   gboolean paused_;
   gboolean flushing_;
@@ -163,9 +361,28 @@ struct _GstAmlHalAsinkPrivate
   guint group_id;
   gboolean group_done;
 
-  /* tempo stretch */
+  /* lock contention profiling */
+  struct lock_prof lprof;
+
+  /* software HAL stand-in, see mock_hal.h */
+  gboolean mock_hal;
+
+  /* set_parameters/get_parameters traffic, see hal_param.h */
+  struct hal_param hparam;
+
+  /* chain side recording for offline replay, trace_location is guarded by
+   * object lock and trace is only replaced in READY */
+  gchar *trace_location;
+  gboolean trace_payload;
+  struct buf_trace *trace;
+
+  /* tempo stretch, st is only touched by the streaming thread. Other
+   * threads hand rate changes over in tempo_pending and ask for a stop
+   * with tempo_stop_req */
   struct scale_tempo st;
   gboolean tempo_used;
+  gpointer tempo_pending;
+  gint tempo_stop_req;
   float rate;
   gboolean need_update_rate;
 
@@ -181,6 +398,21 @@ struct _GstAmlHalAsinkPrivate
   gboolean stream_volume_pending;
   float stream_volume;
 
+  /* PCM volume/mute/remap done in sink, not HAL. sw_volume (Q15) and
+   * sw_mute are written by setters and picked up by render */
+  gboolean pcm_proc_used;
+  struct pcm_process pcm_proc;
+  gint sw_volume;
+  gint sw_mute;
+
+  /* PCM fades around pause/resume/flush, guarded by feed_lock */
+  gint pause_fade;
+  gint pcm_fade_req;
+  gint64 fade_done_time;
+  GCond fade_cond;
+  /* PCM behind the end of the pause fade, played after resume */
+  GstBuffer *fade_hold;
+
   /* underrun detection */
   GThread *xrun_thread;
   gboolean quit_xrun_thread;
@@ -193,10 +425,17 @@ struct _GstAmlHalAsinkPrivate
   EssRMgr *rm;
   int resAssignedId;
 #endif
-  /* thread priority */
-  gboolean pri_set;
+  /* thread scheduling, sched is guarded by object lock. Each thread
+   * keeps what it applied last per sched_id in sched_applied and
+   * re-applies when sched_gen moves past it */
+  struct thread_sched sched;
+  gint sched_gen;
+  gint sched_id;
 
   /* debugging */
+#ifdef DUMP_TO_FILE
+  guint dump_index;
+#endif
   gboolean diag_log_enable;
   char *log_path;
 
@@ -209,11 +448,32 @@ struct _GstAmlHalAsinkPrivate
   /* avsync */
   void * avsync;
   int session_id;
+  /* avsync kept over hal_stop in warm switch mode, create_av_sync re-arms
+   * it if session and mode are still the ones it was made for */
+  gboolean avsync_rearm;
+  int avsync_session;
+  enum sync_mode avsync_mode;
+  guint64 avsync_rearms;
   GstClock *provided_clock;
   gboolean wait_video;
   int aligned_timeout;
-  GstBuffer *start_buf; /* pcr master mode only */
+  /* pcr master start, frames are held until start_frames and start_ms
+   * are queued and avsync is there, then go to HAL back to back, one
+   * commit each with its own pts. Guarded by feed_lock */
+  gint start_frames;
+  gint start_ms;
+  guint8 *start_data;
+  gsize start_data_size;
+  gsize start_size;
+  guint start_count;
+  GstClockTime start_time;      /* pts of start_data[0] */
+  gsize start_off[START_FRAMES_MAX + 1];        /* frame i is off[i]..off[i+1] */
+  GstClockTime start_pts[START_FRAMES_MAX];
+  GstClockTime start_dur;
+  gint64 start_since;           /* monotonic time of the first held frame */
   gboolean start_buf_sent;
+  guint start_batch;            /* frames in the last start commit */
+  gint64 start_wait_us;
   gboolean seamless_switch;
   gboolean tempo_disable; /* disable tempo use */
 
@@ -231,10 +491,25 @@ struct _GstAmlHalAsinkPrivate
 #ifdef SUPPORT_AD
   gboolean is_dual_audio;
   gboolean is_ad_audio;
-  struct ad_des des_ad;
+  struct ad_des des_ad;         /* latest descriptor from the stream */
+  struct ad_des_cache ad_cache;
+  /* descriptor on HAL and where the ramp to des_ad started */
+  struct ad_des ad_sent;
+  gboolean ad_sent_valid;
+  struct ad_des ad_from;
+  gboolean ad_pending;
+  GstClockTime ad_ramp_start;
 #endif
   guint64 clip_front;
   guint64 clip_back;
+
+  /* us since startup_base a milestone was first hit, -1 before, atomic.
+   * A start begins at NULL to READY, READY to PAUSED or caps on an open
+   * stream once the previous start was posted. startup_base is under
+   * the object lock */
+  gint startup[STARTUP_NUM];
+  gint64 startup_base;
+  gboolean startup_posted;
 };
 
 enum
@@ -250,6 +525,59 @@ enum
   RAMP_DOWN,
   RAMP_UP
 };
+
+/* fade out before HAL pause, state thread requests and render completes */
+enum
+{
+  PAUSE_FADE_NONE,
+  PAUSE_FADE_REQUEST,
+  PAUSE_FADE_RUNNING,
+  PAUSE_FADE_DONE
+};
+
+enum
+{
+  PCM_FADE_REQ_NONE,
+  PCM_FADE_REQ_IN,        /* resume */
+  PCM_FADE_REQ_RESTART    /* flush, new data starts from silence */
+};
+
+/* rate change waiting to be applied to scaletempo by render */
+struct tempo_update
+{
+  gdouble rate;
+  guint64 segment_start;
+};
+
+#define PCM_FADE_MS 10
+/* coalescing, pts jitter still treated as contiguous and the largest block */
+#define COALESCE_TOLERANCE GST_MSECOND
+#define COALESCE_MAX_MS 100
+/* adaptive raw chunk, shrink when a write blocks longer than HIGH so flush
+ * and pause stay responsive, grow when HAL takes it faster than LOW */
+#define CHUNK_MIN_MS 5
+#define CHUNK_BLOCK_HIGH_US 20000
+#define CHUNK_BLOCK_LOW_US 2000
+/* raw writes without direct mode, HAL can not handle bigger ones */
+#define MAX_RAW_WRITE_SIZE (8*1024)
+/* upper bound of pause wait, the old fixed sleep */
+#define PAUSE_FADE_TIMEOUT_MS 60
+/* AD queued ahead of main before its pad blocks, and the timestamp jump
+ * that is filled with silence instead of shifting the rest */
+#define MIX_QUEUE_MS 500
+#define MIX_GAP_TOLERANCE (40 * GST_MSECOND)
+#define MIX_MAX_INPUTS 8
+/* mixing buffer allocated with the stream, main buffers rarely exceed it */
+#define MIX_PERIOD_MS 100
+/* sink_%u on their own stream while main does not drain them, see
+ * mix_ui_thread. Period of one commit, and silence before it closes */
+#define MIX_UI_PERIOD_MS 20
+#define MIX_UI_IDLE_MS 1000
+#ifdef SUPPORT_AD
+/* fade/pan changes of the AD descriptor are spread over this much stream
+ * time so the mix does not step */
+#define AD_RAMP_TIME (100 * GST_MSECOND)
+#endif
 enum
 {
   PROP_0,
@@ -284,6 +612,22 @@ enum
   PROP_AD_AUDIO,
 #endif
   PROP_A_WAIT_TIMEOUT,
+  PROP_RESAMPLE_QUALITY,
+  PROP_LOCK_PROFILE_ENABLE,
+  PROP_LOCK_PROFILE,
+  PROP_SCHED_POLICY,
+  PROP_SCHED_PRIORITY,
+  PROP_SCHED_RUNTIME,
+  PROP_SCHED_PERIOD,
+  PROP_CPU_AFFINITY,
+  PROP_TRACE_LOCATION,
+  PROP_TRACE_PAYLOAD,
+  PROP_COALESCE_TIME,
+  PROP_ADAPTIVE_CHUNK,
+  PROP_PCR_START_FRAMES,
+  PROP_PCR_START_TIME,
+  PROP_WARM_SWITCH,
+  PROP_ASYNC_HAL_LOAD,
   PROP_STATS,
   PROP_LAST
 };
@@ -302,6 +646,10 @@ typedef enum
   POS_APTS,
 } pos_t;
 
+#define RAW_AUDIO_FORMATS "format={S16LE,S24LE,S24_32LE,S32LE,F32LE}"
+#define RAW_AUDIO_RATES \
+  "rate={8000,11025,12000,16000,22050,24000,32000,44100,48000,88200,96000}"
+
 #define COMMON_AUDIO_CAPS \
   "channels = (int) [ 1, MAX ], " \
   "rate = (int) [ 1, MAX ]"
@@ -312,7 +660,7 @@ GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS (
-      "audio/x-raw,format=S16LE,rate=48000,"
+      "audio/x-raw," RAW_AUDIO_FORMATS "," RAW_AUDIO_RATES ","
       "channels={2,3,4,5,6,7,8},layout=interleaved; "
       "audio/x-ac3, "
       COMMON_AUDIO_CAPS "; "
@@ -332,12 +680,35 @@ GST_STATIC_PAD_TEMPLATE ("sink",
       )
     );
 
+/* mono or stereo description mixed into PCM main audio */
+static GstStaticPadTemplate template_ad_sink =
+GST_STATIC_PAD_TEMPLATE ("ad_sink",
+  GST_PAD_SINK,
+  GST_PAD_REQUEST,
+  GST_STATIC_CAPS (
+    "audio/x-raw,format=S16LE,rate=(int)[ 1, MAX ],"
+    "channels=(int)[ 1, 2 ],layout=interleaved"
+  )
+);
+
+/* UI sound, TTS or any other PCM. Mixed into main while main plays PCM,
+ * otherwise played by mix_ui_thread on a stream of its own */
+static GstStaticPadTemplate template_mix_sink =
+GST_STATIC_PAD_TEMPLATE ("sink_%u",
+  GST_PAD_SINK,
+  GST_PAD_REQUEST,
+  GST_STATIC_CAPS (
+    "audio/x-raw,format=S16LE,rate=(int)[ 1, MAX ],"
+    "channels=(int)[ 1, 8 ],layout=interleaved"
+  )
+);
+
 static GstStaticPadTemplate template_system_sound =
 GST_STATIC_PAD_TEMPLATE ("sink",
   GST_PAD_SINK,
   GST_PAD_ALWAYS,
   GST_STATIC_CAPS (
-    "audio/x-raw,format=S16LE,rate=48000,"
+    "audio/x-raw," RAW_AUDIO_FORMATS "," RAW_AUDIO_RATES ","
     "channels=2,layout=interleaved; "
   )
 );
@@ -366,6 +737,30 @@ gst_ahal_output_port_get_type (void)
   return ahal_output_port_type;
 }
 
+#define GST_TYPE_AHAL_SCHED_POLICY \
+  (gst_ahal_sched_policy_get_type ())
+
+static GType
+gst_ahal_sched_policy_get_type (void)
+{
+  static GType ahal_sched_policy_type = 0;
+
+  if (!ahal_sched_policy_type) {
+    static const GEnumValue ahal_sched_policy[] = {
+      {THREAD_SCHED_OTHER, "SCHED_OTHER", "other"},
+      {THREAD_SCHED_FIFO, "SCHED_FIFO", "fifo"},
+      {THREAD_SCHED_RR, "SCHED_RR", "rr"},
+      {THREAD_SCHED_DEADLINE, "SCHED_DEADLINE", "deadline"},
+      {0, NULL, NULL},
+    };
+
+    ahal_sched_policy_type =
+        g_enum_register_static ("AmlAsinkSchedPolicy", ahal_sched_policy);
+  }
+
+  return ahal_sched_policy_type;
+}
+
 /* class initialization */
 #define gst_aml_hal_asink_parent_class parent_class
 #if GLIB_CHECK_VERSION(2,58,0)
@@ -380,10 +775,100 @@ G_DEFINE_TYPE_WITH_CODE (GstAmlHalAsink, gst_aml_hal_asink, GST_TYPE_BASE_SINK,
   );
 #endif
 
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_VOLUME,
+  PROP_PAD_MUTE,
+};
+
+G_DEFINE_TYPE (GstAmlHalAsinkMixPad, gst_aml_hal_asink_mix_pad, GST_TYPE_PAD);
+
+static void
+gst_aml_hal_asink_mix_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAmlHalAsinkMixPad *pad = GST_AML_HAL_ASINK_MIX_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VOLUME:
+      g_atomic_int_set (&pad->volume,
+          MIN (lrint (g_value_get_double (value) * PCM_MIX_UNITY),
+              PCM_MIX_GAIN_MAX));
+      break;
+    case PROP_PAD_MUTE:
+      g_atomic_int_set (&pad->mute, g_value_get_boolean (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_aml_hal_asink_mix_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAmlHalAsinkMixPad *pad = GST_AML_HAL_ASINK_MIX_PAD (object);
+
+  switch (prop_id) {
+    case PROP_PAD_VOLUME:
+      g_value_set_double (value,
+          (gdouble) g_atomic_int_get (&pad->volume) / PCM_MIX_UNITY);
+      break;
+    case PROP_PAD_MUTE:
+      g_value_set_boolean (value, g_atomic_int_get (&pad->mute));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_aml_hal_asink_mix_pad_class_init (GstAmlHalAsinkMixPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_aml_hal_asink_mix_pad_set_property;
+  gobject_class->get_property = gst_aml_hal_asink_mix_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PAD_VOLUME,
+      g_param_spec_double ("volume", "Volume", "Volume of this input in the mix",
+          0.0, (gdouble) PCM_MIX_GAIN_MAX / PCM_MIX_UNITY, 1.0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_MUTE,
+      g_param_spec_boolean ("mute", "Mute", "Mute this input in the mix",
+          FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_aml_hal_asink_mix_pad_init (GstAmlHalAsinkMixPad * pad)
+{
+  pad->volume = PCM_MIX_UNITY;
+  pad->mute = FALSE;
+}
+
 static guint g_signals[MAX_SIGNAL]= {0};
 
+/* per thread record of the sink scheduling last applied to it */
+typedef struct {
+  gint id;
+  gint gen;
+} SchedApplied;
+static GPrivate sched_applied = G_PRIVATE_INIT (g_free);
+static gint sched_id_next = 1;
+
 static gboolean gst_aml_hal_asink_open (GstAmlHalAsink* sink);
 static gboolean gst_aml_hal_asink_close (GstAmlHalAsink* asink);
+static void hal_load_start (GstAmlHalAsink * sink);
+static void hal_load_drop (GstAmlHalAsink * sink);
+static gboolean hal_join (GstAmlHalAsink * sink);
+static gboolean hal_stream_route (GstAmlHalAsink * sink,
+    audio_output_flags_t * flag, audio_devices_t * device);
+static GstCaps *gst_aml_hal_asink_get_caps (GstBaseSink * bsink,
+    GstCaps * filter);
 
 static void gst_aml_hal_asink_dispose(GObject * object);
 
@@ -405,6 +890,9 @@ static GstFlowReturn gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer
 static GstFlowReturn gst_aml_hal_asink_chain (GstPad * pad, GstObject * parent, GstBuffer * buf);
 static gboolean gst_aml_hal_asink_event(GstAmlHalAsink *sink, GstEvent * event);
 static gboolean gst_aml_hal_asink_pad_event (GstPad * pad, GstObject * parent, GstEvent * event);
+static GstPad *gst_aml_hal_asink_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_aml_hal_asink_release_pad (GstElement * element, GstPad * pad);
 static GstFlowReturn gst_aml_hal_asink_wait_event(GstBaseSink * bsink,
     GstEvent * event);
 static void gst_aml_hal_asink_get_times(GstBaseSink * bsink,
@@ -416,20 +904,32 @@ static gboolean hal_open_device (GstAmlHalAsink * sink);
 static gboolean hal_close_device (GstAmlHalAsink* sink);
 static gboolean hal_acquire (GstAmlHalAsink * sink, GstAudioRingBufferSpec * spec);
 static gboolean hal_release (GstAmlHalAsink * sink);
+static void hal_close (GstAmlHalAsink * sink);
 static gboolean hal_start (GstAmlHalAsink * sink);
 static gboolean hal_pause (GstAmlHalAsink * sink);
+static gboolean pcm_pause_fade (GstAmlHalAsink * sink);
+static void tempo_post_update (GstAmlHalAsink * sink, gdouble rate, guint64 segment_start);
+static struct tempo_update * tempo_take_update (GstAmlHalAsink * sink);
 static gboolean hal_stop (GstAmlHalAsink * sink);
 static guint hal_commit (GstAmlHalAsink * sink, guchar * data, gint size, guint64 pts_64);
+static void coalesce_drain (GstAmlHalAsink * sink);
+static guint64 hal_commit_silence (GstAmlHalAsink * sink, guint64 frames, guint64 pts_64);
 static uint32_t hal_get_latency (GstAmlHalAsink * sink);
-static void dump(const char* path, const uint8_t *data, int size);
+static void dump(GstAmlHalAsink *sink, const char* path, const uint8_t *data, int size);
 static int create_av_sync(GstAmlHalAsink *sink);
+static void startup_reset (GstAmlHalAsink * sink);
+static inline void startup_mark (GstAmlHalAsink * sink, gint mark);
 static void stop_xrun_thread (GstAmlHalAsink * sink);
+static void start_queue_flush (GstAmlHalAsink * sink);
+static void coalesce_thread_stop (GstAmlHalAsink * sink);
+static void mix_ui_thread_stop (GstAmlHalAsink * sink);
+static void mix_main_sync (GstAmlHalAsink * sink);
 #if 0
 static int get_sysfs_uint32(const char *path, uint32_t *value);
 static int config_sys_node(const char* path, const char* value);
 #endif
 static void check_pause_pts (GstAmlHalAsink *sink, GstClockTime ts);
-static void vol_ramp(guchar * data, gint size, gint ch_num, int dir);
+static void vol_ramp(GstAmlHalAsink * sink, guchar * data, gint size, int dir);
 #ifdef ENABLE_MS12
 static void hal_set_player_overwrite (GstAmlHalAsink * sink, gboolean defaults);
 #endif
@@ -454,6 +954,10 @@ gst_aml_hal_asink_class_init (GstAmlHalAsinkClass * klass)
      base_class_init if you intend to subclass this class. */
   gst_element_class_add_static_pad_template (GST_ELEMENT_CLASS(klass),
       &gst_aml_hal_asink_sink_template);
+  gst_element_class_add_static_pad_template (GST_ELEMENT_CLASS(klass),
+      &template_ad_sink);
+  gst_element_class_add_static_pad_template (GST_ELEMENT_CLASS(klass),
+      &template_mix_sink);
 
   gst_element_class_set_static_metadata (GST_ELEMENT_CLASS(klass),
       "Amlogic audio HAL sink", "Sink/Audio", "gstream plugin to connect AML audio HAL",
@@ -606,6 +1110,98 @@ gst_aml_hal_asink_class_init (GstAmlHalAsinkClass * klass)
           "audio wait for video timeout if no video comes, effective when wait-video property is true.",
           -1, 10000, 0, G_PARAM_WRITABLE));
 
+  g_object_class_install_property (gobject_class,
+      PROP_RESAMPLE_QUALITY,
+      g_param_spec_int ("resample-quality", "Resample quality",
+          "Quality of the internal resampler used when audio HAL can not take the PCM rate, 0 (fastest) to 10 (best)",
+          PCM_RESAMPLE_QUALITY_MIN, PCM_RESAMPLE_QUALITY_MAX,
+          PCM_RESAMPLE_QUALITY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_LOCK_PROFILE_ENABLE,
+      g_param_spec_boolean ("lock-profile-enable", "Enable lock profiling",
+          "Record wait/hold time histograms of sink locks and HAL calls, also enabled by env AMLASINK_LOCK_PROF=1",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LOCK_PROFILE,
+      g_param_spec_boxed ("lock-profile", "Lock profile",
+        "Lock wait/hold histograms per call site", GST_TYPE_STRUCTURE,
+        (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property (gobject_class, PROP_SCHED_POLICY,
+      g_param_spec_enum ("sched-policy", "Scheduling policy",
+          "scheduling policy of the streaming and helper threads",
+          GST_TYPE_AHAL_SCHED_POLICY, THREAD_SCHED_FIFO,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SCHED_PRIORITY,
+      g_param_spec_int ("sched-priority", "Scheduling priority",
+          "real time priority for fifo and rr policies",
+          1, 99, SCHED_PRIORITY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SCHED_RUNTIME,
+      g_param_spec_uint64 ("sched-runtime", "Deadline runtime",
+          "runtime budget in ns per period for the deadline policy",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SCHED_PERIOD,
+      g_param_spec_uint64 ("sched-period", "Deadline period",
+          "period in ns for the deadline policy, also used as deadline",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CPU_AFFINITY,
+      g_param_spec_uint64 ("cpu-affinity", "CPU affinity",
+          "mask of cpus the sink threads may run on, bit n is cpu n, 0 for no pinning",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TRACE_LOCATION,
+      g_param_spec_string ("trace-location", "Trace location",
+          "record buffers, events and xruns reaching the sink to this file for amlasink_replay, applied in READY, also set by env AMLASINK_TRACE",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_TRACE_PAYLOAD,
+      g_param_spec_boolean ("trace-payload", "Trace payload",
+          "also record buffer data, needed to replay compressed formats",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COALESCE_TIME,
+      g_param_spec_int ("coalesce-time", "Coalesce time",
+          "join small contiguous PCM buffers into HAL writes of this many ms, 0 to write each buffer as it comes",
+          0, COALESCE_MAX_MS, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_CHUNK,
+      g_param_spec_boolean ("adaptive-chunk", "Adaptive chunk",
+          "size raw HAL writes by measured write blocking and HAL latency instead of the fixed limit, applied on next caps",
+          TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PCR_START_FRAMES,
+      g_param_spec_int ("pcr-start-frames", "PCR start frames",
+          "frames collected in pcr master mode before the first HAL commit",
+          1, START_FRAMES_MAX, START_FRAMES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PCR_START_TIME,
+      g_param_spec_int ("pcr-start-time", "PCR start time",
+          "ms of audio collected in pcr master mode before the first HAL commit, on top of pcr-start-frames",
+          0, START_MS_MAX, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WARM_SWITCH,
+      g_param_spec_boolean ("warm-switch", "Warm switch",
+          "keep HAL stream open over caps changes that need the same stream and keep avsync over flushes, for fast channel change",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ASYNC_HAL_LOAD,
+      g_param_spec_boolean ("async-hal-load", "Async HAL load",
+          "load audio HAL in the background and wait for it at first caps instead of in NULL to READY",
+          TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
 #if GST_CHECK_VERSION(1, 18, 0)
   g_object_class_override_property (gobject_class, PROP_STATS, "stats");
 #else
@@ -656,11 +1252,17 @@ gst_aml_hal_asink_class_init (GstAmlHalAsinkClass * klass)
   gstelement_class->provide_clock =
       GST_DEBUG_FUNCPTR (gst_aml_hal_asink_provide_clock);
   gstelement_class->query = GST_DEBUG_FUNCPTR (gst_aml_hal_asink_query);
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_aml_hal_asink_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_aml_hal_asink_release_pad);
 
   gstbasesink_class->wait_event =
       GST_DEBUG_FUNCPTR (gst_aml_hal_asink_wait_event);
   gstbasesink_class->get_times =
       GST_DEBUG_FUNCPTR (gst_aml_hal_asink_get_times);
+  gstbasesink_class->get_caps =
+      GST_DEBUG_FUNCPTR (gst_aml_hal_asink_get_caps);
 
   gst_element_class_set_details_simple (gstelement_class, "AmlHalAsink",
       "Decoder/Sink/Audio",
@@ -705,7 +1307,9 @@ gst_aml_hal_asink_init (GstAmlHalAsink* sink)
   priv->format_ = AUDIO_FORMAT_PCM_16_BIT;
   priv->sync_mode = AV_SYNC_MODE_AMASTER;
   priv->session_id = -1;
+  startup_reset (sink);
   priv->stream_volume = 1.0;
+  priv->sw_volume = PCM_PROCESS_UNITY;
   priv->ms12_enable = false;
   priv->commit_data = NULL;
   priv->commit_time =GST_CLOCK_TIME_NONE;
@@ -724,10 +1328,27 @@ gst_aml_hal_asink_init (GstAmlHalAsink* sink)
   priv->des_ad.g_c = priv->des_ad.g_f = priv->des_ad.g_s = -1;
 #endif
   priv->aligned_timeout = -1;
+  priv->resample_quality = PCM_RESAMPLE_QUALITY_DEFAULT;
   priv->clip_front = 0;
   priv->clip_back  = 0;
+  priv->chunk_adapt = TRUE;
+  priv->start_frames = START_FRAMES_DEFAULT;
+  priv->sched.policy = THREAD_SCHED_FIFO;
+  priv->sched.priority = SCHED_PRIORITY_DEFAULT;
+  priv->sched_gen = 1;
+  priv->sched_id = g_atomic_int_add (&sched_id_next, 1);
   g_mutex_init (&priv->feed_lock);
+  hal_param_init (&priv->hparam);
+  lock_prof_init (&priv->lprof);
+  if (g_strcmp0 (g_getenv ("AMLASINK_LOCK_PROF"), "1") == 0)
+    lock_prof_enable (&priv->lprof, TRUE);
+  priv->trace_location = g_strdup (g_getenv ("AMLASINK_TRACE"));
   g_cond_init (&priv->run_ready);
+  g_cond_init (&priv->fade_cond);
+  g_cond_init (&priv->coal_cond);
+  g_mutex_init (&priv->mix_lock);
+  g_cond_init (&priv->mix_cond);
+  priv->mix_ramp_start = GST_CLOCK_TIME_NONE;
   scaletempo_init (&priv->st);
 
   {
@@ -747,6 +1368,13 @@ gst_aml_hal_asink_init (GstAmlHalAsink* sink)
   priv->resAssignedId = -1;
 #endif
   log_set_level(AVS_LOG_INFO);
+
+  /* HAL IPC set up overlaps with the rest of pipeline construction */
+  g_mutex_init (&priv->hal_load_lock);
+  priv->async_hal_load = TRUE;
+  g_mutex_lock (&priv->hal_load_lock);
+  hal_load_start (sink);
+  g_mutex_unlock (&priv->hal_load_lock);
 }
 
 static void
@@ -756,13 +1384,29 @@ gst_aml_hal_asink_dispose (GObject * object)
   GstAmlHalAsinkPrivate *priv = sink->priv;
 
   GST_DEBUG_OBJECT (sink, "dispose");
+  /* never got to READY, or loaded again after NULL */
+  g_mutex_lock (&priv->hal_load_lock);
+  hal_load_drop (sink);
+  g_mutex_unlock (&priv->hal_load_lock);
+  g_mutex_clear (&priv->hal_load_lock);
+
   if (priv->provided_clock) {
     gst_object_unref (priv->provided_clock);
     priv->provided_clock = NULL;
   }
 
+  coalesce_thread_stop (sink);
+  mix_ui_thread_stop (sink);
   g_mutex_clear (&priv->feed_lock);
+  hal_param_destroy (&priv->hparam);
   g_cond_clear (&priv->run_ready);
+  g_cond_clear (&priv->fade_cond);
+  g_cond_clear (&priv->coal_cond);
+  g_mutex_clear (&priv->mix_lock);
+  g_cond_clear (&priv->mix_cond);
+  g_free (priv->mix_buf);
+  priv->mix_buf = NULL;
+  priv->mix_buf_size = 0;
 #ifdef ESSOS_RM
   g_mutex_clear (&priv->ess_lock);
 #endif
@@ -771,8 +1415,26 @@ gst_aml_hal_asink_dispose (GObject * object)
   g_free (priv->ac4_lang2);
 #endif
   g_free (priv->log_path);
+  g_free (priv->trace_location);
+  priv->trace_location = NULL;
+  buf_trace_close (priv->trace);
+  priv->trace = NULL;
   if (priv->commit_data)
     g_free (priv->commit_data);
+  g_free (priv->conv_buf);
+  priv->conv_buf = NULL;
+  priv->conv_buf_size = 0;
+  g_free (priv->rs_buf);
+  priv->rs_buf = NULL;
+  priv->rs_buf_size = 0;
+  g_free (priv->coal_buf);
+  priv->coal_buf = NULL;
+  priv->coal_buf_size = 0;
+  gst_buffer_replace (&priv->fade_hold, NULL);
+  g_free (priv->start_data);
+  priv->start_data = NULL;
+  priv->start_data_size = 0;
+  g_free (tempo_take_update (sink));
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
 
@@ -784,10 +1446,10 @@ gst_aml_hal_asink_provide_clock (GstElement * elem)
   GstAmlHalAsinkPrivate *priv = sink->priv;
   GstClock *clock = NULL;
 
-  GST_OBJECT_LOCK (sink);
+  SINK_OBJECT_LOCK (sink);
   if (priv->provided_clock)
       clock = GST_CLOCK_CAST (gst_object_ref (priv->provided_clock));
-  GST_OBJECT_UNLOCK (sink);
+  SINK_OBJECT_UNLOCK (sink);
 
   return clock;
 }
@@ -845,8 +1507,12 @@ get_position (GstAmlHalAsink* sink, GstFormat format, pos_t pos_type, gint64 * c
 
   if (!priv->provided_clock) {
     //TODO(song): get HAL position
-    if (priv->sr_)
-      *cur = gst_util_uint64_scale_int(priv->render_samples, GST_SECOND, priv->sr_);
+    /* render_samples counts input frames, sr_ is HAL rate if resampled */
+    guint rate = priv->resampler ? GST_AUDIO_INFO_RATE (&priv->spec.info) : priv->sr_;
+    if (rate)
+      *cur = gst_util_uint64_scale_int(priv->render_samples, GST_SECOND, rate);
+    if (priv->render_samples)
+      startup_mark (sink, STARTUP_FIRST_POSITION);
     if (pmono)
       *pmono = 0;
   } else if (gst_aml_clock_get_clock_type(priv->provided_clock) == GST_AML_CLOCK_TYPE_MEDIASYNC) {
@@ -857,7 +1523,9 @@ get_position (GstAmlHalAsink* sink, GstFormat format, pos_t pos_type, gint64 * c
       if (*cur < 0) {
         *cur = priv->segment.start;
         return TRUE;
-      } else if (priv->first_pts_set && (int)(priv->first_pts - (*cur * 90 / 1000)) > 0 &&
+      }
+      startup_mark (sink, STARTUP_FIRST_POSITION);
+      if (priv->first_pts_set && (int)(priv->first_pts - (*cur * 90 / 1000)) > 0 &&
                 (int)(priv->first_pts - (*cur * 90 / 1000)) < 90000 &&
                 priv->sync_mode == AV_SYNC_MODE_AMASTER) {
          *cur = priv->segment.start;
@@ -880,6 +1548,8 @@ get_position (GstAmlHalAsink* sink, GstFormat format, pos_t pos_type, gint64 * c
     if (pmono)
       *pmono = mono;
 
+    if (pcr != -1)
+      startup_mark (sink, STARTUP_FIRST_POSITION);
     if (pcr == -1) {
       if ((priv->paused_ || priv->xrun_paused) && priv->last_pcr != -1) {
         pcr = priv->last_pcr;
@@ -946,6 +1616,99 @@ get_position (GstAmlHalAsink* sink, GstFormat format, pos_t pos_type, gint64 * c
   return TRUE;
 }
 
+/* compressed template structures and the HAL format they open */
+static const struct {
+  const gchar *name;
+  audio_format_t format;
+} caps_formats[] = {
+  { "audio/x-ac3", AUDIO_FORMAT_AC3 },
+  { "audio/x-eac3", AUDIO_FORMAT_E_AC3 },
+  { "audio/x-ac4", AUDIO_FORMAT_AC4 },
+  { "audio/x-true-hd", AUDIO_FORMAT_DOLBY_TRUEHD },
+#ifdef ENABLE_DTS
+  { "audio/x-dts", AUDIO_FORMAT_DTS },
+#endif
+  { "audio/x-private1-lpcm", AUDIO_FORMAT_PCM_LPCM_DVD },
+  { "audio/x-private2-lpcm", AUDIO_FORMAT_PCM_LPCM_1394 },
+  { "audio/x-private-ts-lpcm", AUDIO_FORMAT_PCM_LPCM_BLURAY },
+};
+
+/* template caps without the compressed formats HAL did not report for
+ * the port. Raw stays as the template has it, render converts and
+ * resamples whatever HAL does not take */
+static GstCaps *
+hal_caps_to_gst (GstCaps * tmpl, const struct hal_caps * hc)
+{
+  GstCaps *caps = gst_caps_new_empty ();
+  guint i, j;
+
+  for (i = 0; i < gst_caps_get_size (tmpl); i++) {
+    GstStructure *st = gst_structure_copy (gst_caps_get_structure (tmpl, i));
+    const gchar *name = gst_structure_get_name (st);
+    gboolean keep = TRUE;
+
+    if (hc->n_formats && !g_str_equal (name, "audio/x-raw")) {
+      for (j = 0; j < G_N_ELEMENTS (caps_formats); j++) {
+        if (g_str_equal (name, caps_formats[j].name)) {
+          keep = hal_caps_has_format (hc, caps_formats[j].format);
+          break;
+        }
+      }
+    }
+
+    if (keep)
+      gst_caps_append_structure (caps, st);
+    else
+      gst_structure_free (st);
+  }
+  return caps;
+}
+
+/* answer caps queries from the HAL capability cache, probing the port
+ * once if nothing is known. NULL leaves basesink to the template */
+static GstCaps *
+gst_aml_hal_asink_get_caps (GstBaseSink * bsink, GstCaps * filter)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (bsink);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  audio_output_flags_t flag;
+  audio_devices_t device;
+  audio_hw_device_t *dev;
+  struct hal_caps hc;
+  GstCaps *tmpl, *caps;
+  int ret;
+
+  /* system sound port resamples and mixes whatever the template takes,
+   * and a query in NULL must not take over the HAL */
+  if (!priv->direct_mode_ || priv->tts_mode_ ||
+      GST_STATE (sink) < GST_STATE_READY || !hal_join (sink))
+    return NULL;
+
+  /* the probe opens a stream, never under the object lock */
+  SINK_OBJECT_LOCK (sink);
+  dev = priv->hw_dev_;
+  ret = dev && hal_stream_route (sink, &flag, &device) ? 0 : -1;
+  SINK_OBJECT_UNLOCK (sink);
+  if (!ret)
+    ret = hal_caps_get (dev, device, &hc);
+  if (ret)
+    return NULL;
+
+  tmpl = gst_pad_get_pad_template_caps (bsink->sinkpad);
+  caps = hal_caps_to_gst (tmpl, &hc);
+  gst_caps_unref (tmpl);
+  GST_LOG_OBJECT (sink, "hal caps %" GST_PTR_FORMAT, caps);
+
+  if (filter) {
+    GstCaps *tmp = gst_caps_intersect_full (filter, caps,
+        GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref (caps);
+    caps = tmp;
+  }
+  return caps;
+}
+
 static gboolean
 gst_aml_hal_asink_query (GstElement * element, GstQuery * query)
 {
@@ -988,9 +1751,9 @@ gst_aml_hal_asink_query (GstElement * element, GstQuery * query)
         if (live && us_live) {
           uint32_t latency;
 
-          GST_OBJECT_LOCK (sink);
+          SINK_OBJECT_LOCK (sink);
           latency = hal_get_latency (sink);
-          GST_OBJECT_UNLOCK (sink);
+          SINK_OBJECT_UNLOCK (sink);
 
           base_latency =
               gst_util_uint64_scale_int (latency, GST_SECOND, 1000);
@@ -1026,10 +1789,10 @@ gst_aml_hal_asink_query (GstElement * element, GstQuery * query)
       GST_LOG_OBJECT (sink, "query convert");
 
       gst_query_parse_convert (query, &src_fmt, &src_val, &dest_fmt, NULL);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       res = gst_audio_info_convert (&priv->spec.info, src_fmt,
           src_val, dest_fmt, &dest_val);
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       if (res) {
         gst_query_set_convert (query, src_fmt, src_val, dest_fmt, dest_val);
       }
@@ -1112,6 +1875,15 @@ gst_aml_hal_sink_set_stream_volume (GstAmlHalAsink * sink, float vol, gboolean f
   if (!force && vol == priv->stream_volume)
     return;
 
+  if (priv->pcm_proc_used) {
+    g_atomic_int_set (&priv->sw_volume, (gint)(vol * PCM_PROCESS_UNITY + 0.5f));
+    GST_LOG_OBJECT(sink, "pcm volume set to %f", vol);
+    priv->stream_volume = vol;
+    if (priv->mute)
+      priv->stream_volume_bak = vol;
+    return;
+  }
+
   ret = priv->stream_->set_volume (priv->stream_, vol, vol);
   if (ret)
     GST_ERROR_OBJECT(sink, "set volume fail %d", ret);
@@ -1141,6 +1913,13 @@ gst_aml_hal_sink_set_stream_mute (GstAmlHalAsink * sink, gboolean mute)
   }
 
   GST_WARNING_OBJECT (sink, "set stream mute:%d", mute);
+  if (priv->pcm_proc_used) {
+    if (mute)
+      priv->stream_volume_bak = priv->stream_volume;
+    g_atomic_int_set (&priv->sw_mute, mute);
+    priv->mute = mute;
+    return;
+  }
   if (mute) {
     target = 0;
     priv->stream_volume_bak = priv->stream_volume;
@@ -1173,14 +1952,108 @@ static void remove_clock (GObject * object)
   GST_OBJECT_FLAG_UNSET (basesink, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
 }
 
+static void startup_reset (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint i;
+
+  SINK_OBJECT_LOCK (sink);
+  priv->startup_base = g_get_monotonic_time ();
+  SINK_OBJECT_UNLOCK (sink);
+  for (i = 0; i < STARTUP_NUM; i++)
+    g_atomic_int_set (&priv->startup[i], -1);
+  priv->startup_posted = FALSE;
+}
+
+/* first hit of @mark in this start, cheap enough for hot paths. Takes
+ * the object lock on the first hit only, not to be called with it held */
+static inline void startup_mark (GstAmlHalAsink * sink, gint mark)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint64 base, us;
+
+  if (G_LIKELY (g_atomic_int_get (&priv->startup[mark]) >= 0))
+    return;
+  SINK_OBJECT_LOCK (sink);
+  base = priv->startup_base;
+  SINK_OBJECT_UNLOCK (sink);
+  us = MIN (g_get_monotonic_time () - base, G_MAXINT);
+  if (g_atomic_int_compare_and_exchange (&priv->startup[mark], -1, (gint) us))
+    GST_INFO_OBJECT (sink, "startup %s %" G_GINT64_FORMAT, startup_names[mark], us);
+}
+
+static GstStructure* startup_get_status (GstAmlHalAsink * sink,
+    const gchar * name)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstStructure *s;
+  gint i;
+
+  s = gst_structure_new (name,
+      "wait-video", G_TYPE_BOOLEAN, priv->wait_video,
+      "aligned-timeout", G_TYPE_INT, priv->aligned_timeout,
+      "warm-switch", G_TYPE_BOOLEAN, priv->warm_switch, NULL);
+  for (i = 0; i < STARTUP_NUM; i++)
+    gst_structure_set (s, startup_names[i], G_TYPE_INT64,
+        (gint64) g_atomic_int_get (&priv->startup[i]), NULL);
+  return s;
+}
+
+/* one element message per start, from render once position is valid.
+ * Until then render asks for the position itself after the first
+ * commit, the message must not wait for an application query */
+static void startup_post (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (G_LIKELY (priv->startup_posted))
+    return;
+  if (g_atomic_int_get (&priv->startup[STARTUP_FIRST_POSITION]) < 0) {
+    gint64 cur;
+
+    if (g_atomic_int_get (&priv->startup[STARTUP_FIRST_COMMIT]) < 0)
+      return;
+    /* marks the first position when it is valid */
+    get_position (sink, GST_FORMAT_TIME, POS_WALL, &cur, NULL);
+    if (g_atomic_int_get (&priv->startup[STARTUP_FIRST_POSITION]) < 0)
+      return;
+  }
+  priv->startup_posted = TRUE;
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_element (GST_OBJECT_CAST (sink),
+        startup_get_status (sink, "aml-asink-startup")));
+}
+
 static GstStructure* sink_get_status (GstAmlHalAsink* sink)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct hal_param_counts hc;
+  GstStructure *startup, *s;
 
   g_return_val_if_fail (sink != NULL, NULL);
-  return gst_structure_new ("application/x-gst-base-sink-stats",
+  hal_param_get_counts (&priv->hparam, &hc);
+  startup = startup_get_status (sink, "startup");
+  s = gst_structure_new ("application/x-gst-base-sink-stats",
+      "hal-param-sets", G_TYPE_UINT64, hc.sets,
+      "hal-param-gets", G_TYPE_UINT64, hc.gets,
+      "hal-param-suppressed", G_TYPE_UINT64, hc.suppressed,
+      "hal-param-batched", G_TYPE_UINT64, hc.batched,
       "dropped", G_TYPE_UINT64, priv->dropped_frames,
-      "rendered", G_TYPE_UINT64, priv->rendered_frames, NULL);
+      "rendered", G_TYPE_UINT64, priv->rendered_frames,
+      "coalesced", G_TYPE_UINT64, priv->coal_saved,
+      "mixed", G_TYPE_UINT64, priv->mix_frames,
+      "chunk-bytes", G_TYPE_UINT, priv->chunk_size,
+      "chunk-min", G_TYPE_UINT, priv->chunk_min,
+      "chunk-max", G_TYPE_UINT, priv->chunk_max,
+      "write-block-us", G_TYPE_INT64, priv->chunk_block_us,
+      "start-frames", G_TYPE_UINT, priv->start_batch,
+      "start-wait-us", G_TYPE_INT64, priv->start_wait_us,
+      "warm-switches", G_TYPE_UINT64, priv->warm_switches,
+      "avsync-rearms", G_TYPE_UINT64, priv->avsync_rearms,
+      "hal-wait-us", G_TYPE_INT64, priv->hal_wait_us,
+      "startup", GST_TYPE_STRUCTURE, startup, NULL);
+  gst_structure_free (startup);
+  return s;
 }
 
 static void
@@ -1189,20 +2062,16 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
 {
   GstAmlHalAsink *sink = GST_AML_HAL_ASINK (object);
   GstAmlHalAsinkPrivate *priv = sink->priv;
-#ifdef ENABLE_MS12
-  char setting[50];
-#endif
 
   switch (property_id) {
     case PROP_DIRECT_MODE:
     {
       priv->direct_mode_ = g_value_get_boolean(value);
       GST_DEBUG_OBJECT (sink, "set direct mode:%d", priv->direct_mode_);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->tempo_used && !priv->direct_mode_) {
         GST_DEBUG_OBJECT (sink, "disable scaletempo for non-direct mode");
-        scaletempo_stop (&priv->st);
-        priv->tempo_used = FALSE;
+        g_atomic_int_set (&priv->tempo_stop_req, TRUE);
       }
       if (!priv->direct_mode_ && priv->provided_clock) {
         GstAmlHalAsinkClass *class = GST_AML_HAL_ASINK_GET_CLASS(object);
@@ -1214,7 +2083,7 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
         eclass->provide_clock = NULL;
         GST_OBJECT_FLAG_UNSET (basesink, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       if (!priv->direct_mode_) {
         GstBaseSink *basesink = GST_BASE_SINK_CAST (sink);
         gst_element_remove_pad (GST_ELEMENT_CAST (basesink), basesink->sinkpad);
@@ -1234,9 +2103,17 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
       GST_WARNING_OBJECT (sink, "set tts mode:%d", priv->tts_mode_);
       break;
     case PROP_OUTPUT_PORT:
+    {
+      audio_output_flags_t flag;
+      audio_devices_t device;
+
       priv->output_port_ = g_value_get_enum (value);
       GST_DEBUG_OBJECT (sink, "set output port:%d", priv->output_port_);
+      /* whatever is connected there now may differ from the last probe */
+      if (hal_stream_route (sink, &flag, &device))
+        hal_caps_invalidate (device);
       break;
+    }
     case PROP_MASTER_VOLUME:
     case PROP_STREAM_VOLUME:
     {
@@ -1322,23 +2199,20 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
       priv->tempo_disable = g_value_get_boolean(value);
       GST_WARNING_OBJECT (sink, "disable tempo stretch:%d", priv->tempo_disable);
       if (priv->tempo_used && priv->tempo_disable) {
-        GST_OBJECT_LOCK (sink);
         GST_DEBUG_OBJECT (sink, "disable scaletempo");
-        scaletempo_stop (&priv->st);
-        priv->tempo_used = FALSE;
-        GST_OBJECT_UNLOCK (sink);
+        g_atomic_int_set (&priv->tempo_stop_req, TRUE);
       }
       break;
 #ifdef ENABLE_MS12
     case PROP_AC4_P_GROUP_IDX:
     {
       priv->ac4_pres_group_idx = g_value_get_int(value);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-ac4_pres_group_idx %d", priv->ac4_pres_group_idx);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-ac4_pres_group_idx", "%d", priv->ac4_pres_group_idx);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       GST_WARNING_OBJECT (sink, "ac4_pres_group_idx:%d", priv->ac4_pres_group_idx);
       break;
     }
@@ -1356,12 +2230,12 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
         priv->ac4_pat = 255;
       }
       GST_WARNING_OBJECT (sink, "ac4_pat:%d", priv->ac4_pat);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-pat %d", priv->ac4_pat);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-pat", "%d", priv->ac4_pat);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       break;
     }
     case PROP_AC4_LANG_1:
@@ -1378,12 +2252,12 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
         priv->ac4_lang = NULL;
         break;
       }
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-lang %s", priv->ac4_lang);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-lang", "%s", priv->ac4_lang);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       GST_WARNING_OBJECT (sink, "ac4_lang:%s", priv->ac4_lang);
       break;
     case PROP_AC4_LANG_2:
@@ -1400,12 +2274,12 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
         priv->ac4_lang2 = NULL;
         break;
       }
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-lang2 %s", priv->ac4_lang2);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-lang2", "%s", priv->ac4_lang2);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       GST_WARNING_OBJECT (sink, "ac4_lang2:%s", priv->ac4_lang2);
       break;
     case PROP_AC4_ASS_TYPE:
@@ -1423,36 +2297,36 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
         GST_ERROR_OBJECT (sink, "wrong ass type %s", type);
         priv->ac4_ass_type = 255;
       }
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-at %d", priv->ac4_ass_type);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-at", "%d", priv->ac4_ass_type);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       GST_WARNING_OBJECT (sink, "ac4_ass_type:%d", priv->ac4_ass_type);
       break;
     }
     case PROP_AC4_MIXER_BALANCE:
     {
       priv->ac4_mixer_gain = g_value_get_int(value);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-xu %d", priv->ac4_mixer_gain);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-xu", "%d", priv->ac4_mixer_gain);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       GST_WARNING_OBJECT (sink, "ac4_mixer_gain:%d", priv->ac4_mixer_gain);
       break;
     }
     case PROP_MS12_MIX_EN:
     {
       priv->ms12_mix_en = g_value_get_int(value);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->hw_dev_) {
-        snprintf(setting, sizeof(setting), "ms12_runtime=-xa %d", priv->ms12_mix_en);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+        hal_param_ms12_add (&priv->hparam, priv->hw_dev_, "-xa", "%d", priv->ms12_mix_en);
+        hal_param_ms12_commit (&priv->hparam, priv->hw_dev_);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       GST_WARNING_OBJECT (sink, "ms12 mix enable:%d", priv->ms12_mix_en);
       break;
     }
@@ -1484,6 +2358,71 @@ gst_aml_hal_asink_set_property (GObject * object, guint property_id,
       priv->aligned_timeout = g_value_get_int(value);
       GST_WARNING_OBJECT (sink, "timeout:%d", priv->aligned_timeout);
       break;
+    case PROP_SCHED_POLICY:
+    case PROP_SCHED_PRIORITY:
+    case PROP_SCHED_RUNTIME:
+    case PROP_SCHED_PERIOD:
+    case PROP_CPU_AFFINITY:
+      SINK_OBJECT_LOCK (sink);
+      if (property_id == PROP_SCHED_POLICY)
+        priv->sched.policy = g_value_get_enum (value);
+      else if (property_id == PROP_SCHED_PRIORITY)
+        priv->sched.priority = g_value_get_int (value);
+      else if (property_id == PROP_SCHED_RUNTIME)
+        priv->sched.runtime_ns = g_value_get_uint64 (value);
+      else if (property_id == PROP_SCHED_PERIOD)
+        priv->sched.period_ns = g_value_get_uint64 (value);
+      else
+        priv->sched.cpu_mask = g_value_get_uint64 (value);
+      SINK_OBJECT_UNLOCK (sink);
+      /* running threads pick it up on their next iteration */
+      g_atomic_int_inc (&priv->sched_gen);
+      GST_DEBUG_OBJECT (sink, "%s changed", pspec->name);
+      break;
+    case PROP_TRACE_LOCATION:
+      SINK_OBJECT_LOCK (sink);
+      g_free (priv->trace_location);
+      priv->trace_location = g_value_dup_string (value);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_TRACE_PAYLOAD:
+      priv->trace_payload = g_value_get_boolean (value);
+      break;
+    case PROP_ADAPTIVE_CHUNK:
+      priv->chunk_adapt = g_value_get_boolean (value);
+      break;
+    case PROP_PCR_START_FRAMES:
+      FEED_LOCK (priv);
+      priv->start_frames = g_value_get_int (value);
+      FEED_UNLOCK (priv);
+      break;
+    case PROP_PCR_START_TIME:
+      FEED_LOCK (priv);
+      priv->start_ms = g_value_get_int (value);
+      FEED_UNLOCK (priv);
+      break;
+    case PROP_ASYNC_HAL_LOAD:
+      priv->async_hal_load = g_value_get_boolean (value);
+      break;
+    case PROP_WARM_SWITCH:
+      /* takes effect on next caps or flush */
+      priv->warm_switch = g_value_get_boolean (value);
+      GST_DEBUG_OBJECT (sink, "warm switch %d", priv->warm_switch);
+      break;
+    case PROP_COALESCE_TIME:
+      /* render writes out what it holds with the next buffer */
+      g_atomic_int_set (&priv->coalesce_ms, g_value_get_int (value));
+      GST_DEBUG_OBJECT (sink, "coalesce time %d", g_value_get_int (value));
+      break;
+    case PROP_LOCK_PROFILE_ENABLE:
+      lock_prof_enable (&priv->lprof, g_value_get_boolean (value));
+      GST_DEBUG_OBJECT (sink, "lock profile %d", g_value_get_boolean (value));
+      break;
+    case PROP_RESAMPLE_QUALITY:
+      /* takes effect on next caps */
+      priv->resample_quality = g_value_get_int(value);
+      GST_DEBUG_OBJECT (sink, "resample quality:%d", priv->resample_quality);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1537,6 +2476,66 @@ static void gst_aml_hal_asink_get_property (GObject * object, guint property_id,
     case PROP_A_WAIT_TIMEOUT:
       g_value_set_int (value, priv->aligned_timeout);
       break;
+    case PROP_RESAMPLE_QUALITY:
+      g_value_set_int (value, priv->resample_quality);
+      break;
+    case PROP_LOCK_PROFILE_ENABLE:
+      g_value_set_boolean (value, g_atomic_int_get (&priv->lprof.enabled));
+      break;
+    case PROP_LOCK_PROFILE:
+      g_value_take_boxed (value, lock_prof_summary (&priv->lprof));
+      break;
+    case PROP_SCHED_POLICY:
+      SINK_OBJECT_LOCK (sink);
+      g_value_set_enum (value, priv->sched.policy);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_SCHED_PRIORITY:
+      SINK_OBJECT_LOCK (sink);
+      g_value_set_int (value, priv->sched.priority);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_SCHED_RUNTIME:
+      SINK_OBJECT_LOCK (sink);
+      g_value_set_uint64 (value, priv->sched.runtime_ns);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_SCHED_PERIOD:
+      SINK_OBJECT_LOCK (sink);
+      g_value_set_uint64 (value, priv->sched.period_ns);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_CPU_AFFINITY:
+      SINK_OBJECT_LOCK (sink);
+      g_value_set_uint64 (value, priv->sched.cpu_mask);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_TRACE_LOCATION:
+      SINK_OBJECT_LOCK (sink);
+      g_value_set_string (value, priv->trace_location);
+      SINK_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_TRACE_PAYLOAD:
+      g_value_set_boolean (value, priv->trace_payload);
+      break;
+    case PROP_COALESCE_TIME:
+      g_value_set_int (value, g_atomic_int_get (&priv->coalesce_ms));
+      break;
+    case PROP_ADAPTIVE_CHUNK:
+      g_value_set_boolean (value, priv->chunk_adapt);
+      break;
+    case PROP_PCR_START_FRAMES:
+      g_value_set_int (value, priv->start_frames);
+      break;
+    case PROP_PCR_START_TIME:
+      g_value_set_int (value, priv->start_ms);
+      break;
+    case PROP_WARM_SWITCH:
+      g_value_set_boolean (value, priv->warm_switch);
+      break;
+    case PROP_ASYNC_HAL_LOAD:
+      g_value_set_boolean (value, priv->async_hal_load);
+      break;
     case PROP_DISABLE_TEMPO_STRETCH:
       g_value_set_boolean (value, priv->tempo_disable);
       break;
@@ -1707,6 +2706,116 @@ static gboolean caps_not_changed(GstAmlHalAsink *sink, GstCaps * cur, GstCaps *
   return ret;
 }
 
+/* HAL channel order of the masks picked in hal_parse_spec */
+static const GstAudioChannelPosition *
+hal_channel_order (gint channels)
+{
+  static const GstAudioChannelPosition pos_2[] = {
+    GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+  };
+  static const GstAudioChannelPosition pos_3[] = {
+    GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_LFE1,
+  };
+  static const GstAudioChannelPosition pos_4[] = {
+    GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_TOP_SIDE_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_TOP_SIDE_RIGHT,
+  };
+  static const GstAudioChannelPosition pos_6[] = {
+    GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_CENTER,
+    GST_AUDIO_CHANNEL_POSITION_LFE1,
+    GST_AUDIO_CHANNEL_POSITION_REAR_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_REAR_RIGHT,
+  };
+  static const GstAudioChannelPosition pos_7[] = {
+    GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_CENTER,
+    GST_AUDIO_CHANNEL_POSITION_LFE1,
+    GST_AUDIO_CHANNEL_POSITION_REAR_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_REAR_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_REAR_CENTER,
+  };
+  static const GstAudioChannelPosition pos_8[] = {
+    GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_FRONT_CENTER,
+    GST_AUDIO_CHANNEL_POSITION_LFE1,
+    GST_AUDIO_CHANNEL_POSITION_REAR_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_REAR_RIGHT,
+    GST_AUDIO_CHANNEL_POSITION_SIDE_LEFT,
+    GST_AUDIO_CHANNEL_POSITION_SIDE_RIGHT,
+  };
+
+  switch (channels) {
+    case 2: return pos_2;
+    case 3: return pos_3;
+    case 4: return pos_4;
+    case 6: return pos_6;
+    case 7: return pos_7;
+    case 8: return pos_8;
+    default: return NULL;
+  }
+}
+
+/* PCM volume, mute and channel order are applied in render right before
+ * hal_commit, kernel is picked by channel count here */
+static void
+hal_setup_pcm_process (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstAudioInfo *info = &priv->hal_info;
+  const GstAudioChannelPosition *to;
+  gint reorder[PCM_PROCESS_MAX_CH];
+  gint map[PCM_PROCESS_MAX_CH];
+  const gint *mapp = NULL;
+  gint channels, i;
+
+  priv->pcm_proc_used = FALSE;
+  FEED_LOCK (priv);
+  gst_buffer_replace (&priv->fade_hold, NULL);
+  FEED_UNLOCK (priv);
+  if (!is_raw_type(priv->spec.type) || priv->format_ != AUDIO_FORMAT_PCM_16_BIT)
+    return;
+
+  channels = GST_AUDIO_INFO_CHANNELS (info);
+  to = hal_channel_order (channels);
+  if (to && !GST_AUDIO_INFO_IS_UNPOSITIONED (info) &&
+      gst_audio_get_channel_reorder_map (channels, info->position, to, reorder)) {
+    for (i = 0; i < channels; i++)
+      map[reorder[i]] = i;
+    mapp = map;
+  }
+
+  /* 10ms gain smoothing */
+  if (pcm_process_setup (&priv->pcm_proc, channels, mapp,
+        GST_AUDIO_INFO_RATE (info) / 100)) {
+    GST_WARNING_OBJECT (sink, "no pcm process for %d ch", channels);
+    return;
+  }
+  /* take delayed and HAL side volume/mute before the gain reset, else
+   * the stream starts at the old level */
+  if (priv->mute_pending && priv->mute)
+    priv->stream_volume_bak = priv->stream_volume;
+  priv->stream_volume_pending = FALSE;
+  priv->mute_pending = FALSE;
+  g_atomic_int_set (&priv->sw_volume,
+      (gint)(priv->stream_volume * PCM_PROCESS_UNITY + 0.5f));
+  g_atomic_int_set (&priv->sw_mute, priv->mute);
+  pcm_process_set_volume (&priv->pcm_proc, g_atomic_int_get (&priv->sw_volume));
+  pcm_process_set_mute (&priv->pcm_proc, g_atomic_int_get (&priv->sw_mute));
+  pcm_process_reset_gain (&priv->pcm_proc);
+  priv->pcm_proc_used = TRUE;
+  GST_DEBUG_OBJECT (sink, "pcm process %d ch remap %d", channels,
+      priv->pcm_proc.remap);
+}
+
 static gboolean gst_aml_hal_asink_setcaps (GstAmlHalAsink* sink,
     GstCaps * caps, gboolean force_change)
 {
@@ -1722,14 +2831,39 @@ static gboolean gst_aml_hal_asink_setcaps (GstAmlHalAsink* sink,
     return TRUE;
   }
 
-  GST_DEBUG_OBJECT (sink, "release old hal");
+  if (!hal_join (sink)) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE,
+        (NULL), ("can not load audio HAL"));
+    return FALSE;
+  }
 
-  /* release old ringbuffer */
-  stop_xrun_thread (sink);
-  GST_OBJECT_LOCK (sink);
-  hal_release (sink);
-  priv->flushing_ = FALSE;
-  GST_OBJECT_UNLOCK (sink);
+  /* program switch, time the new start */
+  if (g_atomic_int_get (&priv->startup[STARTUP_FIRST_BUFFER]) >= 0)
+    startup_reset (sink);
+
+  if (priv->warm_switch && priv->stream_) {
+    /* flush only, hal_acquire decides if the stream can stay */
+    GST_DEBUG_OBJECT (sink, "stop old hal");
+    SINK_OBJECT_LOCK (sink);
+    if (!hal_stop (sink))
+      hal_release (sink);
+    priv->flushing_ = FALSE;
+    if (priv->xrun_timer) {
+      g_timer_start (priv->xrun_timer);
+      g_timer_stop (priv->xrun_timer);
+      priv->xrun_paused = false;
+    }
+    SINK_OBJECT_UNLOCK (sink);
+  } else {
+    GST_DEBUG_OBJECT (sink, "release old hal");
+
+    /* release old ringbuffer */
+    stop_xrun_thread (sink);
+    SINK_OBJECT_LOCK (sink);
+    hal_release (sink);
+    priv->flushing_ = FALSE;
+    SINK_OBJECT_UNLOCK (sink);
+  }
 
   GST_DEBUG_OBJECT (sink, "parse caps: %" GST_PTR_FORMAT, caps);
 
@@ -1741,15 +2875,19 @@ static gboolean gst_aml_hal_asink_setcaps (GstAmlHalAsink* sink,
     goto parse_error;
 
   GST_DEBUG_OBJECT (sink, "acquire");
-  GST_OBJECT_LOCK (sink);
+  SINK_OBJECT_LOCK (sink);
   if (!hal_acquire (sink, spec)) {
-    GST_OBJECT_UNLOCK (sink);
+    SINK_OBJECT_UNLOCK (sink);
     goto acquire_error;
   }
-  GST_OBJECT_UNLOCK (sink);
+  SINK_OBJECT_UNLOCK (sink);
+
+  hal_setup_pcm_process (sink);
+  mix_main_sync (sink);
 
   if (create_av_sync(sink))
     return FALSE;
+  startup_mark (sink, STARTUP_AVSYNC);
 
   if (priv->stream_volume_pending) {
     priv->stream_volume_pending = FALSE;
@@ -1760,10 +2898,12 @@ static gboolean gst_aml_hal_asink_setcaps (GstAmlHalAsink* sink,
     priv->mute_pending = FALSE;
   }
 
+  g_atomic_int_set (&priv->tempo_stop_req, FALSE);
+  g_free (tempo_take_update (sink));
   if (is_raw_type(spec->type) && priv->direct_mode_ && !priv->tempo_disable) {
     priv->tempo_used = TRUE;
     scaletempo_start (&priv->st);
-    scaletempo_set_info (&priv->st, &spec->info);
+    scaletempo_set_info (&priv->st, &priv->hal_info);
   } else {
     scaletempo_stop (&priv->st);
     priv->tempo_used = FALSE;
@@ -1800,6 +2940,9 @@ static inline void gst_aml_hal_asink_reset_sync (GstAmlHalAsink * sink, gboolean
   priv->commit_time = GST_CLOCK_TIME_NONE;
   priv->commit_count = 0;
   priv->commit_size = 0;
+  /* flushed data, nothing left to write */
+  priv->coal_size = 0;
+  priv->coal_time = GST_CLOCK_TIME_NONE;
   priv->flushing_ = FALSE;
   priv->first_pts_set = FALSE;
   priv->wrapping_time = 0;
@@ -1812,10 +2955,9 @@ static inline void gst_aml_hal_asink_reset_sync (GstAmlHalAsink * sink, gboolean
   priv->gap_offset = 0;
   priv->quit_clock_wait = FALSE;
   priv->group_done = FALSE;
-  if (priv->start_buf) {
-    gst_buffer_unref (priv->start_buf);
-    priv->start_buf = NULL;
-  }
+  priv->start_size = 0;
+  priv->start_count = 0;
+  priv->start_dur = 0;
   priv->start_buf_sent = FALSE;
   priv->dropped_frames = 0;
   priv->rendered_frames = 0;
@@ -1985,9 +3127,9 @@ gst_aml_hal_asink_wait_event (GstBaseSink * bsink, GstEvent * event)
         return GST_FLOW_ERROR;
       }
 
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       sink_force_start (sink);
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       break;
 #endif
     default:
@@ -2018,74 +3160,119 @@ static int update_avsync_speed(GstAmlHalAsink *sink, float rate)
   return rc;
 }
 
+/* caller holds feed_lock */
+static void avsync_drop (GstAmlHalAsink *sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  void *tmp = priv->avsync;
+
+  priv->avsync_rearm = FALSE;
+  if (!tmp)
+    return;
+  g_atomic_pointer_set (&priv->avsync, NULL);
+  av_sync_destroy (tmp);
+}
+
+/* bind the stream to the sync session, skipped when it already is. A
+ * new segment on a running stream asks again, hal_stop drops the binding
+ * on HAL side and forgets it here so a warm re-arm sends it */
+static void
+hal_set_hw_av_sync (GstAmlHalAsink * sink, int type)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  hal_param_stream_set (&priv->hparam, priv->stream_, "hw_av_sync_type",
+      "%d", type);
+  hal_param_stream_set (&priv->hparam, priv->stream_, "hw_av_sync",
+      "%d", priv->session_id);
+}
+
+/* start policy and hw sync id for the next audio start, on a new or a
+ * kept handle. Caller holds feed_lock */
+static int avsync_arm (GstAmlHalAsink *sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct start_policy policy;
+
+  if (!priv->stream_) {
+    avsync_drop (sink);
+    GST_ERROR_OBJECT (sink, "no stream opened");
+    return -1;
+  }
+
+  if (priv->seamless_switch)
+  {
+    GST_INFO_OBJECT (sink, "SET AVSYNC audio switch to ALIGN mode");
+    policy.policy = AV_SYNC_START_ALIGN;
+    policy.timeout = -1;
+    avs_sync_set_start_policy (priv->avsync, &policy);
+  }
+
+  if (priv->wait_video) {
+    policy.policy = AV_SYNC_START_ALIGN;
+    policy.timeout = priv->aligned_timeout;
+    GST_INFO_OBJECT (sink, "set policy=align,  timeout=%d", policy.timeout);
+    avs_sync_set_start_policy (priv->avsync, &policy);
+  }
+  /* set session into hwsync id */
+  hal_set_hw_av_sync (sink, GST_AML_CLOCK_TYPE_MSYNC);
+  return 0;
+}
+
 static int create_av_sync(GstAmlHalAsink *sink)
 {
   int ret = 0;
   GstAmlHalAsinkPrivate *priv = sink->priv;
 
+  if (priv->avsync_rearm) {
+    /* kept over a flush or switch, only good for what it was made for */
+    FEED_LOCK (priv);
+    if (priv->avsync && (priv->session_id != priv->avsync_session ||
+          priv->sync_mode != priv->avsync_mode || !priv->direct_mode_)) {
+      GST_INFO_OBJECT (sink, "avsync session %d mode %d changed, recreate",
+          priv->avsync_session, priv->avsync_mode);
+      avsync_drop (sink);
+    } else if (priv->avsync) {
+      priv->avsync_rearm = FALSE;
+      ret = avsync_arm (sink);
+      if (!ret)
+        priv->avsync_rearms++;
+      FEED_UNLOCK (priv);
+      GST_INFO_OBJECT (sink, "avsync re-armed %d", ret);
+      return ret;
+    }
+    priv->avsync_rearm = FALSE;
+    FEED_UNLOCK (priv);
+  }
+
   if (priv->direct_mode_ && gst_aml_clock_get_clock_type(priv->provided_clock) == GST_AML_CLOCK_TYPE_MEDIASYNC) {
-    char id_setting[20] = {0};
-    char type_setting[20] = {0};
-    snprintf(type_setting, sizeof(type_setting), "hw_av_sync_type=%d", GST_AML_CLOCK_TYPE_MEDIASYNC);
-    snprintf(id_setting, sizeof(id_setting), "hw_av_sync=%d", priv->session_id);
     if (priv->stream_) {
-      priv->stream_->common.set_parameters (&priv->stream_->common, type_setting);
-      priv->stream_->common.set_parameters (&priv->stream_->common, id_setting);
+      hal_set_hw_av_sync (sink, GST_AML_CLOCK_TYPE_MEDIASYNC);
     } else {
       GST_ERROR_OBJECT (sink, "no stream opened");
       ret = -1;
     }
   } else if (!priv->avsync && priv->direct_mode_) {
-    char id_setting[20] = {0};
-    char type_setting[20] = {0};
-    struct start_policy policy;
-
 #ifdef SUPPORT_AD
     if (priv->is_ad_audio)
       return 0;
 #endif
 
-    g_mutex_lock(&priv->feed_lock);
+    FEED_LOCK (priv);
     if (priv->seamless_switch || priv->sync_mode == AV_SYNC_MODE_PCR_MASTER) {
       priv->avsync = av_sync_attach (priv->session_id, AV_SYNC_TYPE_AUDIO);
     } else {
       priv->avsync = av_sync_create (priv->session_id, priv->sync_mode, AV_SYNC_TYPE_AUDIO, 0);
     }
     if (!priv->avsync) {
-      g_mutex_unlock(&priv->feed_lock);
+      FEED_UNLOCK (priv);
       GST_ERROR_OBJECT (sink, "create av sync fail");
       return -1;
     }
-    if (priv->seamless_switch)
-    {
-      GST_INFO_OBJECT (sink, "SET AVSYNC audio switch to ALIGN mode");
-      policy.policy = AV_SYNC_START_ALIGN;
-      policy.timeout = -1;
-      avs_sync_set_start_policy (priv->avsync, &policy);
-    }
-
-    if (priv->wait_video) {
-      policy.policy = AV_SYNC_START_ALIGN;
-      policy.timeout = priv->aligned_timeout;
-      GST_INFO_OBJECT (sink, "set policy=align,  timeout=%d", policy.timeout);
-      avs_sync_set_start_policy (priv->avsync, &policy);
-    }
-    /* set session into hwsync id */
-    snprintf(type_setting, sizeof(type_setting), "hw_av_sync_type=%d", GST_AML_CLOCK_TYPE_MSYNC);
-    snprintf(id_setting, sizeof(id_setting), "hw_av_sync=%d", priv->session_id);
-    if (priv->stream_) {
-      priv->stream_->common.set_parameters (&priv->stream_->common, type_setting);
-      priv->stream_->common.set_parameters (&priv->stream_->common, id_setting);
-    } else {
-      if (priv->avsync) {
-        void *tmp = priv->avsync;
-        g_atomic_pointer_set (&priv->avsync, NULL);
-        av_sync_destroy(tmp);
-      }
-      GST_ERROR_OBJECT (sink, "no stream opened");
-      ret = -1;
-    }
-    g_mutex_unlock(&priv->feed_lock);
+    priv->avsync_session = priv->session_id;
+    priv->avsync_mode = priv->sync_mode;
+    ret = avsync_arm (sink);
+    FEED_UNLOCK (priv);
   } else {
     GST_INFO_OBJECT (sink, "no need to create av sync, direct: %d",
         priv->direct_mode_);
@@ -2101,6 +3288,12 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
   GstAmlHalAsinkPrivate *priv = sink->priv;
   GstBaseSink* bsink = GST_BASE_SINK_CAST (sink);
 
+  /* data before these events must be on HAL, flush stop drops it instead */
+  if (GST_EVENT_IS_SERIALIZED (event) &&
+      GST_EVENT_TYPE (event) != GST_EVENT_FLUSH_STOP &&
+      GST_EVENT_TYPE (event) != GST_EVENT_TAG)
+    coalesce_drain (sink);
+
   switch (GST_EVENT_TYPE (event)) {
     case GST_EVENT_EOS:
     {
@@ -2108,13 +3301,14 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
       GstFlowReturn ret;
       GST_DEBUG_OBJECT (sink, "receive eos");
       priv->received_eos = TRUE;
-      GST_OBJECT_LOCK (sink);
+      mix_main_sync (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->xrun_timer) {
         g_timer_start (priv->xrun_timer);
         g_timer_stop (priv->xrun_timer);
         priv->xrun_paused = false;
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
 
       ret = sink_drain (sink);
       if (G_UNLIKELY (ret != GST_FLOW_OK)) {
@@ -2137,7 +3331,7 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
     {
       GST_DEBUG_OBJECT (sink, "flush start");
 
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       priv->received_eos = FALSE;
       priv->flushing_ = TRUE;
       priv->quit_clock_wait = TRUE;
@@ -2145,10 +3339,11 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
       if (priv->avsync)
         avs_sync_stop_audio (priv->avsync);
       /* unblock hal_commit() */
-      g_mutex_lock(&priv->feed_lock);
+      FEED_LOCK (priv);
       g_cond_signal (&priv->run_ready);
-      g_mutex_unlock(&priv->feed_lock);
-      GST_OBJECT_UNLOCK (sink);
+      FEED_UNLOCK (priv);
+      SINK_OBJECT_UNLOCK (sink);
+      mix_main_sync (sink);
       break;
     }
     case GST_EVENT_FLUSH_STOP:
@@ -2157,16 +3352,17 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
 
       gst_event_parse_flush_stop (event, &reset_time);
       GST_DEBUG_OBJECT (sink, "flush stop");
-      GST_OBJECT_LOCK (sink);
+      /* serialized, streaming thread owns tempo state */
       if (priv->tempo_used)
         scaletempo_start (&priv->st);
+      SINK_OBJECT_LOCK (sink);
       hal_stop (sink);
       if (priv->xrun_timer) {
         g_timer_start (priv->xrun_timer);
         g_timer_stop(priv->xrun_timer);
         priv->xrun_paused = false;
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
 
       gst_aml_hal_asink_reset_sync (sink, !reset_time);
       if (reset_time) {
@@ -2175,7 +3371,7 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
             gst_message_new_reset_time (GST_OBJECT_CAST (sink), 0));
       }
 #ifdef DUMP_TO_FILE
-      file_index++;
+      priv->dump_index++;
 #endif
       break;
     }
@@ -2210,8 +3406,11 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
         priv->segment.rate = segment.rate;
       }
 
-      if (priv->tempo_used)
+      if (priv->tempo_used) {
+        /* serialized and newer than any out of band rate */
+        g_free (tempo_take_update (sink));
         scaletempo_update_segment (&priv->st, &priv->segment);
+      }
 
       /* create avsync before rate change */
       if (create_av_sync(sink))
@@ -2283,20 +3482,20 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
         break;
       }
 
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (priv->xrun_timer) {
         g_timer_start (priv->xrun_timer);
         g_timer_stop (priv->xrun_timer);
         priv->xrun_paused = false;
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
 
       sink_drain (sink);
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       hal_stop (sink);
       priv->group_done = TRUE;
       priv->eos_end_time = priv->eos_time;
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       gst_aml_hal_asink_reset_sync (sink, FALSE);
       break;
     }
@@ -2324,12 +3523,12 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
       if (!priv->group_done) {
         GstClockReturn cret;
 
-        GST_OBJECT_LOCK (sink);
+        SINK_OBJECT_LOCK (sink);
         if (priv->xrun_timer) {
           g_timer_start (priv->xrun_timer);
           g_timer_stop (priv->xrun_timer);
         }
-        GST_OBJECT_UNLOCK (sink);
+        SINK_OBJECT_UNLOCK (sink);
         cret = sink_wait_clock (sink, wait_end, duration);
         priv->eos_end_time = wait_end;
         GST_DEBUG_OBJECT (sink, "event-gap wait %d", cret);
@@ -2364,6 +3563,12 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
       gdouble rate;
 
       const GstStructure* s = gst_event_get_structure (event);
+      if (s && gst_structure_has_name (s, kCustomOutputChangedEventName)) {
+        GST_INFO_OBJECT (sink, "output device changed");
+        hal_caps_invalidate (AUDIO_DEVICE_NONE);
+        gst_pad_push_event (bsink->sinkpad, gst_event_new_reconfigure ());
+        break;
+      }
       if (s && gst_structure_has_name (s, kCustomInstantRateChangeEventName)) {
         const GValue *v = gst_structure_get_value (s, "rate");
         if (v) {
@@ -2375,15 +3580,16 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
       if (!got_rate)
         break;
 
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       if (!priv->avsync) {
         GST_ERROR_OBJECT (sink, "segment event not received yet");
-        GST_OBJECT_UNLOCK (sink);
+        SINK_OBJECT_UNLOCK (sink);
         break;
       }
       if (priv->tempo_used) {
         priv->segment.rate = rate;
-        scaletempo_update_segment (&priv->st, &priv->segment);
+        /* out of band, render applies it */
+        tempo_post_update (sink, rate, priv->segment.start);
       }
 
       if (priv->direct_mode_) {
@@ -2393,7 +3599,7 @@ gst_aml_hal_asink_event (GstAmlHalAsink *sink, GstEvent * event)
           priv->need_update_rate = TRUE;
         GST_INFO_OBJECT (sink, "rate to %f", rate);
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
       break;
     }
     default:
@@ -2416,6 +3622,7 @@ gst_aml_hal_asink_pad_event (GstPad * pad, GstObject * parent, GstEvent * event)
 
   if (GST_EVENT_TYPE (event) != GST_EVENT_TAG)
     GST_DEBUG_OBJECT (sink, "received event %p %" GST_PTR_FORMAT, event, event);
+  buf_trace_event (priv->trace, event);
 
   if (GST_EVENT_IS_SERIALIZED (event)) {
     if (G_UNLIKELY (priv->flushing_) &&
@@ -2448,6 +3655,43 @@ after_eos:
   }
 }
 
+/* apply the configured scheduling to the calling thread if this sink did
+ * not yet or it changed since. Pool threads move between elements and
+ * instances, so what was applied is kept per thread, @name is only set
+ * the first time this sink sees the thread */
+static void sink_apply_sched (GstAmlHalAsink * sink, const char *name)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint gen = g_atomic_int_get (&priv->sched_gen);
+  SchedApplied *applied = g_private_get (&sched_applied);
+  gboolean first;
+  struct thread_sched ts;
+  int rc;
+
+  if (G_LIKELY (applied && applied->id == priv->sched_id &&
+        applied->gen == gen))
+    return;
+  if (!applied) {
+    applied = g_new0 (SchedApplied, 1);
+    g_private_set (&sched_applied, applied);
+  }
+  first = (applied->id != priv->sched_id);
+
+  SINK_OBJECT_LOCK (sink);
+  ts = priv->sched;
+  SINK_OBJECT_UNLOCK (sink);
+
+  rc = thread_sched_apply (&ts, first ? name : NULL);
+  if (rc)
+    GST_ERROR_OBJECT (sink, "failed to set %s thread policy %s priority %d cpus 0x%" PRIx64 ": %d",
+        name, thread_sched_policy_name (ts.policy), ts.priority, ts.cpu_mask, rc);
+  else
+    GST_WARNING_OBJECT (sink, "set %s thread to policy %s priority %d cpus 0x%" PRIx64 "",
+        name, thread_sched_policy_name (ts.policy), ts.priority, ts.cpu_mask);
+  applied->id = priv->sched_id;
+  applied->gen = gen;
+}
+
 static gpointer xrun_thread(gpointer para)
 {
   GstAmlHalAsink *sink = (GstAmlHalAsink *)para;
@@ -2455,6 +3699,7 @@ static gpointer xrun_thread(gpointer para)
 
   GST_INFO_OBJECT (sink, "enter");
   while (!priv->quit_xrun_thread) {
+    sink_apply_sched (sink, "axrun_render");
     /* cobalt cert requires pause avsync to stop video rendering */
     if (priv->seamless_switch) {
         bool result = false;
@@ -2473,14 +3718,10 @@ static gpointer xrun_thread(gpointer para)
     if (!priv->xrun_paused &&
            g_timer_elapsed(priv->xrun_timer, NULL) > 0.4) {
       if (priv->ms12_enable) {
-        char *status = priv->hw_dev_->get_parameters (priv->hw_dev_,
-            "main_input_underrun");
         int underrun = 0;
 
-        if (status) {
-          sscanf(status,"main_input_underrun=%d", &underrun);
-          free (status);
-        }
+        hal_param_dev_get_int (&priv->hparam, priv->hw_dev_,
+            "main_input_underrun", &underrun);
 
         if (!underrun) {
           usleep(10000);
@@ -2488,10 +3729,11 @@ static gpointer xrun_thread(gpointer para)
         }
         if (priv->received_eos) {
           GST_INFO_OBJECT (sink, "xrun timer reached EOS");
-          GST_OBJECT_LOCK (sink);
+          SINK_OBJECT_LOCK (sink);
           priv->eos = TRUE;
-          GST_OBJECT_UNLOCK (sink);
+          SINK_OBJECT_UNLOCK (sink);
         } else {
+          buf_trace_xrun (priv->trace);
           g_signal_emit (G_OBJECT (sink), g_signals[SIGNAL_XRUN], 0, 0, NULL);
           GST_WARNING_OBJECT (sink, "xrun signaled");
         }
@@ -2504,6 +3746,7 @@ static gpointer xrun_thread(gpointer para)
           g_timer_stop(priv->xrun_timer);
           continue;
         }
+        buf_trace_xrun (priv->trace);
         g_signal_emit (G_OBJECT (sink), g_signals[SIGNAL_XRUN], 0, 0, NULL);
         GST_WARNING_OBJECT (sink, "xrun signaled");
       }
@@ -2549,204 +3792,1314 @@ static void stop_xrun_thread (GstAmlHalAsink * sink)
   }
 }
 
-static GstFlowReturn
-gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
+/* convert raw input to S16LE in one pass, output wraps conv_buf and is
+ * only valid until next call */
+static GstBuffer *
+pcm_convert_to_hal (GstAmlHalAsink * sink, GstBuffer * buf)
 {
-  GstClockTime time, stop;
   GstAmlHalAsinkPrivate *priv = sink->priv;
-  guint64 ctime, cstop;
-  gsize size;
+  GstBuffer *outbuf;
+  GstMapInfo map;
   guint samples;
-  gint bpf, rate;
-  GstFlowReturn ret = GST_FLOW_OK;
-  GstSegment clip_seg;
-  GstMapInfo info;
-  guchar * data;
-
-  if (priv->flushing_) {
-    ret = GST_FLOW_FLUSHING;
-    priv->dropped_frames++;
-    goto done;
+  gsize outsize;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_READ))
+    return NULL;
+
+  samples = map.size / GST_AUDIO_INFO_BPF (&priv->spec.info) *
+      GST_AUDIO_INFO_CHANNELS (&priv->spec.info);
+  outsize = samples * sizeof (int16_t);
+  if (outsize > priv->conv_buf_size) {
+    g_free (priv->conv_buf);
+    priv->conv_buf = g_malloc (outsize);
+    priv->conv_buf_size = outsize;
   }
+  priv->pcm_convert ((int16_t *)priv->conv_buf, map.data, samples);
+  gst_buffer_unmap (buf, &map);
+
+  outbuf = gst_buffer_new_wrapped_full (0,
+      priv->conv_buf, outsize, 0, outsize, NULL, NULL);
+  if (outbuf)
+    gst_buffer_copy_into (outbuf, buf, GST_BUFFER_COPY_METADATA, 0, -1);
+  return outbuf;
+}
 
-  if (G_UNLIKELY (!priv->stream_)) {
-    priv->dropped_frames++;
-    goto lost_resource;
+/* resample S16 input to HAL rate, output wraps rs_buf and is only valid
+ * until next call */
+static GstBuffer *
+pcm_resample_to_hal (GstAmlHalAsink * sink, GstBuffer * buf)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstBuffer *outbuf;
+  GstMapInfo map;
+  gint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
+  guint in_frames, out_frames;
+  gsize outsize;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_READ))
+    return NULL;
+
+  in_frames = map.size / bpf;
+  outsize = pcm_resample_max_out (priv->resampler, in_frames) * bpf;
+  if (outsize > priv->rs_buf_size) {
+    g_free (priv->rs_buf);
+    priv->rs_buf = g_malloc (outsize);
+    priv->rs_buf_size = outsize;
   }
+  out_frames = pcm_resample_process (priv->resampler,
+      (const int16_t *)map.data, in_frames, (int16_t *)priv->rs_buf);
+  gst_buffer_unmap (buf, &map);
+
+  outsize = out_frames * bpf;
+  outbuf = gst_buffer_new_wrapped_full (0,
+      priv->rs_buf, priv->rs_buf_size, 0, outsize, NULL, NULL);
+  if (outbuf)
+    gst_buffer_copy_into (outbuf, buf, GST_BUFFER_COPY_METADATA, 0, -1);
+  return outbuf;
+}
 
-  if (G_UNLIKELY (priv->received_eos)) {
-    priv->dropped_frames++;
-    goto was_eos;
-  }
+/* publish a rate change for the streaming thread, a newer one replaces
+ * any update not yet picked up */
+static void
+tempo_post_update (GstAmlHalAsink * sink, gdouble rate, guint64 segment_start)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct tempo_update *u = g_new (struct tempo_update, 1);
+  gpointer old;
 
-  if (!priv->pri_set) {
-    int rc;
-    struct sched_param schedParam;
+  u->rate = rate;
+  u->segment_start = segment_start;
+  do {
+    old = g_atomic_pointer_get (&priv->tempo_pending);
+  } while (!g_atomic_pointer_compare_and_exchange (&priv->tempo_pending, old, u));
+  g_free (old);
+}
 
-    prctl (PR_SET_NAME, "asink_chain");
-    schedParam.sched_priority= 30;
-    rc = pthread_setschedparam( pthread_self(), SCHED_FIFO, &schedParam );
-    if ( rc )
-      GST_ERROR("failed to set chain thread policy and priority: %d errno %d", rc, errno);
-    else
-      GST_WARNING("set chain thread to policy %s priority %d", "SCHED_FIFO", 50);
-    priv->pri_set = true;
-  }
+/* detach the pending update, caller frees it */
+static struct tempo_update *
+tempo_take_update (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gpointer u;
 
-#ifdef SUPPORT_AD
-  if (priv->is_dual_audio || priv->is_ad_audio) {
-    GstMetaPesHeader* h = GST_META_PES_HEADER_GET (buf);
+  do {
+    u = g_atomic_pointer_get (&priv->tempo_pending);
+  } while (u && !g_atomic_pointer_compare_and_exchange (&priv->tempo_pending, u, NULL));
+  return u;
+}
 
-    GST_LOG("get meta %p", h);
-#ifdef DUMP_TO_FILE
-    if (h) {
-      char *name;
+/* streaming thread only: apply stop request and pending rate change */
+static void
+tempo_sync_state (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct tempo_update *u;
 
-      if (priv->is_dual_audio)
-        name = "/data/apes_m_";
-      else
-        name = "/data/apes_ad_";
-      dump (name, h->header, h->length);
-    }
-#endif
-    if (h) {
-      struct ad_des des;
-      int lret = pes_get_ad_des (h->header, h->length, &des);
-      char setting[50];
-
-      if (!lret && memcmp(&priv->des_ad, &des, sizeof(des))) {
-        snprintf (setting, sizeof(setting),
-            "AD_descriptor=%02x %02x %02x %02x %02x",
-            des.fade, des.g_c, des.g_f, des.g_s, des.pan);
-        priv->hw_dev_->set_parameters (priv->hw_dev_, setting);
-        memcpy(&priv->des_ad, &des, sizeof(des));
-        GST_DEBUG_OBJECT (sink, "m(%d)/ad(%d) gain %d %d %d %d %d",
-            priv->is_dual_audio, priv->is_ad_audio,
-            des.fade, des.pan, des.g_c, des.g_f, des.g_s);
-      } else if (lret) {
-        GST_LOG("can not get ad ret %d", lret);
-      }
-    }
+  if (g_atomic_int_get (&priv->tempo_stop_req)) {
+    g_atomic_int_set (&priv->tempo_stop_req, FALSE);
+    scaletempo_stop (&priv->st);
+    priv->tempo_used = FALSE;
+    return;
   }
-#endif
 
-  bpf = GST_AUDIO_INFO_BPF (&priv->spec.info);
-  rate = GST_AUDIO_INFO_RATE (&priv->spec.info);
+  u = tempo_take_update (sink);
+  if (u) {
+    GstSegment seg;
 
-  size = gst_buffer_get_size (buf);
-  if (G_UNLIKELY (size % bpf) != 0) {
-    priv->dropped_frames++;
-    goto wrong_size;
+    gst_segment_init (&seg, GST_FORMAT_TIME);
+    seg.rate = u->rate;
+    seg.start = u->segment_start;
+    scaletempo_update_segment (&priv->st, &seg);
+    GST_LOG_OBJECT (sink, "tempo rate %f", u->rate);
+    g_free (u);
   }
+}
 
-  if (is_raw_type(priv->spec.type))
-    samples = size / bpf;
-  else
-    samples = priv->sample_per_frame;
-
-  time = GST_BUFFER_TIMESTAMP (buf);
+/* start the fade in asked for by resume or flush, feed_lock held */
+static void
+pcm_fade_take_req (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct pcm_process *pp = &priv->pcm_proc;
+  guint frames = GST_AUDIO_INFO_RATE (&priv->hal_info) * PCM_FADE_MS / 1000;
 
-  if ((!GST_CLOCK_TIME_IS_VALID (time) && !priv->first_pts_set) && priv->direct_mode_) {
-    priv->dropped_frames++;
-    GST_INFO_OBJECT (sink, "discard frame wo/ pts at beginning");
-    goto done;
+  if (priv->pcm_fade_req == PCM_FADE_REQ_RESTART) {
+    pcm_process_set_silent (pp);
+    /* flushed, the held tail is stale */
+    gst_buffer_replace (&priv->fade_hold, NULL);
   }
-  if ((!GST_CLOCK_TIME_IS_VALID (time) ||
-      (priv->last_ts != GST_CLOCK_TIME_NONE && priv->last_ts == time)) &&
-      is_raw_type(priv->spec.type)) {
-    time = priv->first_pts_64;
-    time += gst_util_uint64_scale_int(priv->render_samples, GST_SECOND, rate);
-    GST_BUFFER_TIMESTAMP (buf) = time;
-    GST_LOG_OBJECT (sink, "fake time %" GST_TIME_FORMAT, GST_TIME_ARGS (time));
+  if (priv->pcm_fade_req != PCM_FADE_REQ_NONE)
+    pcm_process_fade (pp, TRUE, frames);
+  priv->pcm_fade_req = PCM_FADE_REQ_NONE;
+}
+
+/* pick up fade requests from pause/resume/flush before PCM is processed.
+ * A tail held back at the end of the pause fade goes in front of @buf.
+ * @fading is set while a pause fade out runs */
+static GstBuffer *
+pcm_fade_gate (GstAmlHalAsink * sink, GstBuffer * buf, gboolean * fading)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct pcm_process *pp = &priv->pcm_proc;
+  guint frames = GST_AUDIO_INFO_RATE (&priv->hal_info) * PCM_FADE_MS / 1000;
+  GstBuffer *hold;
+
+  FEED_LOCK (priv);
+  /* once faded out for pause, hold new data here so it is not
+   * processed into silence before resume */
+  while ((priv->paused_ || priv->pause_fade == PAUSE_FADE_DONE) &&
+      !priv->flushing_) {
+    GST_PAD_STREAM_UNLOCK(GST_BASE_SINK_PAD(sink));
+    FEED_COND_WAIT (priv, &priv->run_ready);
+    GST_PAD_STREAM_LOCK(GST_BASE_SINK_PAD(sink));
   }
 
-  GST_LOG_OBJECT (sink,
-      "time %" GST_TIME_FORMAT ", start %"
-      GST_TIME_FORMAT ", samples %u size %u", GST_TIME_ARGS (time),
-      GST_TIME_ARGS (priv->segment.start), samples, size);
+  pcm_fade_take_req (sink);
+  hold = priv->fade_hold;
+  priv->fade_hold = NULL;
 
-  priv->last_ts = GST_BUFFER_TIMESTAMP (buf);
+  if (priv->pause_fade == PAUSE_FADE_REQUEST) {
+    pcm_process_fade (pp, FALSE, frames);
+    priv->pause_fade = PAUSE_FADE_RUNNING;
+  }
+  *fading = (priv->pause_fade == PAUSE_FADE_RUNNING);
+  FEED_UNLOCK (priv);
 
-  /* let's calc stop based on the number of samples in the buffer instead
-   * of trusting the DURATION */
-  stop = time + gst_util_uint64_scale_int (samples, GST_SECOND, rate);
+  if (hold)
+    buf = gst_buffer_append (hold, buf);
+  return buf;
+}
 
-  clip_seg.format = GST_FORMAT_TIME;
-  clip_seg.start = priv->segment.start;
-  clip_seg.stop = priv->segment.stop;
-  clip_seg.duration = -1;
+/* single in place pass of gain, mute and channel remap over HAL side PCM.
+ * With @fading, frames behind the end of the pause fade are cut off into
+ * fade_hold instead of being processed into silence */
+static GstBuffer *
+pcm_post_process (GstAmlHalAsink * sink, GstBuffer * buf, gboolean fading)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct pcm_process *pp = &priv->pcm_proc;
+  gint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
+  GstMapInfo map;
+
+  pcm_process_set_volume (pp, g_atomic_int_get (&priv->sw_volume));
+  pcm_process_set_mute (pp, g_atomic_int_get (&priv->sw_mute));
+  if (!pcm_process_active (pp))
+    return buf;
+
+  if (fading) {
+    gsize left = (gsize) pcm_process_fade_left (pp) * bpf;
+    gsize size = gst_buffer_get_size (buf);
+
+    if (left && left < size) {
+      GstBuffer *tail;
+
+      /* buf may wrap conv_buf/rs_buf, reused by the next render */
+      tail = gst_buffer_copy_region (buf,
+          GST_BUFFER_COPY_ALL | GST_BUFFER_COPY_DEEP, left, size - left);
+      if (GST_BUFFER_TIMESTAMP_IS_VALID (buf))
+        GST_BUFFER_TIMESTAMP (tail) = GST_BUFFER_TIMESTAMP (buf) +
+            gst_util_uint64_scale_int (left / bpf, GST_SECOND,
+                GST_AUDIO_INFO_RATE (&priv->hal_info));
+      buf = gst_buffer_make_writable (buf);
+      gst_buffer_resize (buf, 0, left);
+      FEED_LOCK (priv);
+      gst_buffer_replace (&priv->fade_hold, NULL);
+      priv->fade_hold = tail;
+      FEED_UNLOCK (priv);
+    }
+  }
 
-  /* samples should be rendered based on their timestamp. All samples
-   * arriving before the segment.start or after segment.stop are to be
-   * thrown away. All samples should also be clipped to the segment
-   * boundaries */
-  if (G_UNLIKELY (!gst_segment_clip (&clip_seg, GST_FORMAT_TIME, time, stop,
-              &ctime, &cstop))) {
-    priv->dropped_frames++;
-    goto out_of_segment;
+  /* converted/resampled buffers are ours and not copied here */
+  buf = gst_buffer_make_writable (buf);
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    gst_buffer_unref (buf);
+    return NULL;
   }
+  pcm_process_run (pp, (int16_t *)map.data, map.size / bpf);
+  gst_buffer_unmap (buf, &map);
+  return buf;
+}
 
-  priv->eos_time = cstop;
+/* write out a tail held back by the pause fade once playing again with no
+ * more data to carry it, e.g. before EOS. feed_lock held */
+static void
+pcm_hold_flush (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstBuffer *buf;
+  GstMapInfo map;
 
-  if (!priv->first_pts_set) {
-    uint32_t pts_32 = gst_util_uint64_scale_int (time, PTS_90K, GST_SECOND);
+  if (priv->paused_ || priv->pause_fade != PAUSE_FADE_NONE ||
+      !priv->fade_hold)
+    return;
 
-    priv->first_pts_set = TRUE;
-    priv->first_pts_64 = time;
-    priv->first_pts = pts_32;
-    GST_INFO_OBJECT(sink, "update first PTS %x", pts_32);
+  pcm_fade_take_req (sink);
+  buf = priv->fade_hold;
+  priv->fade_hold = NULL;
+  if (!buf)
+    return;
+  buf = pcm_post_process (sink, buf, FALSE);
+  if (buf && gst_buffer_map (buf, &map, GST_MAP_READ)) {
+    hal_commit (sink, map.data, map.size, GST_BUFFER_TIMESTAMP (buf));
+    gst_buffer_unmap (buf, &map);
   }
+  if (buf)
+    gst_buffer_unref (buf);
+}
 
-  GST_OBJECT_LOCK (sink);
-  if (priv->tempo_used) {
-    GstBuffer *outbuffer = NULL;
-    gsize insize, outsize;
+/* write out what coalesce_push held back, feed_lock held */
+static void
+coalesce_flush (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
 
-    insize = gst_buffer_get_size (buf);
-    scaletempo_transform_size (&priv->st, insize, &outsize);
-    GST_LOG_OBJECT (sink, "in:%d out:%d", insize, outsize);
+  if (!priv->coal_size)
+    return;
+  hal_commit (sink, priv->coal_buf, priv->coal_size, priv->coal_time);
+  priv->coal_size = 0;
+  priv->coal_time = GST_CLOCK_TIME_NONE;
+}
 
-    outbuffer = gst_buffer_new_allocate (NULL, outsize, NULL);
-    if (!outbuffer) {
-      GST_ERROR_OBJECT (sink, "out buffer fail %d", outsize);
-      ret = GST_FLOW_ERROR;
-      GST_OBJECT_UNLOCK (sink);
-      priv->dropped_frames++;
-      goto done;
+/* flush a held block once it is coalesce_ms old, so a stalled upstream
+ * does not keep it from HAL. Paused data waits for resume or drain */
+static gpointer
+coalesce_thread (gpointer data)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (data);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  sink_apply_sched (sink, "acoal_flush");
+  FEED_LOCK (priv);
+  while (!priv->coal_quit) {
+    gint64 deadline = priv->coal_start +
+        g_atomic_int_get (&priv->coalesce_ms) * G_TIME_SPAN_MILLISECOND;
+
+    if (!priv->coal_size || priv->paused_ || priv->flushing_ ||
+        !priv->stream_) {
+      FEED_COND_WAIT (priv, &priv->coal_cond);
+    } else if (g_get_monotonic_time () < deadline) {
+      FEED_COND_WAIT_UNTIL (priv, &priv->coal_cond, deadline);
+    } else {
+      GST_LOG_OBJECT (sink, "coalesce timeout, %" G_GSIZE_FORMAT " bytes",
+          priv->coal_size);
+      coalesce_flush (sink);
     }
-    gst_buffer_copy_into (outbuffer, buf, GST_BUFFER_COPY_METADATA, 0, -1);
+  }
+  FEED_UNLOCK (priv);
+  return NULL;
+}
 
-    ret = scaletempo_transform (&priv->st, buf, outbuffer);
-    gst_buffer_unref (buf);
-    buf = outbuffer;
+static void
+coalesce_thread_stop (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GThread *thread;
+
+  FEED_LOCK (priv);
+  thread = priv->coal_thread;
+  priv->coal_thread = NULL;
+  priv->coal_quit = TRUE;
+  g_cond_signal (&priv->coal_cond);
+  FEED_UNLOCK (priv);
+  if (thread)
+    g_thread_join (thread);
+}
 
-    if (ret != GST_FLOW_OK) {
-      GST_OBJECT_UNLOCK (sink);
-      GST_LOG_OBJECT (sink, "transform fail");
-      priv->dropped_frames++;
-      goto done;
+/* hold back small contiguous PCM buffers and write them to HAL as one
+ * block of up to coalesce_ms, feed_lock held. Returns FALSE when the caller
+ * has to commit @data itself, anything held back is written out first */
+static gboolean
+coalesce_push (GstAmlHalAsink * sink, guchar * data, gsize size,
+    GstClockTime time, gboolean discont)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint ms = g_atomic_int_get (&priv->coalesce_ms);
+  gint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
+  gint rate = GST_AUDIO_INFO_RATE (&priv->hal_info);
+  gsize target, max;
+
+  /* tempo output is not on the pts axis, fades must reach HAL at once */
+  if (!ms || !bpf || !rate || priv->tempo_used ||
+      priv->pause_fade != PAUSE_FADE_NONE || !GST_CLOCK_TIME_IS_VALID (time)) {
+    coalesce_flush (sink);
+    return FALSE;
+  }
+
+  /* keep a block within one write of hal_commit */
+  target = (gsize) gst_util_uint64_scale_int (rate, ms, 1000) * bpf;
+  max = priv->chunk_size ? priv->chunk_size :
+      (priv->direct_mode_ ? TRANS_DATA_SIZE : MAX_RAW_WRITE_SIZE);
+  if (target > max)
+    target = max - max % bpf;
+
+  if (priv->coal_size) {
+    GstClockTime expect = priv->coal_time + gst_util_uint64_scale_int (
+        priv->coal_size / bpf, GST_SECOND, rate);
+
+    if (discont || ms != priv->coal_ms || time + COALESCE_TOLERANCE < expect ||
+        time > expect + COALESCE_TOLERANCE ||
+        priv->coal_size + size > target) {
+      GST_LOG_OBJECT (sink, "coalesce break at %" GST_TIME_FORMAT
+          " expect %" GST_TIME_FORMAT, GST_TIME_ARGS (time),
+          GST_TIME_ARGS (expect));
+      coalesce_flush (sink);
     }
+  }
+  if (!priv->coal_size && size >= target)
+    return FALSE;
 
-    if (!gst_buffer_get_size(buf)) {
-      /* lenth 0 can not be commited */
-      GST_OBJECT_UNLOCK (sink);
-      GST_LOG_OBJECT (sink, "skip length 0 buff");
-      priv->render_samples += samples;
-      goto done;
+  /* chunk_size may have grown back since the block started */
+  if (priv->coal_buf_size < target) {
+    priv->coal_buf = g_realloc (priv->coal_buf, target);
+    priv->coal_buf_size = target;
+  }
+  if (!priv->coal_size) {
+    priv->coal_time = time;
+    priv->coal_ms = ms;
+    priv->coal_start = g_get_monotonic_time ();
+    if (!priv->coal_thread) {
+      priv->coal_quit = FALSE;
+      priv->coal_thread = g_thread_new ("acoal_flush", coalesce_thread, sink);
     }
-    /* note: do not update time to output buffer
-       time = GST_BUFFER_TIMESTAMP (buf);
-     * it is based on the scaled time axis. When 2x
-     * playback, the time will be 1/2 of real time.
-     */
+    g_cond_signal (&priv->coal_cond);
+  } else {
+    priv->coal_saved++;
   }
-  GST_OBJECT_UNLOCK (sink);
+  memcpy (priv->coal_buf + priv->coal_size, data, size);
+  priv->coal_size += size;
+
+  /* also bound the hold back in wall time, for upstream slower than real
+   * time. A stalled upstream is left to coalesce_thread */
+  if (priv->coal_size + bpf > target ||
+      g_get_monotonic_time () - priv->coal_start >= ms * G_TIME_SPAN_MILLISECOND)
+    coalesce_flush (sink);
+  return TRUE;
+}
+
+/* hold a pcr master start frame, feed_lock held */
+static void
+start_queue_push (GstAmlHalAsink * sink, const guchar * data, gsize size,
+    GstClockTime time, GstClockTime dur)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  /* start_queue_ready lets no more than this pile up */
+  if (priv->start_count >= START_FRAMES_MAX)
+    start_queue_flush (sink);
+  if (priv->start_size + size > priv->start_data_size) {
+    priv->start_data_size = MAX (priv->start_size + size,
+        priv->start_data_size * 2);
+    priv->start_data = g_realloc (priv->start_data, priv->start_data_size);
+  }
+  if (!priv->start_count) {
+    priv->start_time = time;
+    priv->start_since = g_get_monotonic_time ();
+  }
+  memcpy (priv->start_data + priv->start_size, data, size);
+  priv->start_off[priv->start_count] = priv->start_size;
+  priv->start_pts[priv->start_count] = time;
+  priv->start_size += size;
+  priv->start_dur += dur;
+  priv->start_count++;
+  priv->start_off[priv->start_count] = priv->start_size;
+}
+
+/* enough queued and the session can take the first pts, feed_lock held */
+static gboolean
+start_queue_ready (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  /* never hold more than this, whatever avsync does */
+  if (priv->start_count >= START_FRAMES_MAX)
+    return TRUE;
+  if (priv->start_count < priv->start_frames ||
+      priv->start_dur < priv->start_ms * GST_MSECOND)
+    return FALSE;
+  return priv->avsync || !priv->direct_mode_ ||
+      (priv->provided_clock &&
+       gst_aml_clock_get_clock_type (priv->provided_clock) ==
+       GST_AML_CLOCK_TYPE_MEDIASYNC);
+}
+
+/* commit the held start frames, feed_lock held. One hal_commit per
+ * frame as they came, compressed frames each need their own sync header
+ * and pts */
+static void
+start_queue_flush (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  guint i;
+
+  if (!priv->start_count)
+    return;
+  for (i = 0; i < priv->start_count; i++)
+    hal_commit (sink, priv->start_data + priv->start_off[i],
+        priv->start_off[i + 1] - priv->start_off[i], priv->start_pts[i]);
+  /* pts_gap offsets count every E-AC3 byte sent */
+  if (priv->format_ == AUDIO_FORMAT_E_AC3)
+    priv->gap_offset += priv->start_size;
+  priv->start_batch = priv->start_count;
+  priv->start_wait_us = g_get_monotonic_time () - priv->start_since;
+  priv->start_buf_sent = TRUE;
+  GST_INFO_OBJECT (sink, "start commit %u frames %" GST_TIME_FORMAT
+      " after %" G_GINT64_FORMAT " us", priv->start_count,
+      GST_TIME_ARGS (priv->start_dur), priv->start_wait_us);
+  priv->start_size = 0;
+  priv->start_count = 0;
+  priv->start_dur = 0;
+}
+
+/* write out held back data before an event that needs it on HAL */
+static void
+coalesce_drain (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  FEED_LOCK (priv);
+  if (priv->stream_) {
+    start_queue_flush (sink);
+    pcm_hold_flush (sink);
+  }
+  coalesce_flush (sink);
+  FEED_UNLOCK (priv);
+}
+
+#ifdef SUPPORT_AD
+static guint8
+ad_lerp (gint from, gint to, gint w)
+{
+  return from + (to - from) * w / 256;
+}
+
+/* move the HAL descriptor toward des_ad for a buffer spanning
+ * @time..@end, called with FEED_LOCK held right before it is committed */
+static void
+ad_des_step (GstAmlHalAsink * sink, GstClockTime time, GstClockTime end)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct ad_des cur = priv->des_ad;
+
+  if (!priv->ad_pending)
+    return;
+
+  if (priv->ad_sent_valid && GST_CLOCK_TIME_IS_VALID (time) &&
+      GST_CLOCK_TIME_IS_VALID (end)) {
+    const struct ad_des *from = &priv->ad_from;
+    GstClockTime pos;
+
+    /* a flush can move time backward, start over from there */
+    if (!GST_CLOCK_TIME_IS_VALID (priv->ad_ramp_start) ||
+        time < priv->ad_ramp_start)
+      priv->ad_ramp_start = time;
+    pos = end - priv->ad_ramp_start;
+    if (pos < AD_RAMP_TIME) {
+      gint w = gst_util_uint64_scale (pos, 256, AD_RAMP_TIME);
+
+      /* fade 0xff is mute, treating it as the next step below 0xfe is
+       * close enough for a ramp */
+      cur.fade = ad_lerp (from->fade, priv->des_ad.fade, w);
+      /* pan is an angle, take the short way round */
+      cur.pan = from->pan + (gint8) (priv->des_ad.pan - from->pan) * w / 256;
+      cur.g_c = ad_lerp ((gint8) from->g_c, (gint8) priv->des_ad.g_c, w);
+      cur.g_f = ad_lerp ((gint8) from->g_f, (gint8) priv->des_ad.g_f, w);
+      cur.g_s = ad_lerp ((gint8) from->g_s, (gint8) priv->des_ad.g_s, w);
+    }
+  }
+
+  if (!priv->ad_sent_valid || memcmp (&cur, &priv->ad_sent, sizeof (cur))) {
+    /* held back PCM still belongs to the old descriptor */
+    coalesce_flush (sink);
+    hal_param_dev_set (&priv->hparam, priv->hw_dev_, "AD_descriptor",
+        "%02x %02x %02x %02x %02x",
+        cur.fade, cur.g_c, cur.g_f, cur.g_s, cur.pan);
+    priv->ad_sent = cur;
+    priv->ad_sent_valid = TRUE;
+  }
+  if (!memcmp (&cur, &priv->des_ad, sizeof (cur)))
+    priv->ad_pending = FALSE;
+}
+#endif
+
+/* Q14 gains for a mixed input: @main_db on main (mute with @main_mute),
+ * @ad_db on the input, mono input panned to @pan radians clockwise from
+ * front centre across the front pair, others channel by channel */
+static void
+mix_gains (gint * g, gint ad_ch, gint out_ch, gboolean main_mute,
+    gdouble main_db, gdouble pan, gdouble ad_db)
+{
+  gint16 ad = pcm_mix_gain_db (ad_db);
+  gint c;
+
+  g[0] = main_mute ? 0 : pcm_mix_gain_db (main_db);
+  for (c = 0; c < PCM_MIX_MAX_CH; c++)
+    g[1 + c] = 0;
+
+  if (out_ch == 1) {
+    g[1] = ad;
+  } else if (ad_ch == 1) {
+    /* constant power, rear angles fold onto the same left/right spread */
+    gdouble x = (sin (pan) + 1) * G_PI / 4;
+
+    g[1] = ad * cos (x);
+    g[2] = ad * sin (x);
+  } else {
+    for (c = 0; c < ad_ch && c < out_ch && c < PCM_MIX_MAX_CH; c++)
+      g[1 + c] = ad;
+  }
+}
+
+#ifdef SUPPORT_AD
+/* fade is main attenuation in 0.3 dB steps with 0xff for mute, pan is
+ * 360/256 degree steps, the front gain of version 0x32 in 0.5 dB */
+static void
+mix_gains_from_des (gint * g, const struct ad_des *des, gint ad_ch,
+    gint out_ch)
+{
+  mix_gains (g, ad_ch, out_ch, des->fade == 0xff, -0.3 * des->fade,
+      des->pan * 2 * G_PI / 256, des->version == 0x32 ? 0.5 * (gint8) des->g_f : 0);
+}
+#endif
+
+/* pick the gains for a main buffer spanning @rt..@end_rt, mix_lock held.
+ * Returns the main gain the previous period ended at */
+static gint
+mix_update_gains (GstAmlHalAsink * sink, MixInput * in, GstClockTime rt,
+    GstClockTime end_rt, gint ad_ch, gint out_ch)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint from;
+  gint c;
+
+  if (priv->mix_ad_ch != ad_ch || priv->mix_out_ch != out_ch) {
+    /* new layout, start from a centred description without ducking */
+    mix_gains (priv->mix_to, ad_ch, out_ch, FALSE, 0, 0, 0);
+#ifdef SUPPORT_AD
+    if (in->des_cache.has_des)
+      mix_gains_from_des (priv->mix_to, &in->des_cache.des, ad_ch, out_ch);
+#endif
+    memcpy (priv->mix_gain, priv->mix_to, sizeof (priv->mix_gain));
+    priv->mix_ramp_start = GST_CLOCK_TIME_NONE;
+    priv->mix_ad_ch = ad_ch;
+    priv->mix_out_ch = out_ch;
+  }
+  from = priv->mix_gain[0];
+
+#ifdef SUPPORT_AD
+  /* a new descriptor takes effect in the buffer that reaches its time */
+  if (in->des_pending && (!GST_CLOCK_TIME_IS_VALID (in->des_rt) ||
+          in->des_rt < end_rt)) {
+    memcpy (priv->mix_from, priv->mix_gain, sizeof (priv->mix_from));
+    mix_gains_from_des (priv->mix_to, &in->des, ad_ch, out_ch);
+    priv->mix_ramp_start = GST_CLOCK_TIME_IS_VALID (in->des_rt) ?
+        MAX (in->des_rt, rt) : rt;
+    in->des_pending = FALSE;
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (priv->mix_ramp_start)) {
+    GstClockTime pos = end_rt > priv->mix_ramp_start ?
+        end_rt - priv->mix_ramp_start : 0;
+
+    if (pos < AD_RAMP_TIME) {
+      gint w = gst_util_uint64_scale (pos, 256, AD_RAMP_TIME);
+
+      for (c = 0; c <= out_ch; c++)
+        priv->mix_gain[c] = priv->mix_from[c] +
+            (priv->mix_to[c] - priv->mix_from[c]) * w / 256;
+      return from;
+    }
+    priv->mix_ramp_start = GST_CLOCK_TIME_NONE;
+  }
+#endif
+  for (c = 0; c <= out_ch; c++)
+    priv->mix_gain[c] = priv->mix_to[c];
+  return from;
+}
+
+/* whether @in is a sink_%u pad, mix_lock held */
+static gboolean
+mix_input_is_ui (GstAmlHalAsink * sink, MixInput * in)
+{
+  return in && in != sink->priv->ad_in;
+}
+
+/* line the queue of @in up with a main period at @rt, dropping what is
+ * late. Returns frames ready to mix at @offset frames into the period,
+ * mix_lock held */
+static guint
+mix_take (GstAmlHalAsink * sink, MixInput * in, GstClockTime rt,
+    guint frames, gint rate, guint * offset)
+{
+  gint bpf = GST_AUDIO_INFO_BPF (&in->info);
+  guint avail;
+
+  *offset = 0;
+  if (!GST_AUDIO_INFO_IS_VALID (&in->info) ||
+      !GST_CLOCK_TIME_IS_VALID (in->head_rt))
+    return 0;
+  if (GST_AUDIO_INFO_RATE (&in->info) != rate) {
+    if (!in->rate_warned)
+      GST_WARNING_OBJECT (sink, "%s rate %d, output %d, not mixing",
+          GST_PAD_NAME (in->pad), GST_AUDIO_INFO_RATE (&in->info), rate);
+    in->rate_warned = TRUE;
+    return 0;
+  }
+
+  avail = gst_adapter_available (in->adapter) / bpf;
+  if (in->head_rt < rt) {
+    guint drop = MIN (avail, gst_util_uint64_scale_int (rt - in->head_rt,
+            rate, GST_SECOND));
+
+    gst_adapter_flush (in->adapter, drop * bpf);
+    in->head_rt += gst_util_uint64_scale_int (drop, GST_SECOND, rate);
+    avail -= drop;
+  } else {
+    *offset = MIN (frames, gst_util_uint64_scale_int (in->head_rt - rt,
+            rate, GST_SECOND));
+  }
+  return MIN (frames - *offset, avail);
+}
+
+/* grow the mixing buffer, normally sized once when the stream opens */
+static void
+mix_buf_reserve (GstAmlHalAsink * sink, gsize size)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (priv->mix_buf_size >= size)
+    return;
+  g_free (priv->mix_buf);
+  priv->mix_buf = g_malloc (size);
+  priv->mix_buf_size = size;
+}
+
+/* Q14 gains spreading @in onto @ch output channels, mix_lock held */
+static void
+mix_layout_gains (MixInput * in, gint ch)
+{
+  gint g[PCM_MIX_MAX_CH + 1];
+  gint c;
+
+  if (in->gain_out_ch == ch)
+    return;
+  mix_gains (g, GST_AUDIO_INFO_CHANNELS (&in->info), ch, FALSE, 0, 0, 0);
+  for (c = 0; c < ch; c++)
+    in->gain[c] = g[1 + c];
+  in->gain_out_ch = ch;
+}
+
+/* add @n frames from the head of @in to @dst of @ch channels with @gain
+ * per output channel and the pad volume, mix_lock held */
+static void
+mix_add_input (GstAmlHalAsink * sink, MixInput * in, gint16 * dst, gint ch,
+    const gint16 * gain, guint n)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint bpf = GST_AUDIO_INFO_BPF (&in->info);
+  gint16 src_gain;
+  const guint8 *data;
+
+  src_gain = g_atomic_int_get (&in->pad->mute) ? 0 :
+      g_atomic_int_get (&in->pad->volume);
+  mix_buf_reserve (sink, (gsize) n * ch * sizeof (gint16));
+  data = gst_adapter_map (in->adapter, n * bpf);
+  pcm_mix_spread (priv->mix_buf, ch, (const int16_t *) data,
+      GST_AUDIO_INFO_CHANNELS (&in->info), gain, n);
+  gst_adapter_unmap (in->adapter);
+  gst_adapter_flush (in->adapter, n * bpf);
+  in->head_rt += gst_util_uint64_scale_int (n, GST_SECOND,
+      GST_AUDIO_INFO_RATE (&in->info));
+
+  pcm_mix_add (dst, priv->mix_buf, PCM_MIX_UNITY, src_gain, n * ch);
+  priv->mix_frames += n;
+}
+
+/* mix every request pad queue into the main PCM buffer at @time, all in
+ * hal_info layout, so the period still goes to HAL as one commit. Main
+ * drives timing: input that is late is dropped, input that has not
+ * arrived yet is simply not mixed */
+static GstBuffer *
+mix_process (GstAmlHalAsink * sink, GstBuffer * buf, GstClockTime time)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint ch = GST_AUDIO_INFO_CHANNELS (&priv->hal_info);
+  gint rate = GST_AUDIO_INFO_RATE (&priv->hal_info);
+  gint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
+  GstClockTime rt, end_rt;
+  GstMapInfo map;
+  gboolean mapped = FALSE, failed = FALSE;
+  guint frames;
+  GList *l;
+
+  if (priv->format_ != AUDIO_FORMAT_PCM_16_BIT || !bpf || !rate ||
+      ch > PCM_MIX_MAX_CH || !GST_CLOCK_TIME_IS_VALID (time))
+    return buf;
+  rt = gst_segment_to_running_time (&priv->segment, GST_FORMAT_TIME, time);
+  if (!GST_CLOCK_TIME_IS_VALID (rt))
+    return buf;
+  frames = gst_buffer_get_size (buf) / bpf;
+  end_rt = rt + gst_util_uint64_scale_int (frames, GST_SECOND, rate);
+
+  g_mutex_lock (&priv->mix_lock);
+  for (l = priv->mix_inputs; l && !failed; l = l->next) {
+    MixInput *in = l->data;
+    gint in_ch = GST_AUDIO_INFO_CHANNELS (&in->info);
+    gint16 duck_from = PCM_MIX_UNITY;
+    const gint16 *gain = in->gain;
+    gint16 ad_gain[PCM_MIX_MAX_CH];
+    gboolean duck = FALSE;
+    guint offset, n;
+    gint c;
+
+    if (in == priv->ad_in) {
+      if (!GST_AUDIO_INFO_IS_VALID (&in->info) || in_ch > PCM_MIX_MAX_CH)
+        continue;
+      /* the descriptor ramp ducks main over the whole period, whether
+       * the description has samples in it or not */
+      duck_from = mix_update_gains (sink, in, rt, end_rt, in_ch, ch);
+      duck = duck_from != PCM_MIX_UNITY || priv->mix_gain[0] != PCM_MIX_UNITY;
+      for (c = 0; c < ch; c++)
+        ad_gain[c] = priv->mix_gain[1 + c];
+      gain = ad_gain;
+    } else {
+      mix_layout_gains (in, ch);
+    }
+
+    n = mix_take (sink, in, rt, frames, rate, &offset);
+    if (!n && !duck)
+      continue;
+
+    if (!mapped) {
+      buf = gst_buffer_make_writable (buf);
+      if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+        failed = TRUE;
+        break;
+      }
+      mapped = TRUE;
+    }
+    if (duck)
+      pcm_mix_scale ((int16_t *) map.data, ch, frames, duck_from,
+          priv->mix_gain[0]);
+    if (n)
+      mix_add_input (sink, in, (gint16 *) map.data + offset * ch, ch, gain, n);
+  }
+  /* room for the input pads again */
+  g_cond_broadcast (&priv->mix_cond);
+  g_mutex_unlock (&priv->mix_lock);
+
+  if (mapped)
+    gst_buffer_unmap (buf, &map);
+  if (failed) {
+    gst_buffer_unref (buf);
+    return NULL;
+  }
+  return buf;
+}
+
+/* running time of the element clock while the element plays, NONE
+ * otherwise, and the HAL device. Object lock, so mix_lock not held */
+static GstClockTime
+mix_ui_clock (GstAmlHalAsink * sink, audio_hw_device_t ** dev)
+{
+  GstClock *clock = NULL;
+  GstClockTime base = 0, now;
+
+  SINK_OBJECT_LOCK (sink);
+  if (GST_STATE (sink) == GST_STATE_PLAYING &&
+      (clock = GST_ELEMENT_CLOCK (sink))) {
+    gst_object_ref (clock);
+    base = GST_ELEMENT_CAST (sink)->base_time;
+  }
+  *dev = sink->priv->hw_dev_;
+  SINK_OBJECT_UNLOCK (sink);
+  if (!clock)
+    return GST_CLOCK_TIME_NONE;
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+  return now > base ? now - base : 0;
+}
+
+/* rate of the first sink_%u with something queued, 0 for none,
+ * mix_lock held */
+static gint
+mix_ui_rate (GstAmlHalAsink * sink)
+{
+  GList *l;
+
+  for (l = sink->priv->mix_inputs; l; l = l->next) {
+    MixInput *in = l->data;
+
+    if (mix_input_is_ui (sink, in) && !in->flushing &&
+        GST_AUDIO_INFO_IS_VALID (&in->info) &&
+        GST_AUDIO_INFO_CHANNELS (&in->info) <= PCM_MIX_MAX_CH &&
+        gst_adapter_available (in->adapter))
+      return GST_AUDIO_INFO_RATE (&in->info);
+  }
+  return 0;
+}
+
+/* plain stereo PCM on the port main goes to, mixed by HAL like system
+ * sound */
+static struct audio_stream_out *
+mix_ui_open (GstAmlHalAsink * sink, audio_hw_device_t * dev, gint rate)
+{
+  struct audio_stream_out *out = NULL;
+  struct audio_config config;
+  audio_output_flags_t flag;
+  audio_devices_t device;
+  gboolean routed;
+
+  SINK_OBJECT_LOCK (sink);
+  routed = hal_stream_route (sink, &flag, &device);
+  SINK_OBJECT_UNLOCK (sink);
+  if (!routed)
+    return NULL;
+
+  memset (&config, 0, sizeof (config));
+  config.sample_rate = rate;
+  config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+  config.format = AUDIO_FORMAT_PCM_16_BIT;
+  if (dev->open_output_stream (dev, 0, device, AUDIO_OUTPUT_FLAG_PRIMARY,
+          &config, &out, NULL) || !out) {
+    GST_WARNING_OBJECT (sink, "can not open pad stream at %d", rate);
+    return NULL;
+  }
+  hal_caps_stream_opened ();
+  GST_INFO_OBJECT (sink, "request pads on their own stream at %d", rate);
+  return out;
+}
+
+static void
+mix_ui_close (GstAmlHalAsink * sink, audio_hw_device_t * dev,
+    struct audio_stream_out *out)
+{
+  dev->close_output_stream (dev, out);
+  hal_caps_stream_closed ();
+  GST_INFO_OBJECT (sink, "request pads back on main");
+}
+
+/* sink_%u input main render does not drain: main absent, at EOS,
+ * compressed or not playing PCM yet. While the element plays, one
+ * MIX_UI_PERIOD_MS period after the other is mixed at the running time
+ * of the element clock and written to a stream of its own, silence
+ * when nothing is queued. The stream is closed once main plays PCM,
+ * which carries the pads in its own commits again, or after
+ * MIX_UI_IDLE_MS of silence */
+/* sink_%u input waiting to be heard, mix_lock held */
+static gboolean
+mix_ui_pending (GstAmlHalAsink * sink)
+{
+  GList *l;
+
+  for (l = sink->priv->mix_inputs; l; l = l->next) {
+    MixInput *in = l->data;
+
+    if (mix_input_is_ui (sink, in) && !in->flushing &&
+        gst_adapter_available (in->adapter))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static gpointer
+mix_ui_thread (gpointer data)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (data);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct audio_stream_out *out = NULL;
+  audio_hw_device_t *dev = NULL, *out_dev = NULL;
+  GstClockTime rt = GST_CLOCK_TIME_NONE, last = GST_CLOCK_TIME_NONE;
+  gint16 *pcm = NULL;
+  gint64 next = 0, heard = 0;
+  guint frames = 0;
+  gint rate = 0;
+
+  sink_apply_sched (sink, "amix_ui");
+  g_mutex_lock (&priv->mix_lock);
+  while (!priv->mix_ui_quit) {
+    GstClockTime now = GST_CLOCK_TIME_NONE;
+    gboolean drain = priv->mix_main != MIX_MAIN_PLAYING;
+    gboolean mixed = FALSE;
+    GList *l;
+
+    if (drain) {
+      g_mutex_unlock (&priv->mix_lock);
+      now = mix_ui_clock (sink, &dev);
+      g_mutex_lock (&priv->mix_lock);
+    }
+    /* the stream opens for input only, silence alone keeps it open */
+    if (!out && GST_CLOCK_TIME_IS_VALID (now) && dev)
+      rate = mix_ui_pending (sink) ? mix_ui_rate (sink) : 0;
+    if (priv->mix_ui_quit || priv->mix_main == MIX_MAIN_PLAYING ||
+        !GST_CLOCK_TIME_IS_VALID (now) || (!out && (!dev || !rate))) {
+      priv->mix_ui_active = FALSE;
+      if (out) {
+        g_mutex_unlock (&priv->mix_lock);
+        mix_ui_close (sink, out_dev, out);
+        g_mutex_lock (&priv->mix_lock);
+        out = NULL;
+      }
+      /* chain, mix_main_sync and state changes wake this up */
+      if (!priv->mix_ui_quit)
+        g_cond_wait_until (&priv->mix_cond, &priv->mix_lock,
+            g_get_monotonic_time () +
+            MIX_UI_PERIOD_MS * G_TIME_SPAN_MILLISECOND);
+      continue;
+    }
+
+    if (!out) {
+      g_mutex_unlock (&priv->mix_lock);
+      out = mix_ui_open (sink, dev, rate);
+      g_mutex_lock (&priv->mix_lock);
+      if (!out) {
+        g_cond_wait_until (&priv->mix_cond, &priv->mix_lock,
+            g_get_monotonic_time () + MIX_UI_IDLE_MS * G_TIME_SPAN_MILLISECOND);
+        continue;
+      }
+      out_dev = dev;
+      frames = rate * MIX_UI_PERIOD_MS / 1000;
+      pcm = g_realloc (pcm, frames * 2 * sizeof (gint16));
+      rt = GST_CLOCK_TIME_NONE;
+      heard = g_get_monotonic_time ();
+    }
+    priv->mix_ui_active = TRUE;
+
+    /* periods follow each other, the clock only sets them back in line
+     * when it moves and is off by more than the gap tolerance */
+    if (!GST_CLOCK_TIME_IS_VALID (rt) || (now != last &&
+            (now > rt + MIX_GAP_TOLERANCE || rt > now + MIX_GAP_TOLERANCE))) {
+      rt = now;
+      next = g_get_monotonic_time ();
+    }
+    last = now;
+
+    memset (pcm, 0, frames * 2 * sizeof (gint16));
+    for (l = priv->mix_inputs; l; l = l->next) {
+      MixInput *in = l->data;
+      guint offset, n;
+
+      if (!mix_input_is_ui (sink, in) || in->flushing ||
+          GST_AUDIO_INFO_CHANNELS (&in->info) > PCM_MIX_MAX_CH)
+        continue;
+      n = mix_take (sink, in, rt, frames, rate, &offset);
+      if (!n)
+        continue;
+      mix_layout_gains (in, 2);
+      mix_add_input (sink, in, pcm + offset * 2, 2, in->gain, n);
+      mixed = TRUE;
+    }
+    /* room for the input pads again */
+    g_cond_broadcast (&priv->mix_cond);
+    g_mutex_unlock (&priv->mix_lock);
+
+    out->write (out, pcm, frames * 2 * sizeof (gint16));
+
+    g_mutex_lock (&priv->mix_lock);
+    rt += gst_util_uint64_scale_int (frames, GST_SECOND, rate);
+    next += MIX_UI_PERIOD_MS * G_TIME_SPAN_MILLISECOND;
+    if (mixed)
+      heard = g_get_monotonic_time ();
+    else if (g_get_monotonic_time () - heard >=
+        MIX_UI_IDLE_MS * G_TIME_SPAN_MILLISECOND) {
+      priv->mix_ui_active = FALSE;
+      g_mutex_unlock (&priv->mix_lock);
+      mix_ui_close (sink, out_dev, out);
+      g_mutex_lock (&priv->mix_lock);
+      out = NULL;
+      continue;
+    }
+    /* input arriving wakes this early, the period waits for its time */
+    while (!priv->mix_ui_quit && g_get_monotonic_time () < next)
+      g_cond_wait_until (&priv->mix_cond, &priv->mix_lock, next);
+  }
+  priv->mix_ui_active = FALSE;
+  g_mutex_unlock (&priv->mix_lock);
+
+  if (out)
+    mix_ui_close (sink, out_dev, out);
+  g_free (pcm);
+  return NULL;
+}
+
+/* started by the first sink_%u buffer, mix_lock held */
+static void
+mix_ui_thread_start (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (priv->mix_ui_thread)
+    return;
+  priv->mix_ui_quit = FALSE;
+  priv->mix_ui_thread = g_thread_new ("amix_ui", mix_ui_thread, sink);
+}
+
+static void
+mix_ui_thread_stop (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GThread *thread;
+
+  g_mutex_lock (&priv->mix_lock);
+  thread = priv->mix_ui_thread;
+  priv->mix_ui_thread = NULL;
+  priv->mix_ui_quit = TRUE;
+  g_cond_broadcast (&priv->mix_cond);
+  g_mutex_unlock (&priv->mix_lock);
+  if (thread)
+    g_thread_join (thread);
+}
+
+static GstFlowReturn
+gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
+{
+  GstClockTime time, stop;
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  guint64 ctime, cstop;
+  gsize size;
+  guint samples;
+  gint bpf, rate;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstSegment clip_seg;
+  GstMapInfo info;
+  guchar * data;
+  gboolean discont = GST_BUFFER_IS_DISCONT (buf);
+
+  startup_mark (sink, STARTUP_FIRST_BUFFER);
+  startup_post (sink);
+
+  if (priv->flushing_) {
+    ret = GST_FLOW_FLUSHING;
+    priv->dropped_frames++;
+    goto done;
+  }
+
+  if (G_UNLIKELY (!priv->stream_)) {
+    priv->dropped_frames++;
+    goto lost_resource;
+  }
+
+  if (G_UNLIKELY (priv->received_eos)) {
+    priv->dropped_frames++;
+    goto was_eos;
+  }
+
+  sink_apply_sched (sink, "asink_chain");
+
+#ifdef SUPPORT_AD
+  if (priv->is_dual_audio || priv->is_ad_audio) {
+    GstMetaPesHeader* h = GST_META_PES_HEADER_GET (buf);
+
+    GST_LOG("get meta %p", h);
+#ifdef DUMP_TO_FILE
+    if (h) {
+      char *name;
+
+      if (priv->is_dual_audio)
+        name = "/data/apes_m_";
+      else
+        name = "/data/apes_ad_";
+      dump (sink, name, h->header, h->length);
+    }
+#endif
+    if (h) {
+      struct ad_des des;
+      int lret = pes_ad_des_update (&priv->ad_cache, h->header, h->length, &des);
+
+      /* applied from render once this buffer is committed */
+      if (lret > 0) {
+        memcpy(&priv->des_ad, &des, sizeof(des));
+        priv->ad_from = priv->ad_sent;
+        priv->ad_ramp_start = GST_CLOCK_TIME_NONE;
+        priv->ad_pending = TRUE;
+        GST_DEBUG_OBJECT (sink, "m(%d)/ad(%d) gain %d %d %d %d %d",
+            priv->is_dual_audio, priv->is_ad_audio,
+            des.fade, des.pan, des.g_c, des.g_f, des.g_s);
+      } else if (lret < 0) {
+        GST_LOG("can not get ad ret %d", lret);
+      }
+    }
+  }
+#endif
+
+  bpf = GST_AUDIO_INFO_BPF (&priv->spec.info);
+  rate = GST_AUDIO_INFO_RATE (&priv->spec.info);
+
+  size = gst_buffer_get_size (buf);
+  if (G_UNLIKELY (size % bpf) != 0) {
+    priv->dropped_frames++;
+    goto wrong_size;
+  }
+
+  if (is_raw_type(priv->spec.type))
+    samples = size / bpf;
+  else
+    samples = priv->sample_per_frame;
+
+  time = GST_BUFFER_TIMESTAMP (buf);
+
+  if ((!GST_CLOCK_TIME_IS_VALID (time) && !priv->first_pts_set) && priv->direct_mode_) {
+    priv->dropped_frames++;
+    GST_INFO_OBJECT (sink, "discard frame wo/ pts at beginning");
+    goto done;
+  }
+  if ((!GST_CLOCK_TIME_IS_VALID (time) ||
+      (priv->last_ts != GST_CLOCK_TIME_NONE && priv->last_ts == time)) &&
+      is_raw_type(priv->spec.type)) {
+    time = priv->first_pts_64;
+    time += gst_util_uint64_scale_int(priv->render_samples, GST_SECOND, rate);
+    GST_BUFFER_TIMESTAMP (buf) = time;
+    GST_LOG_OBJECT (sink, "fake time %" GST_TIME_FORMAT, GST_TIME_ARGS (time));
+  }
+
+  GST_LOG_OBJECT (sink,
+      "time %" GST_TIME_FORMAT ", start %"
+      GST_TIME_FORMAT ", samples %u size %u", GST_TIME_ARGS (time),
+      GST_TIME_ARGS (priv->segment.start), samples, size);
+
+  priv->last_ts = GST_BUFFER_TIMESTAMP (buf);
+
+  /* let's calc stop based on the number of samples in the buffer instead
+   * of trusting the DURATION */
+  stop = time + gst_util_uint64_scale_int (samples, GST_SECOND, rate);
+
+  clip_seg.format = GST_FORMAT_TIME;
+  clip_seg.start = priv->segment.start;
+  clip_seg.stop = priv->segment.stop;
+  clip_seg.duration = -1;
+
+  /* samples should be rendered based on their timestamp. All samples
+   * arriving before the segment.start or after segment.stop are to be
+   * thrown away. All samples should also be clipped to the segment
+   * boundaries */
+  if (G_UNLIKELY (!gst_segment_clip (&clip_seg, GST_FORMAT_TIME, time, stop,
+              &ctime, &cstop))) {
+    priv->dropped_frames++;
+    goto out_of_segment;
+  }
+
+  priv->eos_time = cstop;
+
+  if (!priv->first_pts_set) {
+    uint32_t pts_32 = gst_util_uint64_scale_int (time, PTS_90K, GST_SECOND);
+
+    priv->first_pts_set = TRUE;
+    priv->first_pts_64 = time;
+    priv->first_pts = pts_32;
+    GST_INFO_OBJECT(sink, "update first PTS %x", pts_32);
+  }
+
+  if (priv->pcm_convert) {
+    GstBuffer *outbuffer = pcm_convert_to_hal (sink, buf);
+
+    if (!outbuffer) {
+      GST_ERROR_OBJECT (sink, "pcm convert fail");
+      ret = GST_FLOW_ERROR;
+      priv->dropped_frames++;
+      goto done;
+    }
+    gst_buffer_unref (buf);
+    buf = outbuffer;
+  }
+
+  if (priv->resampler) {
+    GstBuffer *outbuffer = pcm_resample_to_hal (sink, buf);
+
+    if (!outbuffer) {
+      GST_ERROR_OBJECT (sink, "resample fail");
+      ret = GST_FLOW_ERROR;
+      priv->dropped_frames++;
+      goto done;
+    }
+    gst_buffer_unref (buf);
+    buf = outbuffer;
+
+    if (!gst_buffer_get_size(buf)) {
+      /* all input kept in filter history */
+      priv->render_samples += samples;
+      goto done;
+    }
+  }
+
+  if (priv->mix_inputs) {
+    buf = mix_process (sink, buf, time);
+    if (!buf) {
+      GST_ERROR_OBJECT (sink, "mix fail");
+      ret = GST_FLOW_ERROR;
+      priv->dropped_frames++;
+      goto done;
+    }
+  }
+
+  if (priv->tempo_used)
+    tempo_sync_state (sink);
+
+  if (priv->tempo_used) {
+    GstBuffer *outbuffer = NULL;
+    gsize insize, outsize;
+
+    insize = gst_buffer_get_size (buf);
+    scaletempo_transform_size (&priv->st, insize, &outsize);
+    GST_LOG_OBJECT (sink, "in:%d out:%d", insize, outsize);
+
+    outbuffer = gst_buffer_new_allocate (NULL, outsize, NULL);
+    if (!outbuffer) {
+      GST_ERROR_OBJECT (sink, "out buffer fail %d", outsize);
+      ret = GST_FLOW_ERROR;
+      priv->dropped_frames++;
+      goto done;
+    }
+    gst_buffer_copy_into (outbuffer, buf, GST_BUFFER_COPY_METADATA, 0, -1);
+
+    ret = scaletempo_transform (&priv->st, buf, outbuffer);
+    gst_buffer_unref (buf);
+    buf = outbuffer;
+
+    if (ret != GST_FLOW_OK) {
+      GST_LOG_OBJECT (sink, "transform fail");
+      priv->dropped_frames++;
+      goto done;
+    }
+
+    if (!gst_buffer_get_size(buf)) {
+      /* lenth 0 can not be commited */
+      GST_LOG_OBJECT (sink, "skip length 0 buff");
+      priv->render_samples += samples;
+      goto done;
+    }
+    /* note: do not update time to output buffer
+       time = GST_BUFFER_TIMESTAMP (buf);
+     * it is based on the scaled time axis. When 2x
+     * playback, the time will be 1/2 of real time.
+     */
+  }
+
+  if (priv->pcm_proc_used) {
+    gboolean fading;
+
+    buf = pcm_fade_gate (sink, buf, &fading);
+    buf = pcm_post_process (sink, buf, fading);
+    if (!buf) {
+      GST_ERROR_OBJECT (sink, "pcm process fail");
+      ret = GST_FLOW_ERROR;
+      priv->dropped_frames++;
+      goto done;
+    }
+  }
+
   //for those no bit stream parsed format EAC3 DTS render samples as buffers
   // otherwise position always return the start position.
   if (samples == 0)
     samples = 1;
 
-  gst_buffer_map (buf, &info, GST_MAP_READ);
+  /* gap ramps write into the samples */
+  if (priv->format_ == AUDIO_FORMAT_PCM_16_BIT &&
+      (priv->gap_state == GAP_RAMP_UP ||
+       (priv->gap_state == GAP_IDLE && priv->gap_start_pts != -1))) {
+    buf = gst_buffer_make_writable (buf);
+    gst_buffer_map (buf, &info, GST_MAP_READWRITE);
+  } else {
+    gst_buffer_map (buf, &info, GST_MAP_READ);
+  }
   data = info.data;
   size = info.size;
   time = GST_BUFFER_TIMESTAMP (buf);
@@ -2812,12 +5165,12 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
      }
   }
 
-  g_mutex_lock(&priv->feed_lock);
+  FEED_LOCK (priv);
   /* blocked on paused */
   while (priv->paused_ && !priv->flushing_)
   {
       GST_PAD_STREAM_UNLOCK(GST_BASE_SINK_PAD(sink));
-      g_cond_wait (&priv->run_ready, &priv->feed_lock);
+      FEED_COND_WAIT (priv, &priv->run_ready);
       GST_PAD_STREAM_LOCK(GST_BASE_SINK_PAD(sink));
   }
 
@@ -2832,7 +5185,7 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
   if (priv->flushing_) {
     GST_DEBUG_OBJECT (sink, "interrupted by stop");
     gst_buffer_unmap (buf, &info);
-    g_mutex_unlock(&priv->feed_lock);
+    FEED_UNLOCK (priv);
     ret = GST_FLOW_FLUSHING;
     priv->dropped_frames++;
     goto done;
@@ -2843,27 +5196,38 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
     priv->need_update_rate = FALSE;
   }
 
-  if (priv->sync_mode == AV_SYNC_MODE_PCR_MASTER) {
-      /* ms12 2.4 needs 2 frames to decode immediately */
-      if(!priv->start_buf_sent && !priv->start_buf) {
-        priv->start_buf = gst_buffer_ref (buf);
-        GST_DEBUG_OBJECT (sink, "cache start buf %llu", time);
-        goto commit_done;
-      } else if (!priv->start_buf_sent) {
-        GstMapInfo info2;
-
-        gst_buffer_map (priv->start_buf, &info2, GST_MAP_READ);
-        hal_commit (sink, info2.data, info2.size,
-                GST_BUFFER_TIMESTAMP(priv->start_buf));
-        gst_buffer_unmap (priv->start_buf, &info2);
-        gst_buffer_unref (priv->start_buf);
-        priv->start_buf = NULL;
-        priv->start_buf_sent = TRUE;
-        priv->rendered_frames++;
-        GST_DEBUG_OBJECT (sink, "sent cache start buf");
-      }
+  if (priv->sync_mode == AV_SYNC_MODE_PCR_MASTER && !priv->start_buf_sent) {
+    /* copied, converted data lives in conv_buf/rs_buf reused next time */
+    start_queue_push (sink, data, size, time,
+        gst_util_uint64_scale_int (samples, GST_SECOND, rate));
+    if (!start_queue_ready (sink)) {
+      GST_DEBUG_OBJECT (sink, "hold start frame %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (time));
+      /* a TrueHD package is in start_data now */
+      priv->commit_count = 0;
+      priv->commit_size = 0;
+      goto commit_done;
+    }
+    /* this buffer goes out with the batch */
+    priv->rendered_frames += priv->start_count - 1;
+#ifdef SUPPORT_AD
+    if (priv->ad_pending)
+      ad_des_step (sink, priv->start_time,
+          GST_CLOCK_TIME_IS_VALID (time) && rate ?
+          time + gst_util_uint64_scale_int (samples, GST_SECOND, rate) :
+          GST_CLOCK_TIME_NONE);
+#endif
+    start_queue_flush (sink);
+    goto committed;
   }
 
+#ifdef SUPPORT_AD
+  if (priv->ad_pending)
+    ad_des_step (sink, time, GST_CLOCK_TIME_IS_VALID (time) && rate ?
+        time + gst_util_uint64_scale_int (samples, GST_SECOND, rate) :
+        GST_CLOCK_TIME_NONE);
+#endif
+
   if (priv->format_ == AUDIO_FORMAT_PCM_16_BIT) {
       if ((priv->gap_state == GAP_IDLE) &&
           (priv->gap_start_pts != -1) &&
@@ -2871,50 +5235,42 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
         // PCM volume ramping down
         GST_DEBUG_OBJECT(sink, "PCM volume ramping down %" PRId64 "ms @%" PRId64 " size %d",
           priv->gap_start_pts, time, size);
-        vol_ramp(data, size, (priv->channel_mask_ == AUDIO_CHANNEL_OUT_5POINT1) ? 6 : 2, RAMP_DOWN);
+        coalesce_flush (sink);
+        vol_ramp(sink, data, size, RAMP_DOWN);
         hal_commit (sink, data, size, time);
 
         // insert silence
         if (priv->gap_duration > 0) {
+          gint hal_rate = GST_AUDIO_INFO_RATE (&priv->hal_info);
+          guint64 frames, filled;
+
           GST_DEBUG_OBJECT(sink, "PCM insert silence %d ms", priv->gap_duration);
-          int32_t filled_ms = 0;
-          int32_t bytes_per_ms = 48 * 2 * ((priv->channel_mask_ == AUDIO_CHANNEL_OUT_5POINT1) ? 6 : 2);
-          uint8_t *silence = (uint8_t *)g_malloc(16 * bytes_per_ms);
-          if (silence) {
-            memset(silence, 0, 16 * bytes_per_ms);
-            time += (int64_t)size * GST_MSECOND / bytes_per_ms;
-            while ((filled_ms < priv->gap_duration) &&
-              (!priv->flushing_)) {
-              int insert_ms = priv->gap_duration - filled_ms;
-              if (insert_ms > 16) insert_ms = 16;
-              GST_DEBUG_OBJECT(sink, "PCM silence @%" PRId64, time + filled_ms * GST_MSECOND);
-              hal_commit (sink, silence, insert_ms * bytes_per_ms, time + filled_ms * GST_MSECOND);
-              filled_ms += insert_ms;
-              priv->render_samples += filled_ms * 48;
-            }
-            g_free(silence);
-          }
+          frames = gst_util_uint64_scale_int (priv->gap_duration, hal_rate, 1000);
+          time += gst_util_uint64_scale_int (size / GST_AUDIO_INFO_BPF (&priv->hal_info),
+              GST_SECOND, hal_rate);
+          filled = hal_commit_silence (sink, frames, time);
+          /* render_samples counts input rate frames */
+          priv->render_samples += gst_util_uint64_scale_int (filled,
+              GST_AUDIO_INFO_RATE (&priv->spec.info), hal_rate);
           priv->gap_duration = 0;
         }
         priv->gap_start_pts = -1;
         priv->gap_state = GAP_MUTING_1;
       } else if (priv->gap_state == GAP_MUTING_1) {
         GST_DEBUG_OBJECT(sink, "Muting 1 @%" PRId64 " size %d", time, size);
-        memset(data, 0, size);
-        hal_commit (sink, data, size, time);
+        hal_commit_silence (sink, size / GST_AUDIO_INFO_BPF (&priv->hal_info), time);
         priv->gap_state = GAP_MUTING_2;
       } else if (priv->gap_state == GAP_MUTING_2) {
         GST_DEBUG_OBJECT(sink, "Muting 2 @%" PRId64 " size %d", time, size);
-        memset(data, 0, size);
-        hal_commit (sink, data, size, time);
+        hal_commit_silence (sink, size / GST_AUDIO_INFO_BPF (&priv->hal_info), time);
         priv->gap_state = GAP_RAMP_UP;
       } else if (priv->gap_state == GAP_RAMP_UP) {
         // PCM volume ramping up
         GST_DEBUG_OBJECT(sink, "PCM volume ramping up @%" PRId64 " size %d", time, size);
-        vol_ramp(data, size, (priv->channel_mask_ == AUDIO_CHANNEL_OUT_5POINT1) ? 6 : 2, RAMP_UP);
+        vol_ramp(sink, data, size, RAMP_UP);
         hal_commit (sink, data, size, time);
         priv->gap_state = GAP_IDLE;
-      } else {
+      } else if (!coalesce_push (sink, data, size, time, discont)) {
         hal_commit (sink, data, size, time);
       }
   } else if (priv->format_ == AUDIO_FORMAT_E_AC3) {
@@ -2923,7 +5279,7 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
         char cmd[32] = {0};
         snprintf(cmd, sizeof(cmd), "pts_gap=%llu,%d",
           (unsigned long long)priv->gap_offset, priv->gap_duration);
-        priv->hw_dev_->set_parameters(priv->hw_dev_, cmd);
+        hal_param_dev_cmd (&priv->hparam, priv->hw_dev_, cmd);
         GST_DEBUG_OBJECT(sink, "E-AC3 %s", cmd);
         priv->gap_start_pts = -1;
         priv->gap_duration = 0;
@@ -2933,6 +5289,14 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
   } else {
     hal_commit (sink, data, size, time);
   }
+
+committed:
+  if (priv->pause_fade == PAUSE_FADE_RUNNING &&
+      priv->pcm_proc.fade == PCM_FADE_SILENT) {
+    priv->pause_fade = PAUSE_FADE_DONE;
+    priv->fade_done_time = g_get_monotonic_time ();
+    g_cond_signal (&priv->fade_cond);
+  }
   priv->rendered_frames++;
   if (priv->commit_size > MAX_COMMIT_BYTES)
   {
@@ -2944,18 +5308,18 @@ gst_aml_hal_asink_render (GstAmlHalAsink * sink, GstBuffer * buf)
   priv->commit_time = GST_CLOCK_TIME_NONE;
 
 commit_done:
-  g_mutex_unlock(&priv->feed_lock);
+  FEED_UNLOCK (priv);
   gst_buffer_unmap (buf, &info);
 
-  GST_OBJECT_LOCK (sink);
+  SINK_OBJECT_LOCK (sink);
   if (priv->sync_mode == AV_SYNC_MODE_AMASTER &&
         priv->stream_ && !priv->xrun_thread &&
         start_xrun_thread (sink)) {
     ret = GST_FLOW_ERROR;
-    GST_OBJECT_UNLOCK (sink);
+    SINK_OBJECT_UNLOCK (sink);
     goto done;
   }
-  GST_OBJECT_UNLOCK (sink);
+  SINK_OBJECT_UNLOCK (sink);
 
   ret = GST_FLOW_OK;
 done:
@@ -2993,7 +5357,7 @@ wrong_size:
     gst_buffer_map (buf, &info, GST_MAP_READ);
     data = info.data;
     size = info.size;
-    dump ("/tmp/asink_input_", data, size);
+    dump (sink, "/tmp/asink_input_", data, size);
     gst_buffer_unmap (buf, &info);
 #endif
     ret = GST_FLOW_ERROR;
@@ -3019,21 +5383,487 @@ aml_hal_clip_buf_by_meta (GstAmlHalAsink *sink, GstBuffer *buf)
         return;
     }
 
-    if (!is_raw_type(spec->type))
-    {
-        //not raw type, just transfer the cmeta info to audio hal side.
-        priv->clip_front = cmeta->start;
-        priv->clip_back  = cmeta->end;
-    }
+    if (!is_raw_type(spec->type))
+    {
+        //not raw type, just transfer the cmeta info to audio hal side.
+        priv->clip_front = cmeta->start;
+        priv->clip_back  = cmeta->end;
+    }
+    return;
+}
+
+static GstFlowReturn
+gst_aml_hal_asink_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (parent);
+  /* before clipping, replay feeds it through the same path */
+  buf_trace_buffer (sink->priv->trace, buf);
+  aml_hal_clip_buf_by_meta(sink, buf);
+  return gst_aml_hal_asink_render (sink, buf);
+}
+
+/* mix_lock held */
+static MixInput *
+mix_find_input (GstAmlHalAsink * sink, GstPad * pad)
+{
+  GList *l;
+
+  for (l = sink->priv->mix_inputs; l; l = l->next) {
+    MixInput *in = l->data;
+
+    if ((GstPad *) in->pad == pad)
+      return in;
+  }
+  return NULL;
+}
+
+/* main stream state the request pads go by, call after the stream, its
+ * format, paused_ or received_eos changed */
+static void
+mix_main_sync (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint ch = GST_AUDIO_INFO_CHANNELS (&priv->hal_info);
+  gint rate = GST_AUDIO_INFO_RATE (&priv->hal_info);
+  MixMain state;
+
+  if (!priv->stream_)
+    state = MIX_MAIN_NONE;
+  else if (priv->format_ != AUDIO_FORMAT_PCM_16_BIT || !rate ||
+      ch > PCM_MIX_MAX_CH)
+    state = MIX_MAIN_UNMIXABLE;
+  else if (priv->received_eos)
+    state = MIX_MAIN_EOS;
+  else if (priv->paused_)
+    state = MIX_MAIN_PAUSED;
+  else
+    state = MIX_MAIN_PLAYING;
+  /* sink_%u go to mix_ui_thread then, at any rate */
+  if (state != MIX_MAIN_PAUSED && state != MIX_MAIN_PLAYING)
+    rate = 0;
+
+  g_mutex_lock (&priv->mix_lock);
+  if (priv->mix_main != state || priv->mix_main_rate != rate)
+    GST_DEBUG_OBJECT (sink, "mix main %d rate %d", state, rate);
+  priv->mix_main = state;
+  priv->mix_main_rate = rate;
+  /* waiting pads have to look again */
+  g_cond_broadcast (&priv->mix_cond);
+  g_mutex_unlock (&priv->mix_lock);
+}
+
+/* whether main can take @info at all, mix_lock held */
+static gboolean
+mix_info_ok (GstAmlHalAsink * sink, const GstAudioInfo * info)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (GST_AUDIO_INFO_CHANNELS (info) > PCM_MIX_MAX_CH)
+    return FALSE;
+  return !priv->mix_main_rate ||
+      GST_AUDIO_INFO_RATE (info) == priv->mix_main_rate;
+}
+
+/* template caps with the rate main mixes at once it is known */
+static GstCaps *
+mix_pad_caps (GstAmlHalAsink * sink, GstPad * pad)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstCaps *caps = gst_pad_get_pad_template_caps (pad);
+  gint rate;
+
+  g_mutex_lock (&priv->mix_lock);
+  rate = priv->mix_main_rate;
+  g_mutex_unlock (&priv->mix_lock);
+  if (rate) {
+    caps = gst_caps_make_writable (caps);
+    gst_caps_set_simple (caps, "rate", G_TYPE_INT, rate, NULL);
+  }
+  return caps;
+}
+
+static gboolean
+gst_aml_hal_asink_mix_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    {
+      GstCaps *filter, *caps;
+
+      gst_query_parse_caps (query, &filter);
+      caps = mix_pad_caps (sink, pad);
+      if (filter) {
+        GstCaps *tmp = gst_caps_intersect_full (filter, caps,
+            GST_CAPS_INTERSECT_FIRST);
+
+        gst_caps_unref (caps);
+        caps = tmp;
+      }
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    }
+    case GST_QUERY_ACCEPT_CAPS:
+    {
+      GstCaps *caps, *allowed;
+
+      gst_query_parse_accept_caps (query, &caps);
+      allowed = mix_pad_caps (sink, pad);
+      gst_query_set_accept_caps_result (query,
+          gst_caps_can_intersect (caps, allowed));
+      gst_caps_unref (allowed);
+      return TRUE;
+    }
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+/* queue input PCM for render, or mix_ui_thread, to mix. The pad waits
+ * for room only while one of them drains the queue and not longer than
+ * MIX_QUEUE_MS, main may be starving behind this pad in the same
+ * upstream thread. Otherwise the oldest input beyond MIX_QUEUE_MS is
+ * dropped. sink_%u at another rate than a playing PCM main fails
+ * not-negotiated after asking upstream to reconfigure, ad_sink input
+ * main can not mix is dropped, it follows main anyway */
+static GstFlowReturn
+gst_aml_hal_asink_mix_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (parent);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean reconfigure = FALSE;
+  GstClockTime rt;
+  MixInput *in;
+  gsize avail, max;
+  gint64 end;
+  gint rate, bpf;
+
+  sink_apply_sched (sink, "asink_mix");
+  g_mutex_lock (&priv->mix_lock);
+  in = mix_find_input (sink, pad);
+  if (!in || !GST_AUDIO_INFO_IS_VALID (&in->info)) {
+    ret = GST_FLOW_NOT_NEGOTIATED;
+    goto out;
+  }
+  rate = GST_AUDIO_INFO_RATE (&in->info);
+  bpf = GST_AUDIO_INFO_BPF (&in->info);
+  max = (gsize) rate * bpf * MIX_QUEUE_MS / 1000;
+  end = g_get_monotonic_time () + MIX_QUEUE_MS * G_TIME_SPAN_MILLISECOND;
+  while (!in->flushing && (priv->mix_main == MIX_MAIN_PLAYING ||
+          (priv->mix_ui_active && mix_input_is_ui (sink, in))) &&
+      gst_adapter_available (in->adapter) >= max) {
+    if (!g_cond_wait_until (&priv->mix_cond, &priv->mix_lock, end))
+      break;
+  }
+  if (in->flushing) {
+    ret = GST_FLOW_FLUSHING;
+    goto out;
+  }
+
+  if (!mix_info_ok (sink, &in->info) || (!mix_input_is_ui (sink, in) &&
+          (priv->mix_main == MIX_MAIN_UNMIXABLE ||
+              priv->mix_main == MIX_MAIN_EOS))) {
+    /* main changed rate under negotiated input, ask upstream again */
+    if (!in->rate_warned && priv->mix_main_rate &&
+        GST_AUDIO_INFO_RATE (&in->info) != priv->mix_main_rate) {
+      GST_WARNING_OBJECT (pad, "rate %d, main %d, not mixing", rate,
+          priv->mix_main_rate);
+      in->rate_warned = TRUE;
+      reconfigure = TRUE;
+    }
+    GST_LOG_OBJECT (pad, "main %d can not mix, drop", priv->mix_main);
+    gst_adapter_clear (in->adapter);
+    in->head_rt = GST_CLOCK_TIME_NONE;
+    if (mix_input_is_ui (sink, in)) {
+      /* caps queries give main's rate now, upstream has to renegotiate */
+      reconfigure = TRUE;
+      ret = GST_FLOW_NOT_NEGOTIATED;
+    }
+    goto out;
+  }
+
+  rt = gst_segment_to_running_time (&in->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buf));
+  avail = gst_adapter_available (in->adapter);
+  if (!avail) {
+    /* nothing to line up with before the first timestamp */
+    if (!GST_CLOCK_TIME_IS_VALID (rt))
+      goto out;
+    in->head_rt = rt;
+  } else if (GST_CLOCK_TIME_IS_VALID (rt)) {
+    GstClockTime expect = in->head_rt +
+        gst_util_uint64_scale_int (avail / bpf, GST_SECOND, rate);
+
+    /* a hole in the input stays silent */
+    if (rt > expect + MIX_GAP_TOLERANCE) {
+      gsize gap = gst_util_uint64_scale_int (rt - expect, rate, GST_SECOND);
+      GstBuffer *silence;
+
+      gap = MIN (gap * bpf, max);
+      silence = gst_buffer_new_allocate (NULL, gap, NULL);
+      gst_buffer_memset (silence, 0, 0, gap);
+      gst_adapter_push (in->adapter, silence);
+      avail += gap;
+    }
+  }
+
+#ifdef SUPPORT_AD
+  if (in == priv->ad_in) {
+    GstMetaPesHeader *h = GST_META_PES_HEADER_GET (buf);
+    struct ad_des des;
+
+    if (h && pes_ad_des_update (&in->des_cache, h->header, h->length,
+            &des) > 0) {
+      in->des = des;
+      in->des_rt = in->head_rt +
+          gst_util_uint64_scale_int (avail / bpf, GST_SECOND, rate);
+      in->des_pending = TRUE;
+      GST_DEBUG_OBJECT (sink, "AD mix descriptor fade %d pan %d at %"
+          GST_TIME_FORMAT, des.fade, des.pan, GST_TIME_ARGS (in->des_rt));
+    }
+  }
+#endif
+
+  gst_adapter_push (in->adapter, buf);
+  buf = NULL;
+  if (mix_input_is_ui (sink, in)) {
+    mix_ui_thread_start (sink);
+    g_cond_broadcast (&priv->mix_cond);
+  }
+
+  /* not drained in time, keep the newest MIX_QUEUE_MS */
+  avail = gst_adapter_available (in->adapter);
+  if (avail > max) {
+    gsize drop = (avail - max) / bpf * bpf;
+
+    gst_adapter_flush (in->adapter, drop);
+    in->head_rt += gst_util_uint64_scale_int (drop / bpf, GST_SECOND, rate);
+    GST_LOG_OBJECT (pad, "main %d not draining, dropped %" G_GSIZE_FORMAT
+        " bytes", priv->mix_main, drop);
+  }
+
+out:
+  g_mutex_unlock (&priv->mix_lock);
+  if (buf)
+    gst_buffer_unref (buf);
+  if (reconfigure)
+    gst_pad_push_event (pad, gst_event_new_reconfigure ());
+  return ret;
+}
+
+static gboolean
+gst_aml_hal_asink_mix_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (parent);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gboolean result = TRUE;
+  MixInput *in;
+
+  GST_DEBUG_OBJECT (pad, "event %s", GST_EVENT_TYPE_NAME (event));
+  g_mutex_lock (&priv->mix_lock);
+  in = mix_find_input (sink, pad);
+  if (!in)
+    goto out;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+    {
+      GstCaps *caps;
+      GstAudioInfo info;
+
+      gst_event_parse_caps (event, &caps);
+      if (!gst_audio_info_from_caps (&info, caps) ||
+          !mix_info_ok (sink, &info)) {
+        GST_WARNING_OBJECT (pad, "can not mix %" GST_PTR_FORMAT, caps);
+        result = FALSE;
+        break;
+      }
+      in->info = info;
+      gst_adapter_clear (in->adapter);
+      in->head_rt = GST_CLOCK_TIME_NONE;
+      in->rate_warned = FALSE;
+      in->gain_out_ch = 0;
+      break;
+    }
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment (event, &in->segment);
+      break;
+    case GST_EVENT_FLUSH_START:
+      in->flushing = TRUE;
+      g_cond_broadcast (&priv->mix_cond);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      gst_adapter_clear (in->adapter);
+      gst_segment_init (&in->segment, GST_FORMAT_TIME);
+      in->head_rt = GST_CLOCK_TIME_NONE;
+      in->flushing = FALSE;
+      in->eos = FALSE;
+#ifdef SUPPORT_AD
+      in->des_pending = FALSE;
+#endif
+      break;
+    case GST_EVENT_EOS:
+      in->eos = TRUE;
+#ifdef SUPPORT_AD
+      /* description over, bring main back up after what is queued */
+      if (in == priv->ad_in && GST_AUDIO_INFO_IS_VALID (&in->info)) {
+        memset (&in->des, 0, sizeof (in->des));
+        in->des_rt = GST_CLOCK_TIME_IS_VALID (in->head_rt) ?
+            in->head_rt + gst_util_uint64_scale_int (
+                gst_adapter_available (in->adapter) /
+                GST_AUDIO_INFO_BPF (&in->info), GST_SECOND,
+                GST_AUDIO_INFO_RATE (&in->info)) : GST_CLOCK_TIME_NONE;
+        in->des_pending = TRUE;
+      }
+#endif
+      break;
+    default:
+      break;
+  }
+
+out:
+  g_mutex_unlock (&priv->mix_lock);
+  gst_event_unref (event);
+  return result;
+}
+
+/* stop or allow request pad streaming along with the main pad */
+static void
+mix_set_flushing (GstAmlHalAsink * sink, gboolean flushing)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GList *l;
+
+  g_mutex_lock (&priv->mix_lock);
+  for (l = priv->mix_inputs; l; l = l->next) {
+    MixInput *in = l->data;
+
+    in->flushing = flushing;
+    if (flushing) {
+      gst_adapter_clear (in->adapter);
+      in->head_rt = GST_CLOCK_TIME_NONE;
+    }
+  }
+  g_cond_broadcast (&priv->mix_cond);
+  g_mutex_unlock (&priv->mix_lock);
+}
+
+/* ad_sink or sink_%u, their PCM is mixed into main so everything shares
+ * one HAL stream, sink_%u goes out on its own while main does not play */
+static GstPad *
+gst_aml_hal_asink_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (element);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gboolean is_ad = !g_strcmp0 (GST_PAD_TEMPLATE_NAME_TEMPLATE (templ),
+      "ad_sink");
+  gchar *pad_name;
+  MixInput *in;
+
+  g_mutex_lock (&priv->mix_lock);
+  if ((is_ad && priv->ad_in) ||
+      g_list_length (priv->mix_inputs) >= MIX_MAX_INPUTS) {
+    g_mutex_unlock (&priv->mix_lock);
+    GST_WARNING_OBJECT (sink, "no more %s pads",
+        GST_PAD_TEMPLATE_NAME_TEMPLATE (templ));
+    return NULL;
+  }
+  if (is_ad)
+    pad_name = g_strdup ("ad_sink");
+  else if (name)
+    pad_name = g_strdup (name);
+  else
+    pad_name = g_strdup_printf ("sink_%u", priv->mix_next_id++);
+
+  in = g_new0 (MixInput, 1);
+  in->pad = g_object_new (GST_TYPE_AML_HAL_ASINK_MIX_PAD, "name", pad_name,
+      "direction", GST_PAD_SINK, "template", templ, NULL);
+  g_free (pad_name);
+  in->adapter = gst_adapter_new ();
+  gst_audio_info_init (&in->info);
+  gst_segment_init (&in->segment, GST_FORMAT_TIME);
+  in->head_rt = GST_CLOCK_TIME_NONE;
+  gst_pad_set_chain_function (GST_PAD (in->pad),
+      GST_DEBUG_FUNCPTR (gst_aml_hal_asink_mix_chain));
+  gst_pad_set_event_function (GST_PAD (in->pad),
+      GST_DEBUG_FUNCPTR (gst_aml_hal_asink_mix_event));
+  gst_pad_set_query_function (GST_PAD (in->pad),
+      GST_DEBUG_FUNCPTR (gst_aml_hal_asink_mix_query));
+  /* AD goes first, its fade ducks main before anything else is added */
+  if (is_ad) {
+    priv->mix_inputs = g_list_prepend (priv->mix_inputs, in);
+    priv->ad_in = in;
+    priv->mix_ad_ch = 0;
+  } else {
+    priv->mix_inputs = g_list_append (priv->mix_inputs, in);
+  }
+  if (GST_AUDIO_INFO_IS_VALID (&priv->hal_info))
+    mix_buf_reserve (sink, (gsize) GST_AUDIO_INFO_BPF (&priv->hal_info) *
+        GST_AUDIO_INFO_RATE (&priv->hal_info) * MIX_PERIOD_MS / 1000);
+  g_mutex_unlock (&priv->mix_lock);
+
+  GST_INFO_OBJECT (sink, "mixing %s", GST_PAD_NAME (in->pad));
+  gst_element_add_pad (element, GST_PAD (in->pad));
+  return GST_PAD (in->pad);
+}
+
+static void
+gst_aml_hal_asink_release_pad (GstElement * element, GstPad * pad)
+{
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (element);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  MixInput *in;
+
+  g_mutex_lock (&priv->mix_lock);
+  in = mix_find_input (sink, pad);
+  if (!in) {
+    g_mutex_unlock (&priv->mix_lock);
     return;
+  }
+  in->flushing = TRUE;
+  g_cond_broadcast (&priv->mix_cond);
+  g_mutex_unlock (&priv->mix_lock);
+
+  /* let a chain call in flight return before the queue goes away */
+  GST_PAD_STREAM_LOCK (pad);
+  g_mutex_lock (&priv->mix_lock);
+  priv->mix_inputs = g_list_remove (priv->mix_inputs, in);
+  if (priv->ad_in == in)
+    priv->ad_in = NULL;
+  g_mutex_unlock (&priv->mix_lock);
+  GST_PAD_STREAM_UNLOCK (pad);
+
+  GST_INFO_OBJECT (sink, "stop mixing %s", GST_PAD_NAME (pad));
+  gst_element_remove_pad (element, pad);
+  g_object_unref (in->adapter);
+  g_free (in);
 }
 
-static GstFlowReturn
-gst_aml_hal_asink_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+static void trace_open (GstAmlHalAsink *sink)
 {
-  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (parent);
-  aml_hal_clip_buf_by_meta(sink, buf);
-  return gst_aml_hal_asink_render (sink, buf);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gchar *path;
+
+  SINK_OBJECT_LOCK (sink);
+  path = g_strdup (priv->trace_location);
+  SINK_OBJECT_UNLOCK (sink);
+  if (!path || !*path) {
+    g_free (path);
+    return;
+  }
+
+  priv->trace = buf_trace_open (path, priv->trace_payload);
+  if (priv->trace)
+    GST_WARNING_OBJECT (sink, "recording trace to %s payload %d",
+        path, priv->trace_payload);
+  else
+    GST_ERROR_OBJECT (sink, "can not open trace %s", path);
+  g_free (path);
 }
 
 static void paused_to_ready(GstAmlHalAsink *sink)
@@ -3043,8 +5873,15 @@ static void paused_to_ready(GstAmlHalAsink *sink)
   /* make sure we unblock before calling the parent state change
    * so it can grab the STREAM_LOCK */
   stop_xrun_thread (sink);
-  GST_OBJECT_LOCK (sink);
+  coalesce_thread_stop (sink);
+  /* its stream goes with the HAL */
+  mix_ui_thread_stop (sink);
+  SINK_OBJECT_LOCK (sink);
   hal_release (sink);
+  /* kept by warm switch until here */
+  FEED_LOCK (priv);
+  avsync_drop (sink);
+  FEED_UNLOCK (priv);
   priv->quit_clock_wait = TRUE;
   priv->paused_ = FALSE;
 
@@ -3054,7 +5891,8 @@ static void paused_to_ready(GstAmlHalAsink *sink)
     scaletempo_stop (&priv->st);
     priv->tempo_used = FALSE;
   }
-  GST_OBJECT_UNLOCK (sink);
+  g_free (tempo_take_update (sink));
+  SINK_OBJECT_UNLOCK (sink);
 }
 
 #ifdef ESSOS_RM
@@ -3071,10 +5909,10 @@ static void resMgrNotify(EssRMgr *rm, int event, int type, int id, void* userDat
         case EssRMgrEvent_revoked:
         {
 #ifdef ENABLE_MS12
-          GST_OBJECT_LOCK (sink);
+          SINK_OBJECT_LOCK (sink);
           if (priv->format_ == AUDIO_FORMAT_AC4)
             hal_set_player_overwrite(sink, TRUE);
-          GST_OBJECT_UNLOCK (sink);
+          SINK_OBJECT_UNLOCK (sink);
 #endif
           GST_WARNING_OBJECT (sink, "releasing audio decoder %d", id);
           paused_to_ready (sink);
@@ -3154,10 +5992,16 @@ gst_aml_hal_asink_change_state (GstElement * element,
   GstAmlHalAsink *sink = GST_AML_HAL_ASINK (element);
   GstAmlHalAsinkPrivate *priv = sink->priv;
 
+  /* pads are inactive in NULL, so nobody else touches priv->trace here */
+  if (transition == GST_STATE_CHANGE_NULL_TO_READY)
+    trace_open (sink);
+  buf_trace_state (priv->trace, transition);
+
   switch (transition) {
     case GST_STATE_CHANGE_NULL_TO_READY:
     {
       GST_INFO_OBJECT(sink, "null to ready");
+      startup_reset (sink);
 #ifdef ESSOS_RM
       if (priv->direct_mode_)
         essos_rm_init (sink);
@@ -3168,26 +6012,31 @@ gst_aml_hal_asink_change_state (GstElement * element,
       }
       GST_WARNING_OBJECT(sink, "avsync session %d", priv->session_id);
 
-      GST_OBJECT_LOCK (sink);
       if (!gst_aml_hal_asink_open (sink)) {
-        GST_OBJECT_UNLOCK (sink);
         GST_ERROR_OBJECT(sink, "asink open failure");
         goto open_failed;
       }
 
+      SINK_OBJECT_LOCK (sink);
       if (!hal_open_device (sink)) {
-        GST_OBJECT_UNLOCK (sink);
+        SINK_OBJECT_UNLOCK (sink);
         goto open_failed;
       }
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
+      startup_mark (sink, STARTUP_READY);
       break;
     }
     case GST_STATE_CHANGE_READY_TO_PAUSED:
       GST_INFO_OBJECT(sink, "ready to paused");
+      /* restart from READY, no HAL load in this start */
+      if (g_atomic_int_get (&priv->startup[STARTUP_STREAM_OPEN]) >= 0)
+        startup_reset (sink);
+      mix_set_flushing (sink, FALSE);
       gst_base_sink_set_async_enabled (GST_BASE_SINK_CAST(sink), FALSE);
       gst_aml_hal_asink_reset_sync (sink, FALSE);
       /* start in paused state until PLAYING */
       priv->paused_ = TRUE;
+      mix_main_sync (sink);
       priv->quit_clock_wait = FALSE;
 
       /* Only post clock-provide messages if this is the clock that
@@ -3205,9 +6054,9 @@ gst_aml_hal_asink_change_state (GstElement * element,
     {
       GST_INFO_OBJECT(sink, "paused to playing");
 
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
       hal_start (sink);
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
 #ifdef ESSOS_RM
       resMgrUpdateState(priv, EssRMgrRes_active);
 #endif
@@ -3225,17 +6074,29 @@ gst_aml_hal_asink_change_state (GstElement * element,
     case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
     {
       GstBaseSink* bsink = GST_BASE_SINK_CAST (sink);
+      gboolean faded;
+      gint64 ramp_end;
+
       GST_INFO_OBJECT(sink, "playing to paused");
+      ramp_end = g_get_monotonic_time () +
+          PAUSE_FADE_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+      faded = pcm_pause_fade (sink);
       if (!priv->ms12_enable) {
-        GST_OBJECT_LOCK (sink);
-        if (priv->hw_dev_)
-          priv->hw_dev_->set_parameters(priv->hw_dev_, "gst_pause=1");
-        GST_OBJECT_UNLOCK (sink);
-        usleep(60*1000);
+        SINK_OBJECT_LOCK (sink);
+        hal_param_dev_cmd (&priv->hparam, priv->hw_dev_, "gst_pause=1");
+        SINK_OBJECT_UNLOCK (sink);
+        /* give HAL time to ramp down what sink could not fade, waiting
+         * for sink fade already took part of it */
+        if (!faded) {
+          gint64 left = ramp_end - g_get_monotonic_time ();
+
+          if (left > 0)
+            usleep (left);
+        }
       } else if (priv->stream_) {
-        GST_OBJECT_LOCK (sink);
-        priv->stream_->common.set_parameters(&priv->stream_->common, "will_pause=1");
-        GST_OBJECT_UNLOCK (sink);
+        SINK_OBJECT_LOCK (sink);
+        hal_param_stream_cmd (&priv->hparam, priv->stream_, "will_pause=1");
+        SINK_OBJECT_UNLOCK (sink);
       }
       if (priv->avsync && priv->sync_mode == AV_SYNC_MODE_PCR_MASTER) {
         GST_INFO_OBJECT(sink, "avsync to free run");
@@ -3247,8 +6108,14 @@ gst_aml_hal_asink_change_state (GstElement * element,
         av_sync_change_mode_by_id(priv->session_id, AV_SYNC_MODE_FREE_RUN);
       }
 #endif
-      GST_OBJECT_LOCK (sink);
+      /* held back PCM goes out before HAL stops */
+      coalesce_drain (sink);
+      SINK_OBJECT_LOCK (sink);
       hal_pause (sink);
+      FEED_LOCK (priv);
+      priv->pause_fade = PAUSE_FADE_NONE;
+      g_cond_signal (&priv->run_ready);
+      FEED_UNLOCK (priv);
       /* To complete transition to paused state in async_enabled mode,
        * we need a preroll buffer pushed to the pad.
        * This is a workaround to avoid the need for preroll buffer. */
@@ -3257,7 +6124,7 @@ gst_aml_hal_asink_change_state (GstElement * element,
       GST_BASE_SINK_PREROLL_LOCK (bsink);
       bsink->have_preroll = 1;
       GST_BASE_SINK_PREROLL_UNLOCK (bsink);
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
 #ifdef ESSOS_RM
       resMgrUpdateState(priv, EssRMgrRes_paused);
 #endif
@@ -3266,10 +6133,11 @@ gst_aml_hal_asink_change_state (GstElement * element,
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       // unblock _render and upstream
       // original code here has to place below parent change_state (avoid race condtion)
-      g_mutex_lock(&priv->feed_lock);
+      FEED_LOCK (priv);
       priv->flushing_ = TRUE;
       g_cond_signal(&priv->run_ready);
-      g_mutex_unlock(&priv->feed_lock);
+      FEED_UNLOCK (priv);
+      mix_set_flushing (sink, TRUE);
       break;
     default:
       break;
@@ -3291,7 +6159,7 @@ gst_aml_hal_asink_change_state (GstElement * element,
     }
     case GST_STATE_CHANGE_READY_TO_NULL:
       GST_INFO_OBJECT(sink, "ready to null");
-      GST_OBJECT_LOCK (sink);
+      SINK_OBJECT_LOCK (sink);
 #ifdef ENABLE_MS12
       if (priv->format_ == AUDIO_FORMAT_AC4)
         hal_set_player_overwrite(sink, TRUE);
@@ -3306,7 +6174,7 @@ gst_aml_hal_asink_change_state (GstElement * element,
       priv->format_ = AUDIO_FORMAT_PCM_16_BIT;
       scaletempo_init (&priv->st);
 
-      GST_OBJECT_UNLOCK (sink);
+      SINK_OBJECT_UNLOCK (sink);
 
 #ifdef ESSOS_RM
       g_mutex_lock(&priv->ess_lock);
@@ -3321,6 +6189,8 @@ gst_aml_hal_asink_change_state (GstElement * element,
       }
       g_mutex_unlock(&priv->ess_lock);
 #endif
+      buf_trace_close (priv->trace);
+      priv->trace = NULL;
       break;
     default:
       break;
@@ -3336,30 +6206,134 @@ open_failed:
   }
 }
 
-/* open the device with given specs */
-static gboolean gst_aml_hal_asink_open (GstAmlHalAsink* sink)
+/* runs on hal_loader, the HAL IPC set up and the ms12 probe */
+static gpointer hal_load_thread (gpointer data)
 {
+  GstAmlHalAsink *sink = GST_AML_HAL_ASINK (data);
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  audio_hw_device_t *dev = NULL;
   int ret, val = 0;
-  char *status;
+
+  sink_apply_sched (sink, "ahal_load");
+#ifdef MOCK_HAL_ONLY
+  priv->mock_hal = TRUE;
+#else
+  priv->mock_hal = mock_hal_enabled ();
+#endif
+  if (priv->mock_hal) {
+    GST_WARNING_OBJECT (sink, "using mock HAL");
+    ret = mock_hal_load (&dev);
+  }
+#ifndef MOCK_HAL_ONLY
+  else
+    ret = audio_hw_load_interface(&dev);
+#endif
+
+  priv->hal_load_ms12 = 0;
+  if (!ret && !hal_param_dev_get_int (&priv->hparam, dev,
+        "dolby_ms12_enable", &val))
+    priv->hal_load_ms12 = val;
+  priv->hal_load_dev = ret ? NULL : dev;
+  priv->hal_load_ret = ret;
+  GST_DEBUG_OBJECT (sink, "load hw %d", ret);
+  return NULL;
+}
+
+/* kick off loading unless loaded or on the way, hal_load_lock held */
+static void hal_load_start (GstAmlHalAsink * sink)
+{
   GstAmlHalAsinkPrivate *priv = sink->priv;
 
-  GST_DEBUG_OBJECT (sink, "open");
-  ret = audio_hw_load_interface(&priv->hw_dev_);
-  if (ret) {
-    GST_ERROR_OBJECT(sink, "fail to load hw:%d", ret);
-    return FALSE;
+  if (priv->hw_dev_ || priv->hal_load_pending)
+    return;
+
+  priv->hal_load_pending = TRUE;
+  priv->hal_loader = g_thread_try_new ("ahal_load", hal_load_thread, sink, NULL);
+  if (!priv->hal_loader) {
+    GST_WARNING_OBJECT (sink, "no loader thread, load in place");
+    hal_load_thread (sink);
+  }
+}
+
+static void hal_unload (GstAmlHalAsink * sink, audio_hw_device_t * dev)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (priv->mock_hal)
+    mock_hal_unload (dev);
+#ifndef MOCK_HAL_ONLY
+  else
+    audio_hw_unload_interface(dev);
+#endif
+}
+
+/* wait for the loader and unload what nobody took, hal_load_lock held */
+static void hal_load_drop (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (!priv->hal_load_pending)
+    return;
+  if (priv->hal_loader) {
+    g_thread_join (priv->hal_loader);
+    priv->hal_loader = NULL;
   }
+  priv->hal_load_pending = FALSE;
+  if (priv->hal_load_dev) {
+    hal_unload (sink, priv->hal_load_dev);
+    priv->hal_load_dev = NULL;
+  }
+}
 
-  status = priv->hw_dev_->get_parameters (priv->hw_dev_,
-      "dolby_ms12_enable");
+/* first use of the HAL waits for the loader here. Returns FALSE when the
+ * HAL could not be loaded. Must not be called with the object lock held */
+static gboolean hal_join (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gboolean ok;
+  gint64 t;
+
+  g_mutex_lock (&priv->hal_load_lock);
+  hal_load_start (sink);
+  if (priv->hal_load_pending) {
+    t = g_get_monotonic_time ();
+    if (priv->hal_loader) {
+      g_thread_join (priv->hal_loader);
+      priv->hal_loader = NULL;
+    }
+    priv->hal_load_pending = FALSE;
+    priv->hal_wait_us = g_get_monotonic_time () - t;
 
-  if (status) {
-    sscanf(status,"dolby_ms12_enable=%d", &val);
-    priv->ms12_enable = val;
-    free (status);
-    GST_DEBUG_OBJECT (sink, "load hw done ms12: %d", val);
+    if (priv->hal_load_ret) {
+      GST_ERROR_OBJECT(sink, "fail to load hw:%d", priv->hal_load_ret);
+    } else {
+      /* a reloaded HAL knows nothing of what was set before */
+      hal_param_forget (&priv->hparam, NULL);
+      priv->ms12_enable = priv->hal_load_ms12;
+      g_atomic_pointer_set (&priv->hw_dev_, priv->hal_load_dev);
+      priv->hal_load_dev = NULL;
+      GST_DEBUG_OBJECT (sink, "load hw done ms12: %d, waited %" G_GINT64_FORMAT " us",
+          priv->ms12_enable, priv->hal_wait_us);
+      startup_mark (sink, STARTUP_HAL_LOAD);
+    }
   }
+  ok = (priv->hw_dev_ != NULL);
+  g_mutex_unlock (&priv->hal_load_lock);
+  return ok;
+}
 
+/* start loading the HAL, waited for right here only without async-hal-load */
+static gboolean gst_aml_hal_asink_open (GstAmlHalAsink* sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  GST_DEBUG_OBJECT (sink, "open");
+  g_mutex_lock (&priv->hal_load_lock);
+  hal_load_start (sink);
+  g_mutex_unlock (&priv->hal_load_lock);
+
+  if (!priv->async_hal_load)
+    return hal_join (sink);
   return TRUE;
 }
 
@@ -3368,7 +6342,11 @@ static gboolean gst_aml_hal_asink_close (GstAmlHalAsink* sink)
   GstAmlHalAsinkPrivate *priv = sink->priv;
 
   GST_DEBUG_OBJECT(sink, "close");
-  audio_hw_unload_interface(priv->hw_dev_);
+  g_mutex_lock (&priv->hal_load_lock);
+  hal_load_drop (sink);
+  g_mutex_unlock (&priv->hal_load_lock);
+  if (priv->hw_dev_)
+    hal_unload (sink, priv->hw_dev_);
   priv->hw_dev_ = NULL;
   GST_DEBUG_OBJECT(sink, "unload hw");
   return TRUE;
@@ -3402,6 +6380,8 @@ static gboolean hal_close_device (GstAmlHalAsink* sink)
     priv->stream_->flush(priv->stream_);
     priv->hw_dev_->close_output_stream(priv->hw_dev_,
         priv->stream_);
+    hal_caps_stream_closed ();
+    hal_param_forget (&priv->hparam, priv->stream_);
   }
 
   if (priv->trans_buf)
@@ -3417,16 +6397,43 @@ hal_parse_spec (GstAmlHalAsink * sink, GstAudioRingBufferSpec * spec)
   gint channels;
   gboolean raw_data = is_raw_type(spec->type);
 
+  priv->pcm_convert = NULL;
+  if (priv->resampler) {
+    pcm_resample_free (priv->resampler);
+    priv->resampler = NULL;
+  }
   switch (spec->type) {
     case GST_AUDIO_RING_BUFFER_FORMAT_TYPE_RAW:
+    {
+      enum pcm_fmt fmt;
+
       switch (GST_AUDIO_INFO_FORMAT (&spec->info)) {
         case GST_AUDIO_FORMAT_S16LE:
-          priv->format_ = AUDIO_FORMAT_PCM_16_BIT;
+          fmt = PCM_FMT_S16LE;
+          break;
+        case GST_AUDIO_FORMAT_S24LE:
+          fmt = PCM_FMT_S24LE;
+          break;
+        case GST_AUDIO_FORMAT_S24_32LE:
+          fmt = PCM_FMT_S24_32LE;
+          break;
+        case GST_AUDIO_FORMAT_S32LE:
+          fmt = PCM_FMT_S32LE;
+          break;
+        case GST_AUDIO_FORMAT_F32LE:
+          fmt = PCM_FMT_F32LE;
           break;
         default:
           goto error;
       }
+      /* HAL takes S16 only, wider formats are converted in render */
+      priv->format_ = AUDIO_FORMAT_PCM_16_BIT;
+      priv->pcm_convert = pcm_convert_get (fmt);
+      gst_audio_info_set_format (&priv->hal_info, GST_AUDIO_FORMAT_S16LE,
+          GST_AUDIO_INFO_RATE (&spec->info),
+          GST_AUDIO_INFO_CHANNELS (&spec->info), spec->info.position);
       break;
+    }
     case GST_AUDIO_RING_BUFFER_FORMAT_TYPE_AC3:
       priv->format_ = AUDIO_FORMAT_AC3;
       break;
@@ -3501,123 +6508,338 @@ error:
   return FALSE;
 }
 
-/* prepare resources and state to operate with the given specs */
-static gboolean
-aml_open_output_stream (GstAmlHalAsink * sink, GstAudioRingBufferSpec * spec)
+static guint
+chunk_align_up (guint size, guint align)
+{
+  return (size + align - 1) / align * align;
+}
+
+/* bounds of the raw write size for the new stream, the upper one is the
+ * fixed limit hal_commit always had, lowered to half of HAL latency */
+static void
+chunk_setup (GstAmlHalAsink * sink, gboolean raw)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
-  struct audio_config config;
-  int ret;
-  audio_output_flags_t flag;
-  audio_devices_t device;
+  guint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
+  guint rate = GST_AUDIO_INFO_RATE (&priv->hal_info);
+  guint hard, align, latency;
 
-  GST_DEBUG_OBJECT (sink, "prepare");
+  priv->chunk_size = priv->chunk_min = priv->chunk_max = 0;
+  priv->chunk_block_us = 0;
+  if (!raw || !bpf || !rate)
+    return;
 
-  if (!hal_parse_spec (sink, spec))
-    return FALSE;
+  /* direct mode keeps writes 16 byte aligned, frames stay whole here */
+  align = bpf;
+  while (priv->direct_mode_ && align % 16)
+    align += bpf;
+  hard = priv->direct_mode_ ? TRANS_DATA_SIZE : MAX_RAW_WRITE_SIZE;
+  priv->chunk_align = align;
+  priv->chunk_max = hard - hard % align;
+  priv->chunk_size = priv->chunk_max;
+  if (!priv->chunk_adapt)
+    return;
 
-  memset(&config, 0, sizeof(config));
-  config.sample_rate = priv->sr_;
-  config.channel_mask = priv->channel_mask_;
-  config.format = priv->format_;
+  /* not hal_get_latency, that pauses the stream before asking */
+  latency = priv->stream_ ? priv->stream_->get_latency (priv->stream_) : 0;
+  if (latency) {
+    guint half = gst_util_uint64_scale_int (rate, latency, 2000) * bpf;
 
-  if (priv->tts_mode_)
-    flag = AUDIO_OUTPUT_FLAG_MMAP_NOIRQ | AUDIO_OUTPUT_FLAG_PRIMARY;
-  else if (priv->direct_mode_)
-    flag = AUDIO_OUTPUT_FLAG_DIRECT | AUDIO_OUTPUT_FLAG_HW_AV_SYNC;
-  else
-    flag = AUDIO_OUTPUT_FLAG_PRIMARY;
+    if (half < priv->chunk_max)
+      priv->chunk_max = half - half % align;
+  }
+  priv->chunk_min = chunk_align_up (rate * CHUNK_MIN_MS / 1000 * bpf, align);
+  if (priv->chunk_min > priv->chunk_max)
+    priv->chunk_min = priv->chunk_max;
+  priv->chunk_max = MAX (priv->chunk_max, align);
+  priv->chunk_min = MAX (priv->chunk_min, align);
+  priv->chunk_size = priv->chunk_max;
+  GST_INFO_OBJECT (sink, "raw chunk %u..%u latency %u ms",
+      priv->chunk_min, priv->chunk_max, latency);
+}
 
-#if SUPPORT_AD
-  if (priv->is_dual_audio) {
-    char setting[50];
+/* feed back how long the last raw write() blocked */
+static void
+chunk_update (GstAmlHalAsink * sink, gint64 block_us)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  guint size = priv->chunk_size;
 
-    snprintf(setting, sizeof(setting), "dual_decoder_support=1");
-    priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+  if (!priv->chunk_adapt || !priv->chunk_min)
+    return;
+
+  priv->chunk_block_us += (block_us - priv->chunk_block_us) / 4;
+  if (priv->chunk_block_us > CHUNK_BLOCK_HIGH_US)
+    size = size * 3 / 4;
+  else if (priv->chunk_block_us < CHUNK_BLOCK_LOW_US)
+    size = chunk_align_up (size * 5 / 4, priv->chunk_align);
+  size -= size % priv->chunk_align;
+  size = CLAMP (size, priv->chunk_min, priv->chunk_max);
+  if (size != priv->chunk_size) {
+    GST_LOG_OBJECT (sink, "chunk %u -> %u block %" G_GINT64_FORMAT " us",
+        priv->chunk_size, size, priv->chunk_block_us);
+    priv->chunk_size = size;
   }
-  if (priv->is_ad_audio) {
-    char setting[50];
+}
 
-    flag |= AUDIO_OUTPUT_FLAG_AD_STREAM;
-    snprintf(setting, sizeof(setting), "associate_audio_mixing_enable_force=1");
-    priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+/* resample raw input to @rate, HAL side info follows */
+static gboolean
+hal_setup_resample (GstAmlHalAsink * sink, guint rate)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  GstAudioInfo *info = &priv->spec.info;
+
+  if (priv->resampler)
+    pcm_resample_free (priv->resampler);
+  priv->resampler = pcm_resample_new (GST_AUDIO_INFO_RATE (info), rate,
+      GST_AUDIO_INFO_CHANNELS (info), priv->resample_quality);
+  if (!priv->resampler) {
+    GST_ERROR_OBJECT (sink, "can not resample %d to %d",
+        GST_AUDIO_INFO_RATE (info), rate);
+    return FALSE;
   }
+
+  priv->sr_ = rate;
+  gst_audio_info_set_format (&priv->hal_info, GST_AUDIO_FORMAT_S16LE, rate,
+      GST_AUDIO_INFO_CHANNELS (info), info->position);
+  GST_INFO_OBJECT (sink, "resample %d to %d quality %d",
+      GST_AUDIO_INFO_RATE (info), rate, priv->resample_quality);
+  return TRUE;
+}
+
+/* output flags and device the stream is opened with */
+static gboolean
+hal_stream_route (GstAmlHalAsink * sink, audio_output_flags_t * flag,
+    audio_devices_t * device)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  if (priv->tts_mode_)
+    *flag = AUDIO_OUTPUT_FLAG_MMAP_NOIRQ | AUDIO_OUTPUT_FLAG_PRIMARY;
+  else if (priv->direct_mode_)
+    *flag = AUDIO_OUTPUT_FLAG_DIRECT | AUDIO_OUTPUT_FLAG_HW_AV_SYNC;
+  else
+    *flag = AUDIO_OUTPUT_FLAG_PRIMARY;
+#if SUPPORT_AD
+  if (priv->is_ad_audio)
+    *flag |= AUDIO_OUTPUT_FLAG_AD_STREAM;
 #endif
 
   if (priv->output_port_ == 0)
-    device = AUDIO_DEVICE_OUT_SPEAKER;
+    *device = AUDIO_DEVICE_OUT_SPEAKER;
   else if (priv->output_port_ == 1)
-    device = AUDIO_DEVICE_OUT_HDMI;
+    *device = AUDIO_DEVICE_OUT_HDMI;
   else if (priv->output_port_ == 2)
-    device = AUDIO_DEVICE_OUT_HDMI_ARC;
+    *device = AUDIO_DEVICE_OUT_HDMI_ARC;
   else if (priv->output_port_ == 3)
-    device = AUDIO_DEVICE_OUT_SPDIF;
+    *device = AUDIO_DEVICE_OUT_SPDIF;
   else {
     GST_ERROR_OBJECT(sink, "invalid port:%d", priv->output_port_);
     return FALSE;
   }
+  return TRUE;
+}
+
+/* spec dependent state around an opened stream, also redone when a warm
+ * switch keeps the stream */
+static void
+hal_stream_ready (GstAmlHalAsink * sink, GstAudioRingBufferSpec * spec)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+#if SUPPORT_AD
+  /* a new stream starts without a descriptor, send the current one again */
+  pes_ad_des_cache_reset (&priv->ad_cache);
+  priv->ad_sent_valid = FALSE;
+  priv->ad_pending = FALSE;
+#endif
+
+  chunk_setup (sink, is_raw_type(spec->type));
+  if (priv->mix_inputs && is_raw_type(spec->type)) {
+    g_mutex_lock (&priv->mix_lock);
+    mix_buf_reserve (sink, (gsize) GST_AUDIO_INFO_BPF (&priv->hal_info) *
+        GST_AUDIO_INFO_RATE (&priv->hal_info) * MIX_PERIOD_MS / 1000);
+    g_mutex_unlock (&priv->mix_lock);
+  }
+}
+
+/* prepare resources and state to operate with the given specs */
+static gboolean
+aml_open_output_stream (GstAmlHalAsink * sink, GstAudioRingBufferSpec * spec)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  struct audio_config config;
+  int ret;
+  audio_output_flags_t flag;
+  audio_devices_t device;
+
+  GST_DEBUG_OBJECT (sink, "prepare");
+
+  if (!hal_parse_spec (sink, spec))
+    return FALSE;
+
+  /* system sound mixing port runs at 48K only */
+  if (is_raw_type(spec->type) && !priv->direct_mode_ && priv->sr_ != 48000 &&
+      !hal_setup_resample (sink, 48000))
+    return FALSE;
+
+  if (!hal_stream_route (sink, &flag, &device))
+    return FALSE;
+
+#if SUPPORT_AD
+  if (priv->is_dual_audio)
+    hal_param_dev_set (&priv->hparam, priv->hw_dev_,
+        "dual_decoder_support", "1");
+  if (priv->is_ad_audio)
+    hal_param_dev_set (&priv->hparam, priv->hw_dev_,
+        "associate_audio_mixing_enable_force", "1");
+#endif
+
+reopen:
+  memset(&config, 0, sizeof(config));
+  config.sample_rate = priv->sr_;
+  config.channel_mask = priv->channel_mask_;
+  config.format = priv->format_;
 
   ret = priv->hw_dev_->open_output_stream(priv->hw_dev_,
       0, device,
       flag, &config,
       &priv->stream_, NULL);
   if (ret) {
+    if (is_raw_type(spec->type) && priv->sr_ != 48000) {
+      GST_WARNING_OBJECT(sink, "HAL rejects %d, resample to 48000", priv->sr_);
+      if (hal_setup_resample (sink, 48000))
+        goto reopen;
+    }
     GST_ERROR_OBJECT(sink, "can not open output stream:%d", ret);
     return FALSE;
   }
+  hal_caps_stream_opened ();
+  priv->open_format = priv->format_;
+  priv->open_sr = GST_AUDIO_INFO_RATE (&spec->info);
+  priv->open_hw_sr = priv->sr_;
+  priv->open_mask = priv->channel_mask_;
+  priv->open_flags = flag;
+  priv->open_device = device;
+#if SUPPORT_AD
+  priv->open_dual = priv->is_dual_audio;
+#endif
 
 #ifdef ENABLE_MS12
   if (priv->format_ == AUDIO_FORMAT_AC4)
     hal_set_player_overwrite(sink, FALSE);
 #endif
 
+  hal_stream_ready (sink, spec);
   GST_DEBUG_OBJECT (sink, "done");
   return TRUE;
 }
 
+/* warm switch: TRUE when @spec gets the stream that is open, so it can be
+ * kept. Parses @spec into priv either way */
+static gboolean
+hal_stream_reusable (GstAmlHalAsink * sink, GstAudioRingBufferSpec * spec)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  audio_output_flags_t flag;
+  audio_devices_t device;
+
+  if (!priv->warm_switch || !priv->stream_)
+    return FALSE;
+  if (!hal_parse_spec (sink, spec) ||
+      !hal_stream_route (sink, &flag, &device))
+    return FALSE;
+
+  if (priv->format_ != priv->open_format || priv->sr_ != priv->open_sr ||
+      priv->channel_mask_ != priv->open_mask || flag != priv->open_flags ||
+      device != priv->open_device) {
+    GST_INFO_OBJECT (sink, "stream 0x%x/%u/0x%x -> 0x%x/%u/0x%x, reopen",
+        priv->open_format, priv->open_sr, priv->open_mask,
+        priv->format_, priv->sr_, priv->channel_mask_);
+    return FALSE;
+  }
+#if SUPPORT_AD
+  /* dual decoder is set up before open */
+  if (priv->is_dual_audio != priv->open_dual)
+    return FALSE;
+#endif
+
+  /* resample the way the open stream was set up, 48K port or fallback */
+  if (priv->open_hw_sr != priv->sr_ &&
+      !hal_setup_resample (sink, priv->open_hw_sr))
+    return FALSE;
+  return TRUE;
+}
+
 /* This method should create a new stream of the given @spec. No playback should
  * start yet so we start in the corked state. */
 static gboolean hal_acquire (GstAmlHalAsink * sink,
     GstAudioRingBufferSpec * spec)
 {
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+
+  /* warm switch, stream_ is flushed already */
+  if (hal_stream_reusable (sink, spec)) {
+    FEED_LOCK (priv);
+    priv->render_samples = 0;
+    priv->warm_switches++;
+    FEED_UNLOCK (priv);
+    hal_stream_ready (sink, spec);
+    startup_mark (sink, STARTUP_STREAM_OPEN);
+    GST_INFO_OBJECT (sink, "keep stream %p", priv->stream_);
+    return TRUE;
+  }
+  if (priv->stream_)
+    hal_close (sink);
+
   if (!aml_open_output_stream (sink, spec))
     return FALSE;
+  startup_mark (sink, STARTUP_STREAM_OPEN);
 
   /* TODO:: configure volume when we changed it, else we leave the default */
   GST_DEBUG_OBJECT(sink, "done");
   return TRUE;
 }
 
-/* free the stream that we acquired before */
-static gboolean hal_release (GstAmlHalAsink * sink)
+/* close the stream, it is stopped already */
+static void hal_close (GstAmlHalAsink * sink)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
-  GST_INFO_OBJECT (sink, "enter");
 
-  hal_stop(sink);
-  g_mutex_lock(&priv->feed_lock);
+  FEED_LOCK (priv);
   if (priv->stream_) {
     priv->hw_dev_->close_output_stream(priv->hw_dev_, priv->stream_);
+    hal_caps_stream_closed ();
+    /* the next stream may get the same address */
+    hal_param_forget (&priv->hparam, priv->stream_);
     priv->stream_ = NULL;
     priv->render_samples = 0;
   }
-  g_mutex_unlock(&priv->feed_lock);
+  if (priv->resampler) {
+    pcm_resample_free (priv->resampler);
+    priv->resampler = NULL;
+  }
+  FEED_UNLOCK (priv);
+  mix_main_sync (sink);
 
 #if SUPPORT_AD
-  if (priv->is_dual_audio) {
-    char setting[50];
+  if (priv->is_dual_audio)
+    hal_param_dev_set (&priv->hparam, priv->hw_dev_,
+        "dual_decoder_support", "0");
 
-    snprintf(setting, sizeof(setting), "dual_decoder_support=0");
-    priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  }
+  if (priv->is_ad_audio)
+    hal_param_dev_set (&priv->hparam, priv->hw_dev_,
+        "associate_audio_mixing_enable_force", "255");
+#endif
+}
 
-  if (priv->is_ad_audio) {
-    char setting[50];
+/* free the stream that we acquired before */
+static gboolean hal_release (GstAmlHalAsink * sink)
+{
+  GST_INFO_OBJECT (sink, "enter");
 
-    snprintf(setting, sizeof(setting), "associate_audio_mixing_enable_force=255");
-    priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  }
-#endif
+  hal_stop(sink);
+  hal_close(sink);
 
   GST_INFO_OBJECT(sink, "done");
   return TRUE;
@@ -3699,11 +6921,14 @@ static gboolean hal_start (GstAmlHalAsink * sink)
     GST_INFO_OBJECT (sink, "stream not created yet");
     priv->paused_ = FALSE;
   } else {
-    g_mutex_lock(&priv->feed_lock);
+    FEED_LOCK (priv);
     if (priv->paused_) {
       int ret;
 
+      gint64 t = lock_prof_begin (&priv->lprof);
+
       ret = priv->stream_->resume(priv->stream_);
+      lock_prof_end (&priv->lprof, "resume", t);
       if (ret)
         GST_WARNING_OBJECT (sink, "resume failure:%d", ret);
 
@@ -3714,27 +6939,74 @@ static gboolean hal_start (GstAmlHalAsink * sink)
         g_timer_start(priv->xrun_timer);
 
       priv->paused_ = FALSE;
+      if (priv->pcm_proc_used)
+        priv->pcm_fade_req = PCM_FADE_REQ_IN;
       g_cond_signal (&priv->run_ready);
     }
-    g_mutex_unlock(&priv->feed_lock);
+    FEED_UNLOCK (priv);
   }
+  mix_main_sync (sink);
 
   return TRUE;
 }
 
+/* fade PCM out in render before HAL pause. Returns TRUE once the faded
+ * tail is committed and had HAL latency to play out, FALSE if nothing was
+ * faded before the deadline */
+static gboolean pcm_pause_fade (GstAmlHalAsink * sink)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint64 deadline, drained;
+  gboolean done;
+
+  FEED_LOCK (priv);
+  if (!priv->pcm_proc_used || !priv->stream_ || priv->paused_ ||
+      priv->flushing_ || priv->received_eos) {
+    FEED_UNLOCK (priv);
+    return FALSE;
+  }
+
+  deadline = g_get_monotonic_time () +
+      PAUSE_FADE_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+  priv->pause_fade = PAUSE_FADE_REQUEST;
+  while (priv->pause_fade != PAUSE_FADE_DONE && !priv->flushing_) {
+    if (!FEED_COND_WAIT_UNTIL (priv, &priv->fade_cond, deadline))
+      break;
+  }
+
+  done = (priv->pause_fade == PAUSE_FADE_DONE);
+  if (done) {
+    /* wait for the fade to reach the output, not longer than deadline */
+    drained = priv->fade_done_time +
+        priv->stream_->get_latency (priv->stream_) * G_TIME_SPAN_MILLISECOND;
+    if (drained > deadline)
+      drained = deadline;
+    while (!priv->flushing_ && FEED_COND_WAIT_UNTIL (priv,
+          &priv->fade_cond, drained))
+      ;
+  } else {
+    /* render resumes fading in on next start */
+    priv->pause_fade = PAUSE_FADE_NONE;
+  }
+  FEED_UNLOCK (priv);
+  GST_INFO_OBJECT (sink, "pause fade %s", done ? "done" : "timeout");
+  return done;
+}
+
 /* pause/stop playback ASAP */
 static gboolean hal_pause (GstAmlHalAsink * sink)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
   int ret;
+  gint64 t;
 
   GST_INFO_OBJECT (sink, "enter");
   if (!priv->stream_) {
     return FALSE;
   }
-  g_mutex_lock(&priv->feed_lock);
+  FEED_LOCK (priv);
   if (priv->paused_) {
-    g_mutex_unlock(&priv->feed_lock);
+    FEED_UNLOCK (priv);
     GST_DEBUG_OBJECT (sink, "already in pause state");
     return TRUE;
   }
@@ -3743,11 +7015,14 @@ static gboolean hal_pause (GstAmlHalAsink * sink)
    * returns correct value
    */
   priv->paused_ = TRUE;
+  t = lock_prof_begin (&priv->lprof);
   ret = priv->stream_->pause(priv->stream_);
+  lock_prof_end (&priv->lprof, "pause", t);
   if (ret)
     GST_WARNING_OBJECT (sink, "pause failure:%d", ret);
 
-  g_mutex_unlock(&priv->feed_lock);
+  FEED_UNLOCK (priv);
+  mix_main_sync (sink);
   GST_INFO_OBJECT (sink, "done");
   return TRUE;
 }
@@ -3757,39 +7032,51 @@ static gboolean hal_stop (GstAmlHalAsink * sink)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
   int ret;
+  gint64 t;
 
   GST_DEBUG_OBJECT (sink, "enter");
   if (!priv->stream_) {
     return FALSE;
   }
 
+  t = lock_prof_begin (&priv->lprof);
   ret = priv->stream_->flush(priv->stream_);
+  lock_prof_end (&priv->lprof, "flush", t);
   if (ret) {
     GST_ERROR_OBJECT (sink, "pause failure:%d", ret);
     return FALSE;
   }
+  /* the flush unbinds hw_av_sync */
+  hal_param_forget (&priv->hparam, priv->stream_);
+
+  if (priv->resampler)
+    pcm_resample_reset (priv->resampler);
 
   /* unblock audio HAL wait */
   if (priv->avsync)
     avs_sync_stop_audio (priv->avsync);
 
-  g_mutex_lock (&priv->feed_lock);
+  FEED_LOCK (priv);
   priv->flushing_ = TRUE;
   g_cond_signal (&priv->run_ready);
+  /* HAL dropped the tail, fade the next data in */
+  priv->pause_fade = PAUSE_FADE_NONE;
+  priv->pcm_fade_req = PCM_FADE_REQ_RESTART;
+  g_cond_signal (&priv->fade_cond);
   GST_DEBUG_OBJECT (sink, "stop");
 
   if (priv->avsync) {
-    void *tmp;
     /* if session is still alive, recover mode for next playback */
     if (priv->sync_mode == AV_SYNC_MODE_PCR_MASTER) {
       GST_INFO_OBJECT(sink, "recover avsync mode");
       av_sync_change_mode (priv->avsync, AV_SYNC_MODE_PCR_MASTER);
     }
-    tmp = priv->avsync;
-    g_atomic_pointer_set (&priv->avsync, NULL);
-    av_sync_destroy (tmp);
+    if (priv->warm_switch)
+      priv->avsync_rearm = TRUE;
+    else
+      avsync_drop (sink);
   }
-  g_mutex_unlock (&priv->feed_lock);
+  FEED_UNLOCK (priv);
 
   return TRUE;
 }
@@ -3925,7 +7212,7 @@ static int parse_bit_stream(GstAmlHalAsink *sink,
 
     if (ac4_toc_parse(data, size, &info)) {
       GST_ERROR_OBJECT (sink, "parse ac4 fail");
-      dump("/tmp/ac4.dat", data, size);
+      dump(sink, "/tmp/ac4_", data, size);
       return -1;
     }
     priv->sample_per_frame = info.samples_per_frame;
@@ -4017,12 +7304,14 @@ static void hw_sync_set_offset(struct hw_sync_header_v2* header, uint32_t offset
   hw_sync_set_header_offset(header->offset, offset);
 }
 
-static void dump(const char* path, const uint8_t *data, int size) {
+static void dump(GstAmlHalAsink *sink, const char* path, const uint8_t *data, int size) {
 #ifdef DUMP_TO_FILE
-    char name[50];
+    char name[128];
     FILE* fd;
 
-    sprintf(name, "%s%d.dat", path, file_index);
+    /* one file set per instance */
+    snprintf(name, sizeof(name), "%s%s_%d.dat", path,
+        GST_OBJECT_NAME (sink), sink->priv->dump_index);
     fd = fopen(name, "ab");
 
     if (!fd)
@@ -4046,27 +7335,17 @@ static void diag_print(GstAmlHalAsink * sink, uint32_t pts_90k)
   }
 }
 
-/* audio gap is for Netflix 2ch AAC, 2/6ch LPCM PCM16_LE are the only cases */
-static void vol_ramp(guchar * data, gint size, gint ch_num, int dir)
+/* audio gap is for Netflix AAC and LPCM PCM16_LE, any channel count
+ * hal_parse_spec takes. Cubic curve comes from the Q15 fade table */
+static void vol_ramp(GstAmlHalAsink * sink, guchar * data, gint size, int dir)
 {
-  int i, ch;
-  int frames = size / 2 / ch_num;
+  GstAmlHalAsinkPrivate *priv = sink->priv;
 
-  int16_t *p = (int16_t *)(data);
+  if (!priv->pcm_proc_used)
+    return;
 
-  if (dir == RAMP_DOWN) {
-    for (i = 0; i < frames; i++) {
-      float t = (float)(i) / frames;
-      for (ch = 0; ch < ch_num; ch++)
-        *p++ *= 1.0f - t * t * t;
-    }
-  } else {
-     for (i = 0; i < frames; i++) {
-      float t = (float)i / frames - 1.0;
-      for (ch = 0; ch < ch_num; ch++)
-        *p++ *= t * t * t + 1;
-    }
-  }
+  pcm_process_ramp (&priv->pcm_proc, (int16_t *)data,
+      size / GST_AUDIO_INFO_BPF (&priv->hal_info), dir == RAMP_UP);
 }
 
 static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
@@ -4086,7 +7365,7 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
   towrite = size;
 
   if (towrite)
-    dump ("/data/asink_", data, towrite);
+    dump (sink, "/data/asink_", data, towrite);
 
   if (priv->format_ == AUDIO_FORMAT_AC4) {
     /* parse sync frame */
@@ -4129,17 +7408,23 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
       }
       cur_size = priv->encoded_size;
     } else if (priv->tempo_used) {
-      cur_size = scaletemp_get_stride(&priv->st);
+      gint stride = scaletemp_get_stride(&priv->st);
+
+      /* whole strides, as many as the chunk size takes */
+      cur_size = stride;
+      if (raw_data && stride > 0 && priv->chunk_size > (guint) stride)
+        cur_size = priv->chunk_size - priv->chunk_size % stride;
       if (cur_size > towrite)
         cur_size = towrite;
-    } else
+    } else {
       cur_size = towrite;
+      if (raw_data && priv->chunk_size && cur_size > priv->chunk_size)
+        cur_size = priv->chunk_size;
+    }
 
     if (priv->format_ == AUDIO_FORMAT_AC4 && !priv->sync_frame) {
-        int32_t ac4_header_len;
-        uint8_t *header;
+        int32_t ac4_header_len = AC4_SYNCFRAME_HEADER_LEN;
 
-        header = ac4_syncframe_header(towrite, &ac4_header_len);
         header_size += ac4_header_len;
 
         if (cur_size > TRANS_DATA_SIZE) {
@@ -4149,7 +7434,7 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
         memcpy(priv->trans_buf + TRANS_DATA_OFFSET,
                 data, cur_size);
         trans_data = priv->trans_buf + TRANS_DATA_OFFSET - ac4_header_len;
-        memcpy(trans_data, header, ac4_header_len);
+        ac4_syncframe_header(trans_data, towrite);
         cur_size += ac4_header_len;
         trans = true;
     }
@@ -4210,13 +7495,19 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
         diag_print (sink, pts_32);
     } else if (raw_data) {
       /* audio hal can not handle too big frame, limit to 8K*/
-      if (cur_size > 8*1024) {
-        cur_size = 8*1024;
+      if (cur_size > MAX_RAW_WRITE_SIZE) {
+        cur_size = MAX_RAW_WRITE_SIZE;
       }
     }
 
     if (trans) {
+      gint64 t = lock_prof_begin (&priv->lprof);
+      gint64 wstart = g_get_monotonic_time ();
+
       written = priv->stream_->write(priv->stream_, trans_data, cur_size);
+      lock_prof_end (&priv->lprof, "write", t);
+      if (raw_data)
+        chunk_update (sink, g_get_monotonic_time () - wstart);
       if (written ==  cur_size)
         written -= header_size;
       else {
@@ -4225,7 +7516,13 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
       }
     } else {
       /* should consume all the PCM data */
+      gint64 t = lock_prof_begin (&priv->lprof);
+      gint64 wstart = g_get_monotonic_time ();
+
       written = priv->stream_->write(priv->stream_, data, cur_size);
+      lock_prof_end (&priv->lprof, "write", t);
+      if (raw_data)
+        chunk_update (sink, g_get_monotonic_time () - wstart);
       if (written < 0) {
         GST_ERROR_OBJECT (sink, "drop data %d/%d", written, cur_size);
         return cur_size;
@@ -4234,6 +7531,8 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
 
     towrite -= written;
     data += written;
+    if (written > 0)
+      startup_mark (sink, STARTUP_FIRST_COMMIT);
 
     GST_LOG_OBJECT (sink,
         "write %d/%d left %d ts: %llu", written, cur_size, towrite, pts_64);
@@ -4242,7 +7541,7 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
     if (priv->direct_mode_ && pts_64 != HAL_INVALID_PTS) {
       if (priv->sr_) {
         if (raw_data) {
-          gint bpf = GST_AUDIO_INFO_BPF (&priv->spec.info);
+          gint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
 
           if (bpf)
             pts_inc = gst_util_uint64_scale_int (written/bpf,
@@ -4266,6 +7565,33 @@ static guint hal_commit (GstAmlHalAsink * sink, guchar * data,
   return size;
 }
 
+/* commit @frames of PCM silence in as few writes as the zero page allows,
+ * returns frames committed before a flush stops it */
+static guint64 hal_commit_silence (GstAmlHalAsink * sink, guint64 frames,
+    guint64 pts_64)
+{
+  GstAmlHalAsinkPrivate *priv = sink->priv;
+  gint bpf = GST_AUDIO_INFO_BPF (&priv->hal_info);
+  gint rate = GST_AUDIO_INFO_RATE (&priv->hal_info);
+  guint64 filled = 0;
+  guint max_frames;
+
+  if (!bpf || !rate)
+    return 0;
+
+  max_frames = SILENCE_BUF_SIZE / bpf;
+  while (filled < frames && !priv->flushing_) {
+    guint n = MIN (frames - filled, max_frames);
+
+    GST_LOG_OBJECT(sink, "PCM silence %u @%" PRId64, n,
+        pts_64 + gst_util_uint64_scale_int (filled, GST_SECOND, rate));
+    hal_commit (sink, (guchar *)pcm_silence, n * bpf,
+        pts_64 + gst_util_uint64_scale_int (filled, GST_SECOND, rate));
+    filled += n;
+  }
+  return filled;
+}
+
 static uint32_t hal_get_latency (GstAmlHalAsink * sink)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
@@ -4289,25 +7615,22 @@ static uint32_t hal_get_latency (GstAmlHalAsink * sink)
 static void hal_set_player_overwrite(GstAmlHalAsink * sink, gboolean defaults)
 {
   GstAmlHalAsinkPrivate *priv = sink->priv;
-  char setting[50];
+  struct hal_param *hp = &priv->hparam;
+  int failed = 0;
 
   if (!priv->hw_dev_)
     return;
-  /*ac4 setting */
-  snprintf(setting, sizeof(setting), "ms12_runtime=-lang %s", defaults ? "DEF" : priv->ac4_lang);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  snprintf(setting, sizeof(setting), "ms12_runtime=-lang2 %s", defaults ? "DEF" : priv->ac4_lang2);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  snprintf(setting, sizeof(setting), "ms12_runtime=-pat %d", defaults ? 255 : priv->ac4_pat);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  snprintf(setting, sizeof(setting), "ms12_runtime=-ac4_pres_group_idx %d", defaults ? -1 : priv->ac4_pres_group_idx);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  snprintf(setting, sizeof(setting), "ms12_runtime=-at %d", defaults ? 255 : priv->ac4_ass_type);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  snprintf(setting, sizeof(setting), "ms12_runtime=-xu %d", defaults ? 255 : priv->ac4_mixer_gain);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
-  snprintf(setting, sizeof(setting), "ms12_runtime=-xa %d", defaults ? 255 : priv->ms12_mix_en);
-  priv->hw_dev_->set_parameters(priv->hw_dev_, setting);
+  /*ac4 setting, one ms12_runtime call for all */
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-lang", "%s", defaults ? "DEF" : priv->ac4_lang);
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-lang2", "%s", defaults ? "DEF" : priv->ac4_lang2);
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-pat", "%d", defaults ? 255 : priv->ac4_pat);
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-ac4_pres_group_idx", "%d", defaults ? -1 : priv->ac4_pres_group_idx);
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-at", "%d", defaults ? 255 : priv->ac4_ass_type);
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-xu", "%d", defaults ? 255 : priv->ac4_mixer_gain);
+  failed |= hal_param_ms12_add (hp, priv->hw_dev_, "-xa", "%d", defaults ? 255 : priv->ms12_mix_en);
+  hal_param_ms12_commit (hp, priv->hw_dev_);
+  if (failed)
+    GST_WARNING_OBJECT (sink, "ms12 option too long, not sent");
 }
 #endif
 
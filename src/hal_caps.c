@@ -0,0 +1,306 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "hal_caps.h"
+
+#define HAL_CAPS_KEYS "sup_formats;sup_sampling_rates;sup_channels"
+#define HAL_CAPS_PORTS 8
+
+static const struct {
+    const char *name;
+    audio_format_t format;
+} format_names[] = {
+    { "AUDIO_FORMAT_PCM_16_BIT", AUDIO_FORMAT_PCM_16_BIT },
+    { "AUDIO_FORMAT_AC3", AUDIO_FORMAT_AC3 },
+    { "AUDIO_FORMAT_E_AC3", AUDIO_FORMAT_E_AC3 },
+    { "AUDIO_FORMAT_AC4", AUDIO_FORMAT_AC4 },
+    { "AUDIO_FORMAT_DOLBY_TRUEHD", AUDIO_FORMAT_DOLBY_TRUEHD },
+    { "AUDIO_FORMAT_DTS", AUDIO_FORMAT_DTS },
+    { "AUDIO_FORMAT_HE_AAC_V2", AUDIO_FORMAT_HE_AAC_V2 },
+    { "AUDIO_FORMAT_PCM_LPCM_DVD", AUDIO_FORMAT_PCM_LPCM_DVD },
+    { "AUDIO_FORMAT_PCM_LPCM_1394", AUDIO_FORMAT_PCM_LPCM_1394 },
+    { "AUDIO_FORMAT_PCM_LPCM_BLURAY", AUDIO_FORMAT_PCM_LPCM_BLURAY },
+};
+
+static const struct {
+    const char *name;
+    int channels;
+} mask_names[] = {
+    { "AUDIO_CHANNEL_OUT_MONO", 1 },
+    { "AUDIO_CHANNEL_OUT_STEREO", 2 },
+    { "AUDIO_CHANNEL_OUT_2POINT1", 3 },
+    { "AUDIO_CHANNEL_OUT_2POINT0POINT2", 4 },
+    { "AUDIO_CHANNEL_OUT_QUAD", 4 },
+    { "AUDIO_CHANNEL_OUT_5POINT1", 6 },
+    { "AUDIO_CHANNEL_OUT_6POINT1", 7 },
+    { "AUDIO_CHANNEL_OUT_7POINT1", 8 },
+};
+
+struct port_entry {
+    audio_devices_t device;
+    int used;
+    int known;                      /* caps valid */
+    int probing;                    /* a probe runs outside g_lock */
+    unsigned int gen;               /* bumped by hal_caps_invalidate */
+    int64_t tried_ms;               /* last failed probe */
+    struct hal_caps caps;
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct port_entry g_ports[HAL_CAPS_PORTS];
+/* streams open in this process, a probe would compete with them */
+static int g_streams;
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* value of @key up to the next ';', length in @len */
+static const char *find_value(const char *reply, const char *key, size_t *len)
+{
+    size_t klen = strlen(key);
+    const char *p = reply;
+
+    while (p && *p) {
+        if (!strncmp(p, key, klen) && p[klen] == '=') {
+            const char *v = p + klen + 1;
+            const char *end = strchr(v, ';');
+
+            *len = end ? (size_t)(end - v) : strlen(v);
+            return v;
+        }
+        p = strchr(p, ';');
+        if (p)
+            p++;
+    }
+    return NULL;
+}
+
+/* calls @fn on each '|' separated item of @v, @len long */
+static void for_each_item(const char *v, size_t len,
+        void (*fn)(struct hal_caps *caps, const char *item, size_t n),
+        struct hal_caps *caps)
+{
+    const char *end = v + len;
+
+    while (v < end) {
+        const char *bar = memchr(v, '|', end - v);
+        size_t n = bar ? (size_t)(bar - v) : (size_t)(end - v);
+
+        if (n)
+            fn(caps, v, n);
+        v += n + 1;
+    }
+}
+
+static int name_is(const char *item, size_t n, const char *name)
+{
+    return strlen(name) == n && !strncmp(item, name, n);
+}
+
+static void add_format(struct hal_caps *caps, const char *item, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (name_is(item, n, format_names[i].name)) {
+            if (caps->n_formats < HAL_CAPS_MAX_FORMATS &&
+                    !hal_caps_has_format(caps, format_names[i].format))
+                caps->formats[caps->n_formats++] = format_names[i].format;
+            return;
+        }
+    }
+}
+
+static void add_rate(struct hal_caps *caps, const char *item, size_t n)
+{
+    char buf[16];
+    long r;
+
+    if (n >= sizeof(buf) || caps->n_rates >= HAL_CAPS_MAX_RATES)
+        return;
+    memcpy(buf, item, n);
+    buf[n] = 0;
+    r = strtol(buf, NULL, 10);
+    if (r > 0)
+        caps->rates[caps->n_rates++] = (uint32_t)r;
+}
+
+static void add_mask(struct hal_caps *caps, const char *item, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(mask_names) / sizeof(mask_names[0]); i++) {
+        if (name_is(item, n, mask_names[i].name)) {
+            if (mask_names[i].channels > caps->max_channels)
+                caps->max_channels = mask_names[i].channels;
+            return;
+        }
+    }
+}
+
+int hal_caps_parse(struct hal_caps *caps, const char *reply)
+{
+    const char *v;
+    size_t len;
+    int found = 0;
+
+    memset(caps, 0, sizeof(*caps));
+    if (!reply)
+        return 0;
+    if ((v = find_value(reply, "sup_formats", &len))) {
+        for_each_item(v, len, add_format, caps);
+        found += caps->n_formats > 0;
+    }
+    if ((v = find_value(reply, "sup_sampling_rates", &len))) {
+        for_each_item(v, len, add_rate, caps);
+        found += caps->n_rates > 0;
+    }
+    if ((v = find_value(reply, "sup_channels", &len))) {
+        for_each_item(v, len, add_mask, caps);
+        found += caps->max_channels > 0;
+    }
+    return found;
+}
+
+int hal_caps_has_format(const struct hal_caps *caps, audio_format_t format)
+{
+    int i;
+
+    for (i = 0; i < caps->n_formats; i++)
+        if (caps->formats[i] == format)
+            return 1;
+    return 0;
+}
+
+/* a plain direct stream only lives for the query */
+static int probe(audio_hw_device_t *dev, audio_devices_t device,
+        struct hal_caps *caps)
+{
+    struct audio_config config;
+    struct audio_stream_out *out = NULL;
+    char *reply;
+    int found;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (dev->open_output_stream(dev, 0, device, AUDIO_OUTPUT_FLAG_DIRECT,
+                &config, &out, NULL) || !out)
+        return -1;
+    reply = out->common.get_parameters(&out->common, HAL_CAPS_KEYS);
+    dev->close_output_stream(dev, out);
+
+    found = hal_caps_parse(caps, reply);
+    free(reply);
+    return found ? 0 : -1;
+}
+
+int hal_caps_get(audio_hw_device_t *dev, audio_devices_t device,
+        struct hal_caps *caps)
+{
+    struct port_entry *e = NULL;
+    struct hal_caps probed;
+    unsigned int gen;
+    int i, ret = -1;
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < HAL_CAPS_PORTS; i++) {
+        if (g_ports[i].used && g_ports[i].device == device) {
+            e = &g_ports[i];
+            break;
+        }
+        if (!g_ports[i].used && !e)
+            e = &g_ports[i];
+    }
+    if (!e)
+        goto out;
+    if (!e->used) {
+        memset(e, 0, sizeof(*e));
+        e->device = device;
+    }
+
+    /* one caller probes, the others go on with what is known */
+    if (!e->known && !e->probing && !g_streams && dev &&
+            (!e->used || now_ms() - e->tried_ms >= HAL_CAPS_RETRY_MS)) {
+        e->used = 1;
+        e->probing = 1;
+        gen = e->gen;
+        pthread_mutex_unlock(&g_lock);
+        ret = probe(dev, device, &probed);
+        pthread_mutex_lock(&g_lock);
+        e->probing = 0;
+        /* an answer from before an invalidate is stale */
+        if (e->gen == gen) {
+            if (!ret) {
+                e->caps = probed;
+                e->known = 1;
+            } else {
+                e->tried_ms = now_ms();
+            }
+        }
+        ret = -1;
+    }
+    if (e->known) {
+        *caps = e->caps;
+        ret = 0;
+    }
+out:
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+void hal_caps_invalidate(audio_devices_t device)
+{
+    int i;
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < HAL_CAPS_PORTS; i++) {
+        if (g_ports[i].used && (device == AUDIO_DEVICE_NONE ||
+                    g_ports[i].device == device)) {
+            g_ports[i].known = 0;
+            g_ports[i].tried_ms = 0;
+            g_ports[i].gen++;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void hal_caps_stream_opened(void)
+{
+    pthread_mutex_lock(&g_lock);
+    g_streams++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void hal_caps_stream_closed(void)
+{
+    pthread_mutex_lock(&g_lock);
+    if (g_streams > 0)
+        g_streams--;
+    pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,65 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef HAL_CAPS_H_
+#define HAL_CAPS_H_
+
+#include <stdint.h>
+#include <audio_if_client.h>
+
+/* What the audio HAL takes on an output port, asked once per process the
+ * way a direct output profile is: open a stream on the port and query
+ * sup_formats, sup_sampling_rates and sup_channels on it. The answer is
+ * taken as the set open_output_stream accepts there. A port HAL did not
+ * answer for is asked again after HAL_CAPS_RETRY_MS, one that changed,
+ * like HDMI after a hotplug, once it is invalidated. Nothing is probed
+ * while any stream of the process is open. */
+
+#define HAL_CAPS_MAX_FORMATS 16
+#define HAL_CAPS_MAX_RATES 16
+#define HAL_CAPS_RETRY_MS 5000
+
+struct hal_caps {
+    int n_formats;                  /* 0 when not reported */
+    audio_format_t formats[HAL_CAPS_MAX_FORMATS];
+    int n_rates;
+    uint32_t rates[HAL_CAPS_MAX_RATES];
+    int max_channels;
+};
+
+/* parse the three lists out of one get_parameters reply, unknown names
+ * are skipped. Returns the number of lists found */
+int hal_caps_parse(struct hal_caps *caps, const char *reply);
+
+/* cached capabilities of @device, probed on @dev when not known yet and
+ * the HAL is idle. Callers asking during a probe do not wait for it.
+ * Returns 0 with @caps filled, -1 when nothing is known */
+int hal_caps_get(audio_hw_device_t *dev, audio_devices_t device,
+        struct hal_caps *caps);
+
+/* forget what is known of @device, all ports for AUDIO_DEVICE_NONE */
+void hal_caps_invalidate(audio_devices_t device);
+
+/* count the streams open in this process, every open_output_stream of
+ * the caller is paired with these */
+void hal_caps_stream_opened(void);
+void hal_caps_stream_closed(void);
+
+int hal_caps_has_format(const struct hal_caps *caps, audio_format_t format);
+
+#endif
@@ -0,0 +1,328 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal_param.h"
+
+#define MS12_KEY "ms12_runtime"
+
+void hal_param_init(struct hal_param *hp)
+{
+    memset(hp, 0, sizeof(*hp));
+    pthread_mutex_init(&hp->lock, NULL);
+}
+
+void hal_param_destroy(struct hal_param *hp)
+{
+    pthread_mutex_destroy(&hp->lock);
+}
+
+void hal_param_forget(struct hal_param *hp, const void *target)
+{
+    int i;
+
+    pthread_mutex_lock(&hp->lock);
+    for (i = 0; i < HAL_PARAM_CACHE_SIZE; i++) {
+        if (!target || hp->cache[i].target == target)
+            hp->cache[i].target = NULL;
+    }
+    if (!target) {
+        hp->ms12_len = 0;
+        hp->ms12_opts = 0;
+    }
+    pthread_mutex_unlock(&hp->lock);
+}
+
+static struct hal_param_entry *lookup(struct hal_param *hp,
+        const void *target, const char *key)
+{
+    int i;
+
+    for (i = 0; i < HAL_PARAM_CACHE_SIZE; i++) {
+        struct hal_param_entry *e = &hp->cache[i];
+
+        if (e->target == target && !strcmp(e->key, key))
+            return e;
+    }
+    return NULL;
+}
+
+static void forget_key(struct hal_param *hp, const void *target,
+        const char *key)
+{
+    struct hal_param_entry *e = lookup(hp, target, key);
+
+    if (e)
+        e->target = NULL;
+}
+
+/* returns 1 when @val is what @target already has */
+static int cached(struct hal_param *hp, const void *target, const char *key,
+        const char *val)
+{
+    struct hal_param_entry *e = lookup(hp, target, key);
+
+    if (e && !strcmp(e->val, val)) {
+        hp->counts.suppressed++;
+        return 1;
+    }
+    return 0;
+}
+
+/* remember @val once @target took it */
+static void remember(struct hal_param *hp, const void *target,
+        const char *key, const char *val)
+{
+    struct hal_param_entry *e = lookup(hp, target, key);
+    int i;
+
+    if (!e) {
+        for (i = 0; i < HAL_PARAM_CACHE_SIZE; i++) {
+            if (!hp->cache[i].target) {
+                e = &hp->cache[i];
+                break;
+            }
+        }
+    }
+    if (!e) {
+        e = &hp->cache[hp->victim];
+        hp->victim = (hp->victim + 1) % HAL_PARAM_CACHE_SIZE;
+    }
+    /* too long to remember exactly, always send */
+    if (strlen(key) >= HAL_PARAM_KEY_MAX || strlen(val) >= HAL_PARAM_VAL_MAX) {
+        e->target = NULL;
+        return;
+    }
+    e->target = target;
+    strcpy(e->key, key);
+    strcpy(e->val, val);
+}
+
+static int send_kv(struct hal_param *hp, audio_hw_device_t *dev,
+        struct audio_stream_out *out, const char *kv)
+{
+    hp->counts.sets++;
+    if (dev)
+        return dev->set_parameters(dev, kv);
+    return out->common.set_parameters(&out->common, kv);
+}
+
+static int vset(struct hal_param *hp, audio_hw_device_t *dev,
+        struct audio_stream_out *out, const char *key, const char *fmt,
+        va_list args)
+{
+    char val[HAL_PARAM_VAL_MAX * 2];
+    char kv[HAL_PARAM_KEY_MAX + sizeof(val) + 1];
+    int ret = 0;
+
+    vsnprintf(val, sizeof(val), fmt, args);
+    snprintf(kv, sizeof(kv), "%s=%s", key, val);
+
+    pthread_mutex_lock(&hp->lock);
+    if (dev) {
+        /* the device is shared with other sinks and HAL itself, what this
+         * sink sent last says nothing about its state */
+        ret = send_kv(hp, dev, NULL, kv);
+    } else if (!cached(hp, out, key, val)) {
+        ret = send_kv(hp, NULL, out, kv);
+        /* a failed send is tried again next time */
+        if (!ret)
+            remember(hp, out, key, val);
+        else
+            forget_key(hp, out, key);
+    }
+    pthread_mutex_unlock(&hp->lock);
+    return ret;
+}
+
+int hal_param_dev_set(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *key, const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    if (!dev)
+        return -1;
+    va_start(args, fmt);
+    ret = vset(hp, dev, NULL, key, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+int hal_param_stream_set(struct hal_param *hp, struct audio_stream_out *out,
+        const char *key, const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    if (!out)
+        return -1;
+    va_start(args, fmt);
+    ret = vset(hp, NULL, out, key, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+int hal_param_dev_cmd(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *kv)
+{
+    int ret;
+
+    if (!dev)
+        return -1;
+    pthread_mutex_lock(&hp->lock);
+    ret = send_kv(hp, dev, NULL, kv);
+    pthread_mutex_unlock(&hp->lock);
+    return ret;
+}
+
+int hal_param_stream_cmd(struct hal_param *hp, struct audio_stream_out *out,
+        const char *kv)
+{
+    int ret;
+
+    if (!out)
+        return -1;
+    pthread_mutex_lock(&hp->lock);
+    ret = send_kv(hp, NULL, out, kv);
+    pthread_mutex_unlock(&hp->lock);
+    return ret;
+}
+
+/* find "key=" at the start of @reply or after a ';' */
+static const char *find_value(const char *reply, const char *key)
+{
+    size_t len = strlen(key);
+    const char *p = reply;
+
+    while (p && *p) {
+        if (!strncmp(p, key, len) && p[len] == '=')
+            return p + len + 1;
+        p = strchr(p, ';');
+        if (p)
+            p++;
+    }
+    return NULL;
+}
+
+int hal_param_dev_get_int(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *key, int *val)
+{
+    const char *v;
+    char *reply, *end;
+    long n;
+    int ret = -1;
+
+    if (!dev)
+        return -1;
+    pthread_mutex_lock(&hp->lock);
+    hp->counts.gets++;
+    pthread_mutex_unlock(&hp->lock);
+
+    reply = dev->get_parameters(dev, key);
+    if (!reply)
+        return -1;
+    v = find_value(reply, key);
+    if (v) {
+        n = strtol(v, &end, 0);
+        if (end != v) {
+            *val = (int)n;
+            ret = 0;
+        }
+    }
+    free(reply);
+    return ret;
+}
+
+/* send and reset the queued options, lock held */
+static int ms12_send(struct hal_param *hp, audio_hw_device_t *dev)
+{
+    char kv[sizeof(MS12_KEY) + HAL_PARAM_MS12_MAX + 1];
+    int ret = 0;
+
+    if (dev && hp->ms12_opts) {
+        snprintf(kv, sizeof(kv), MS12_KEY "=%s", hp->ms12);
+        hp->counts.batched += hp->ms12_opts - 1;
+        ret = send_kv(hp, dev, NULL, kv);
+    }
+    hp->ms12_len = 0;
+    hp->ms12_opts = 0;
+    hp->ms12[0] = '\0';
+    return ret;
+}
+
+/* append " @opt @val" to the queue, 0 when it did not fit */
+static int ms12_append(struct hal_param *hp, const char *opt,
+        const char *val)
+{
+    int n;
+
+    n = snprintf(hp->ms12 + hp->ms12_len,
+            sizeof(hp->ms12) - hp->ms12_len, "%s%s %s",
+            hp->ms12_len ? " " : "", opt, val);
+    if (n <= 0 || hp->ms12_len + n >= sizeof(hp->ms12)) {
+        hp->ms12[hp->ms12_len] = '\0';
+        return 0;
+    }
+    hp->ms12_len += n;
+    hp->ms12_opts++;
+    return 1;
+}
+
+int hal_param_ms12_add(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *opt, const char *fmt, ...)
+{
+    char val[HAL_PARAM_VAL_MAX];
+    va_list args;
+    int ret = 0;
+
+    va_start(args, fmt);
+    vsnprintf(val, sizeof(val), fmt, args);
+    va_end(args);
+
+    pthread_mutex_lock(&hp->lock);
+    if (!ms12_append(hp, opt, val)) {
+        /* full, start a new batch behind what is queued */
+        if (hp->ms12_opts)
+            ms12_send(hp, dev);
+        if (!ms12_append(hp, opt, val))
+            ret = -1;
+    }
+    pthread_mutex_unlock(&hp->lock);
+    return ret;
+}
+
+int hal_param_ms12_commit(struct hal_param *hp, audio_hw_device_t *dev)
+{
+    int ret;
+
+    pthread_mutex_lock(&hp->lock);
+    ret = ms12_send(hp, dev);
+    pthread_mutex_unlock(&hp->lock);
+    return ret;
+}
+
+void hal_param_get_counts(struct hal_param *hp, struct hal_param_counts *c)
+{
+    pthread_mutex_lock(&hp->lock);
+    *c = hp->counts;
+    pthread_mutex_unlock(&hp->lock);
+}
@@ -0,0 +1,103 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef HAL_PARAM_H_
+#define HAL_PARAM_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <audio_if_client.h>
+
+/* Parameter traffic to the audio HAL. State like stream keys remember
+ * what was last sent to each stream and skip sends of the same value, a
+ * failed send is not remembered. The device is shared with other sinks
+ * and HAL itself, so device keys and commands always go out. ms12_runtime
+ * options are collected and sent as one option string, which MS12 parses
+ * as a command line. Every call is counted so the traffic can be seen in
+ * the sink stats. */
+
+#define HAL_PARAM_CACHE_SIZE 24
+#define HAL_PARAM_KEY_MAX 48
+#define HAL_PARAM_VAL_MAX 96
+#define HAL_PARAM_MS12_MAX 256
+
+struct hal_param_entry {
+    const void *target;         /* stream, NULL for a free slot */
+    char key[HAL_PARAM_KEY_MAX];
+    char val[HAL_PARAM_VAL_MAX];
+};
+
+struct hal_param_counts {
+    uint64_t sets;              /* set_parameters calls */
+    uint64_t gets;              /* get_parameters calls */
+    uint64_t suppressed;        /* sends skipped, value unchanged */
+    uint64_t batched;           /* keys folded into another call */
+};
+
+struct hal_param {
+    pthread_mutex_t lock;
+    struct hal_param_entry cache[HAL_PARAM_CACHE_SIZE];
+    int victim;                 /* next slot to reuse when full */
+
+    /* pending ms12_runtime options */
+    char ms12[HAL_PARAM_MS12_MAX];
+    size_t ms12_len;
+    int ms12_opts;
+
+    struct hal_param_counts counts;
+};
+
+void hal_param_init(struct hal_param *hp);
+void hal_param_destroy(struct hal_param *hp);
+
+/* drop what is known about @target, NULL for everything. Use when a stream
+ * is closed or the HAL reloaded, their values are lost with them */
+void hal_param_forget(struct hal_param *hp, const void *target);
+
+/* state like "key=value", printf style value. Stream keys are skipped
+ * when unchanged, device keys always sent. Return what set_parameters
+ * returned, 0 when skipped */
+int hal_param_dev_set(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *key, const char *fmt, ...)
+        __attribute__((format(printf, 4, 5)));
+int hal_param_stream_set(struct hal_param *hp, struct audio_stream_out *out,
+        const char *key, const char *fmt, ...)
+        __attribute__((format(printf, 4, 5)));
+
+/* edge triggered "key=value" commands like gst_pause, always sent */
+int hal_param_dev_cmd(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *kv);
+int hal_param_stream_cmd(struct hal_param *hp, struct audio_stream_out *out,
+        const char *kv);
+
+/* query @key and parse an integer "key=<n>" reply, 0 on success */
+int hal_param_dev_get_int(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *key, int *val);
+
+/* queue ms12_runtime option @opt (e.g. "-lang") with a value.
+ * hal_param_ms12_commit sends all queued in one call. When the queue is
+ * full what it holds is sent to @dev first. Returns -1 when the option
+ * could not be queued at all */
+int hal_param_ms12_add(struct hal_param *hp, audio_hw_device_t *dev,
+        const char *opt, const char *fmt, ...)
+        __attribute__((format(printf, 4, 5)));
+int hal_param_ms12_commit(struct hal_param *hp, audio_hw_device_t *dev);
+
+void hal_param_get_counts(struct hal_param *hp, struct hal_param_counts *c);
+
+#endif
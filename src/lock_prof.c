@@ -0,0 +1,177 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <string.h>
+#include <gst/gst.h>
+#include "lock_prof.h"
+
+static const gchar *lock_names[LOCK_PROF_LOCKS] = {
+  "feed", "object", "cond", "hal"
+};
+
+void
+lock_prof_init (struct lock_prof *lp)
+{
+  memset (lp, 0, sizeof (*lp));
+}
+
+void
+lock_prof_enable (struct lock_prof *lp, gboolean enable)
+{
+  gint i;
+
+  g_atomic_int_set (&lp->enabled, FALSE);
+  if (!enable)
+    return;
+
+  /* site names stay registered, only counters restart */
+  for (i = 0; i < LOCK_PROF_MAX_SITES; i++) {
+    memset (&lp->sites[i].wait, 0, sizeof (lp->sites[i].wait));
+    memset (&lp->sites[i].hold, 0, sizeof (lp->sites[i].hold));
+  }
+  memset (lp->hold_start, 0, sizeof (lp->hold_start));
+  g_atomic_int_set (&lp->enabled, TRUE);
+}
+
+/* lock free lookup/insert, @func is a static string (G_STRFUNC) so
+ * pointer compare is enough. Returns -1 when the table is full */
+gint
+lock_prof_site (struct lock_prof *lp, gint lock, const gchar *func)
+{
+  gint i;
+
+  for (i = 0; i < LOCK_PROF_MAX_SITES; i++) {
+    struct lock_prof_site *s = &lp->sites[i];
+    const gchar *cur = g_atomic_pointer_get (&s->func);
+
+    if (!cur) {
+      /* lock is published before func so readers matching func see it */
+      if (g_atomic_pointer_compare_and_exchange (&s->func, NULL, (gpointer) 1)) {
+        s->lock = lock;
+        g_atomic_pointer_set (&s->func, func);
+        return i;
+      }
+      cur = g_atomic_pointer_get (&s->func);
+    }
+    /* another thread is filling this slot */
+    while (cur == (gpointer) 1)
+      cur = g_atomic_pointer_get (&s->func);
+    if (cur == func && s->lock == lock)
+      return i;
+  }
+  return -1;
+}
+
+void
+lock_prof_add (struct lock_prof_hist *h, gint64 us)
+{
+  guint64 cur;
+  gint b = 0;
+
+  if (us < 0)
+    us = 0;
+  while (b < LOCK_PROF_BUCKETS - 1 && (us >> b))
+    b++;
+
+  __atomic_fetch_add (&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&h->total_us, us, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&h->bucket[b], 1, __ATOMIC_RELAXED);
+  cur = __atomic_load_n (&h->max_us, __ATOMIC_RELAXED);
+  while ((guint64) us > cur &&
+      !__atomic_compare_exchange_n (&h->max_us, &cur, us, TRUE,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* upper edge of the bucket holding the @pct percentile */
+static guint64
+hist_percentile (const struct lock_prof_hist *h, guint pct)
+{
+  guint64 target = (h->count * pct + 99) / 100;
+  guint64 acc = 0;
+  gint b;
+
+  for (b = 0; b < LOCK_PROF_BUCKETS; b++) {
+    acc += h->bucket[b];
+    if (acc >= target)
+      return b ? (G_GUINT64_CONSTANT (1) << b) - 1 : 0;
+  }
+  return h->max_us;
+}
+
+static void
+hist_to_structure (GstStructure *st, const gchar *prefix,
+    const struct lock_prof_hist *h)
+{
+  GString *hist = g_string_new (NULL);
+  gchar *name;
+  gint b;
+
+  for (b = 0; b < LOCK_PROF_BUCKETS; b++)
+    g_string_append_printf (hist, b ? ",%" G_GUINT64_FORMAT : "%" G_GUINT64_FORMAT,
+        h->bucket[b]);
+
+#define SET_U64(field, val) \
+  name = g_strdup_printf ("%s-" field, prefix); \
+  gst_structure_set (st, name, G_TYPE_UINT64, (guint64) (val), NULL); \
+  g_free (name);
+
+  SET_U64 ("count", h->count);
+  SET_U64 ("avg-us", h->count ? h->total_us / h->count : 0);
+  SET_U64 ("p99-us", hist_percentile (h, 99));
+  SET_U64 ("max-us", h->max_us);
+#undef SET_U64
+
+  name = g_strdup_printf ("%s-log2us", prefix);
+  gst_structure_set (st, name, G_TYPE_STRING, hist->str, NULL);
+  g_free (name);
+  g_string_free (hist, TRUE);
+}
+
+/* one nested structure per lock and call site: "feed.hal_start" etc.
+ * Counters are read without stopping writers, close enough for stats */
+GstStructure *
+lock_prof_summary (struct lock_prof *lp)
+{
+  GstStructure *st = gst_structure_new ("lock-profile",
+      "enabled", G_TYPE_BOOLEAN, g_atomic_int_get (&lp->enabled), NULL);
+  gint i;
+
+  for (i = 0; i < LOCK_PROF_MAX_SITES; i++) {
+    struct lock_prof_site *s = &lp->sites[i];
+    const gchar *func = g_atomic_pointer_get (&s->func);
+    GstStructure *site;
+    gchar *name;
+
+    if (!func || func == (gpointer) 1)
+      continue;
+    if (!s->wait.count && !s->hold.count)
+      continue;
+
+    name = g_strdup_printf ("%s.%s", lock_names[s->lock], func);
+    site = gst_structure_new_empty (name);
+    if (s->wait.count)
+      hist_to_structure (site, "wait", &s->wait);
+    if (s->hold.count)
+      hist_to_structure (site, "hold", &s->hold);
+    gst_structure_set (st, name, GST_TYPE_STRUCTURE, site, NULL);
+    gst_structure_free (site);
+    g_free (name);
+  }
+  return st;
+}
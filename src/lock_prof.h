@@ -0,0 +1,165 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef LOCK_PROF_H_
+#define LOCK_PROF_H_
+
+#include <gst/gst.h>
+
+/* Opt-in wait/hold time histograms of sink locks and HAL calls, keyed by
+ * calling function. Disabled cost is one atomic read per lock. */
+
+#define LOCK_PROF_MAX_SITES 64
+/* log2 microsecond buckets, last one is open ended (>= 2^19 us) */
+#define LOCK_PROF_BUCKETS 20
+
+enum lock_prof_lock
+{
+  LOCK_PROF_FEED,       /* priv->feed_lock */
+  LOCK_PROF_OBJECT,     /* GST_OBJECT_LOCK */
+  LOCK_PROF_COND,       /* cond waits on feed_lock, wait only */
+  LOCK_PROF_HAL,        /* HAL calls, hold is call duration */
+  LOCK_PROF_LOCKS
+};
+
+struct lock_prof_hist
+{
+  guint64 count;
+  guint64 total_us;
+  guint64 max_us;
+  guint64 bucket[LOCK_PROF_BUCKETS];
+};
+
+struct lock_prof_site
+{
+  const gchar *func;
+  gint lock;
+  struct lock_prof_hist wait;
+  struct lock_prof_hist hold;
+};
+
+struct lock_prof
+{
+  gint enabled;
+  struct lock_prof_site sites[LOCK_PROF_MAX_SITES];
+
+  /* owner bookkeeping, only written by the thread holding the lock */
+  gint64 hold_start[LOCK_PROF_LOCKS];
+  gint hold_site[LOCK_PROF_LOCKS];
+};
+
+void lock_prof_init (struct lock_prof *lp);
+/* clears histograms, enabling also clears */
+void lock_prof_enable (struct lock_prof *lp, gboolean enable);
+gint lock_prof_site (struct lock_prof *lp, gint lock, const gchar *func);
+void lock_prof_add (struct lock_prof_hist *h, gint64 us);
+GstStructure *lock_prof_summary (struct lock_prof *lp);
+
+static inline void
+lock_prof_lock (struct lock_prof *lp, gint lock, GMutex *m, const gchar *func)
+{
+  gint64 t0, t1;
+  gint site;
+
+  if (!g_atomic_int_get (&lp->enabled)) {
+    g_mutex_lock (m);
+    return;
+  }
+  site = lock_prof_site (lp, lock, func);
+  t0 = g_get_monotonic_time ();
+  g_mutex_lock (m);
+  t1 = g_get_monotonic_time ();
+  lp->hold_start[lock] = t1;
+  lp->hold_site[lock] = site;
+  if (site >= 0)
+    lock_prof_add (&lp->sites[site].wait, t1 - t0);
+}
+
+static inline void
+lock_prof_hold_end (struct lock_prof *lp, gint lock)
+{
+  gint site = lp->hold_site[lock];
+
+  if (lp->hold_start[lock] && site >= 0)
+    lock_prof_add (&lp->sites[site].hold,
+        g_get_monotonic_time () - lp->hold_start[lock]);
+  lp->hold_start[lock] = 0;
+}
+
+static inline void
+lock_prof_unlock (struct lock_prof *lp, gint lock, GMutex *m)
+{
+  if (g_atomic_int_get (&lp->enabled))
+    lock_prof_hold_end (lp, lock);
+  g_mutex_unlock (m);
+}
+
+/* cond wait on a profiled lock: hold time stops while waiting and the
+ * wait is accounted to LOCK_PROF_COND at @func. @end_time < 0 waits
+ * without deadline */
+static inline gboolean
+lock_prof_cond_wait (struct lock_prof *lp, gint lock, GCond *c, GMutex *m,
+    gint64 end_time, const gchar *func)
+{
+  gint64 t0;
+  gint site, hold_site;
+  gboolean ret = TRUE;
+
+  if (!g_atomic_int_get (&lp->enabled)) {
+    if (end_time < 0)
+      g_cond_wait (c, m);
+    else
+      ret = g_cond_wait_until (c, m, end_time);
+    return ret;
+  }
+
+  hold_site = lp->hold_site[lock];
+  lock_prof_hold_end (lp, lock);
+  site = lock_prof_site (lp, LOCK_PROF_COND, func);
+  t0 = g_get_monotonic_time ();
+  if (end_time < 0)
+    g_cond_wait (c, m);
+  else
+    ret = g_cond_wait_until (c, m, end_time);
+  lp->hold_start[lock] = g_get_monotonic_time ();
+  lp->hold_site[lock] = hold_site;
+  if (site >= 0)
+    lock_prof_add (&lp->sites[site].wait, lp->hold_start[lock] - t0);
+  return ret;
+}
+
+/* time a HAL call: t = lock_prof_begin (); call; lock_prof_end (t) */
+static inline gint64
+lock_prof_begin (struct lock_prof *lp)
+{
+  return g_atomic_int_get (&lp->enabled) ? g_get_monotonic_time () : 0;
+}
+
+static inline void
+lock_prof_end (struct lock_prof *lp, const gchar *call, gint64 t0)
+{
+  gint site;
+
+  if (!t0)
+    return;
+  site = lock_prof_site (lp, LOCK_PROF_HAL, call);
+  if (site >= 0)
+    lock_prof_add (&lp->sites[site].hold, g_get_monotonic_time () - t0);
+}
+
+#endif
@@ -27,6 +27,7 @@
 #include <gst/gst.h>
 
 #include "mediasync_wrap.h"
+#include "avsync_sim.h"
 
 
 typedef void* (*MediaSync_create_func)(void);
@@ -67,13 +68,24 @@ static MediaSync_reset_func gMediaSync_reset = NULL;
 static MediaSync_destroy_func gMediaSync_destroy = NULL;
 
 static void* glibHandle = NULL;
-static int gMediasync_init = 0;
+/* set once every symbol resolved, a failed load is tried again by the
+ * next create, loads are serialized by gMediasync_lock */
+static gint gMediasync_init = 0;
+static GMutex gMediasync_lock;
 
-static bool mediasync_wrap_create_init()
+/* the simulation stands in for the library, see avsync_sim.h */
+static void* mediasync_sym(const char *name)
+{
+    if (avsync_sim_enabled())
+        return avsync_sim_mediasync_sym(name);
+    return dlsym(glibHandle, name);
+}
+
+static bool mediasync_wrap_load()
 {
     bool err = false;
 
-    if (glibHandle == NULL) {
+    if (glibHandle == NULL && !avsync_sim_enabled()) {
         glibHandle = dlopen("libmediahal_mediasync.so", RTLD_NOW);
         if (glibHandle == NULL) {
             GST_ERROR("unable to dlopen libmediahal_mediasync.so: %s", dlerror());
@@ -82,97 +94,110 @@ static bool mediasync_wrap_create_init()
     }
 
     gMediaSync_create =
-        (MediaSync_create_func)dlsym(glibHandle, "MediaSync_create");
+        (MediaSync_create_func)mediasync_sym("MediaSync_create");
     if (gMediaSync_create == NULL) {
         GST_ERROR("dlsym MediaSync_create failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_allocInstance =
-        (MediaSync_allocInstance_func)dlsym(glibHandle, "MediaSync_allocInstance");
+        (MediaSync_allocInstance_func)mediasync_sym("MediaSync_allocInstance");
     if (gMediaSync_allocInstance == NULL) {
         GST_ERROR("dlsym MediaSync_allocInstance failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_bindInstance =
-    (MediaSync_bindInstance_func)dlsym(glibHandle, "MediaSync_bindInstance");
+    (MediaSync_bindInstance_func)mediasync_sym("MediaSync_bindInstance");
     if (gMediaSync_bindInstance == NULL) {
         GST_ERROR("dlsym MediaSync_bindInstance failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_setPlaybackRate =
-    (MediaSync_setPlaybackRate_func)dlsym(glibHandle, "MediaSync_setPlaybackRate");
+    (MediaSync_setPlaybackRate_func)mediasync_sym("MediaSync_setPlaybackRate");
     if (gMediaSync_setPlaybackRate == NULL) {
         GST_ERROR("dlsym MediaSync_setPlaybackRate failed, err=%s \n", dlerror());
         return err;
     }
     gMediaSync_getPlaybackRate =
-    (MediaSync_getPlaybackRate_func)dlsym(glibHandle, "MediaSync_getPlaybackRate");
+    (MediaSync_getPlaybackRate_func)mediasync_sym("MediaSync_getPlaybackRate");
     if (gMediaSync_getPlaybackRate == NULL) {
         GST_ERROR("dlsym MediaSync_getPlaybackRate failed, err=%s \n", dlerror());
         return err;
     }
     gMediaSync_getMediaTime =
-        (MediaSync_getMediaTime_func)dlsym(glibHandle, "MediaSync_getMediaTime");
+        (MediaSync_getMediaTime_func)mediasync_sym("MediaSync_getMediaTime");
     if (gMediaSync_getMediaTime == NULL) {
         GST_ERROR("dlsym MediaSync_getMediaTime failed, err=%s \n", dlerror());
         return err;
     }
     gMediaSync_getRealTimeFor =
-    (MediaSync_getRealTimeFor_func)dlsym(glibHandle, "MediaSync_getRealTimeFor");
+    (MediaSync_getRealTimeFor_func)mediasync_sym("MediaSync_getRealTimeFor");
     if (gMediaSync_getRealTimeFor == NULL) {
         GST_ERROR("dlsym MediaSync_getRealTimeFor failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_getRealTimeForNextVsync =
-    (MediaSync_getRealTimeForNextVsync_func)dlsym(glibHandle, "MediaSync_getRealTimeForNextVsync");
+    (MediaSync_getRealTimeForNextVsync_func)mediasync_sym("MediaSync_getRealTimeForNextVsync");
     if (gMediaSync_getRealTimeForNextVsync == NULL) {
         GST_ERROR("dlsym MediaSync_getRealTimeForNextVsync failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_reset =
-    (MediaSync_reset_func)dlsym(glibHandle, "MediaSync_reset");
+    (MediaSync_reset_func)mediasync_sym("MediaSync_reset");
     if (gMediaSync_reset == NULL) {
         GST_ERROR("dlsym MediaSync_reset failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_destroy =
-    (MediaSync_destroy_func)dlsym(glibHandle, "MediaSync_destroy");
+    (MediaSync_destroy_func)mediasync_sym("MediaSync_destroy");
     if (gMediaSync_destroy == NULL) {
         GST_ERROR("dlsym MediaSync_destroy failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_getTrackMediaTime =
-    (MediaSync_getTrackMediaTime_func)dlsym(glibHandle, "MediaSync_getTrackMediaTime");
+    (MediaSync_getTrackMediaTime_func)mediasync_sym("MediaSync_getTrackMediaTime");
     if (gMediaSync_getTrackMediaTime == NULL) {
         GST_ERROR("dlsym MediaSync_destroy failed, err=%s \n", dlerror());
         return err;
     }
 
     gMediaSync_GetMediaTimeByType =
-    (MediaSync_GetMediaTimeByType)dlsym(glibHandle, "MediaSync_GetMediaTimeByType");
+    (MediaSync_GetMediaTimeByType)mediasync_sym("MediaSync_GetMediaTimeByType");
     if (gMediaSync_GetMediaTimeByType == NULL) {
         GST_ERROR("dlsym MediaSync_AudioProcess failed, err=%s\n", dlerror());
         return err;
     }
 
     gMediaSync_audioSwitch =
-    (MediaSync_audioSwitch)dlsym(glibHandle, "MediaSync_audioSwitch");
+    (MediaSync_audioSwitch)mediasync_sym("MediaSync_audioSwitch");
     if (gMediaSync_audioSwitch == NULL) {
         GST_ERROR("dlsym MediaSync_audioSwitch failed, err=%s\n", dlerror());
         return err;
     }
 
-    gMediasync_init = 1;
+    g_atomic_int_set(&gMediasync_init, 1);
     return true;
 }
 
+/* every clock instance gets here, load and resolve until it worked once */
+static bool mediasync_wrap_create_init()
+{
+    bool ok;
+
+    if (g_atomic_int_get(&gMediasync_init))
+        return true;
+    g_mutex_lock(&gMediasync_lock);
+    ok = g_atomic_int_get(&gMediasync_init) || mediasync_wrap_load();
+    g_mutex_unlock(&gMediasync_lock);
+    return ok;
+}
+
 void* mediasync_wrap_create() {
     bool ret = mediasync_wrap_create_init();
     if (!ret) {
@@ -0,0 +1,582 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mock_hal.h"
+#include "avsync_sim.h"
+
+#define MOCK_PARAMS_MAX 32
+#define MOCK_KV_LEN 64
+
+struct mock_opts {
+    uint32_t latency_ms;
+    uint32_t buffer_ms;
+    int block;
+    uint32_t stall_every;
+    uint32_t stall_ms;
+    int ms12;
+};
+
+struct mock_kv {
+    char key[MOCK_KV_LEN];
+    char val[MOCK_KV_LEN];
+};
+
+struct mock_params {
+    pthread_mutex_t lock;
+    int num;
+    struct mock_kv kv[MOCK_PARAMS_MAX];
+};
+
+struct mock_stream {
+    struct audio_stream_out out;    /* must be first */
+    struct mock_dev *dev;
+    struct mock_params params;
+    pthread_mutex_t lock;
+
+    uint32_t rate;
+    audio_format_t format;
+    uint32_t frame_size;            /* bytes per frame */
+
+    /* device model, all in frames */
+    uint64_t written;
+    uint64_t played;                /* consumed up to clock_ref */
+    int64_t clock_ref;              /* us, 0 when not consuming */
+    int paused;
+    uint64_t writes;
+    uint32_t underruns;
+    int underrun;                   /* queue ran dry since last query */
+
+    int sync_session;               /* hw_av_sync id, -1 when not tunneled */
+};
+
+struct mock_dev {
+    audio_hw_device_t hw;           /* must be first */
+    struct mock_opts opts;
+    struct mock_params params;
+    struct mock_stream *stream;
+};
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    /* share the time base so presentation times line up with the sim */
+    if (avsync_sim_enabled())
+        return avsync_sim_now_us();
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void parse_opts(struct mock_opts *o, const char *env)
+{
+    char *dup, *tok, *save = NULL;
+
+    o->latency_ms = 30;
+    o->buffer_ms = 64;
+    o->block = 1;
+    o->stall_every = 0;
+    o->stall_ms = 100;
+    o->ms12 = 0;
+
+    if (!env || !strchr(env, '='))
+        return;
+    dup = strdup(env);
+    if (!dup)
+        return;
+    for (tok = strtok_r(dup, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        long v;
+
+        if (!eq)
+            continue;
+        *eq = 0;
+        v = strtol(eq + 1, NULL, 0);
+        if (v < 0)
+            v = 0;
+        if (!strcmp(tok, "latency"))
+            o->latency_ms = v;
+        else if (!strcmp(tok, "buffer"))
+            o->buffer_ms = v ? v : 1;
+        else if (!strcmp(tok, "block"))
+            o->block = !!v;
+        else if (!strcmp(tok, "stall_every"))
+            o->stall_every = v;
+        else if (!strcmp(tok, "stall_ms"))
+            o->stall_ms = v;
+        else if (!strcmp(tok, "ms12"))
+            o->ms12 = !!v;
+    }
+    free(dup);
+}
+
+/* "k1=v1;k2=v2" as used by set_parameters, last value wins */
+static void params_set(struct mock_params *p, const char *kv_pairs)
+{
+    char *dup, *tok, *save = NULL;
+
+    dup = strdup(kv_pairs);
+    if (!dup)
+        return;
+    pthread_mutex_lock(&p->lock);
+    for (tok = strtok_r(dup, ";", &save); tok; tok = strtok_r(NULL, ";", &save)) {
+        char *eq = strchr(tok, '=');
+        const char *val = "";
+        int i;
+
+        if (eq) {
+            *eq = 0;
+            val = eq + 1;
+        }
+        for (i = 0; i < p->num; i++)
+            if (!strcmp(p->kv[i].key, tok))
+                break;
+        if (i == p->num) {
+            if (p->num == MOCK_PARAMS_MAX)
+                continue;
+            p->num++;
+            snprintf(p->kv[i].key, MOCK_KV_LEN, "%s", tok);
+        }
+        snprintf(p->kv[i].val, MOCK_KV_LEN, "%s", val);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* returns "key=value" or "key=" for unknown keys, caller frees */
+static char * params_get(struct mock_params *p, const char *key)
+{
+    char buf[2 * MOCK_KV_LEN + 2];
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    snprintf(buf, sizeof(buf), "%s=", key);
+    for (i = 0; i < p->num; i++) {
+        if (!strcmp(p->kv[i].key, key)) {
+            snprintf(buf, sizeof(buf), "%s=%s", key, p->kv[i].val);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return strdup(buf);
+}
+
+/* advance the consumption model to now, called with stream lock held */
+static void stream_update(struct mock_stream *s)
+{
+    int64_t now;
+    uint64_t avail, run;
+
+    if (!s->clock_ref)
+        return;
+    now = now_us();
+    run = (uint64_t)(now - s->clock_ref) * s->rate / 1000000;
+    if (!run)
+        return;
+    s->clock_ref += (int64_t)(run * 1000000 / s->rate);
+
+    avail = s->written - s->played;
+    if (run >= avail) {
+        s->played = s->written;
+        /* stays dry until next write restarts the clock */
+        s->clock_ref = 0;
+        if (run > avail) {
+            s->underruns++;
+            s->underrun = 1;
+        }
+    } else {
+        s->played += run;
+    }
+}
+
+static uint32_t stream_get_sample_rate(const struct audio_stream *stream)
+{
+    return ((const struct mock_stream *)stream)->rate;
+}
+
+static int stream_set_parameters(struct audio_stream *stream, const char *kv_pairs)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    params_set(&s->params, kv_pairs);
+    if (!strncmp(kv_pairs, "hw_av_sync=", 11)) {
+        pthread_mutex_lock(&s->lock);
+        s->sync_session = atoi(kv_pairs + 11);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return 0;
+}
+
+static uint64_t rd_be(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+
+    while (n--)
+        v = (v << 8) | *p++;
+    return v;
+}
+
+/* length of the hw sync header v2/v3 in front of tunneled frames, its
+ * pts goes to @pts or UINT64_MAX when there is none */
+static size_t sync_header(const struct mock_stream *s, const uint8_t *buf,
+        size_t bytes, uint64_t *pts)
+{
+    size_t hdr;
+
+    *pts = UINT64_MAX;
+    if (s->sync_session < 0 || bytes < 20 || buf[0] != 0x55 ||
+            buf[1] != 0x55 || buf[2] != 0)
+        return 0;
+    hdr = buf[3] == 3 ? 36 : 20;
+    if (bytes < hdr)
+        return 0;
+    *pts = rd_be(buf + 8, 8);
+    return hdr;
+}
+
+static char * stream_get_parameters(const struct audio_stream *stream,
+        const char *keys)
+{
+    return params_get(&((struct mock_stream *)stream)->params, keys);
+}
+
+static int stream_standby(struct audio_stream *stream)
+{
+    (void)stream;
+    return 0;
+}
+
+static size_t stream_get_buffer_size(const struct audio_stream *stream)
+{
+    const struct mock_stream *s = (const struct mock_stream *)stream;
+
+    return (size_t)s->rate * s->dev->opts.buffer_ms / 1000 * s->frame_size;
+}
+
+static audio_format_t stream_get_format(const struct audio_stream *stream)
+{
+    return ((const struct mock_stream *)stream)->format;
+}
+
+static uint32_t out_get_latency(const struct audio_stream_out *stream)
+{
+    return ((const struct mock_stream *)stream)->dev->opts.latency_ms;
+}
+
+static int out_set_volume(struct audio_stream_out *stream, float left, float right)
+{
+    char kv[64];
+
+    snprintf(kv, sizeof(kv), "volume=%.3f,%.3f", left, right);
+    params_set(&((struct mock_stream *)stream)->params, kv);
+    return 0;
+}
+
+static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
+        size_t bytes)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+    const struct mock_opts *o = &s->dev->opts;
+    uint64_t frames, pts;
+    uint64_t cap = (uint64_t)s->rate * o->buffer_ms / 1000;
+    size_t hdr;
+
+    pthread_mutex_lock(&s->lock);
+    hdr = sync_header(s, buffer, bytes, &pts);
+    frames = (bytes - hdr) / s->frame_size;
+    s->writes++;
+    if (o->stall_every && s->writes % o->stall_every == 0) {
+        pthread_mutex_unlock(&s->lock);
+        usleep(o->stall_ms * 1000);
+        pthread_mutex_lock(&s->lock);
+    }
+
+    for (;;) {
+        uint64_t queued;
+
+        stream_update(s);
+        queued = s->written - s->played;
+        if (!o->block || s->paused || queued + frames <= cap || !queued)
+            break;
+        pthread_mutex_unlock(&s->lock);
+        /* sleep roughly until the overflow has drained */
+        usleep((useconds_t)((queued + frames - cap) * 1000000 / s->rate) + 1000);
+        pthread_mutex_lock(&s->lock);
+    }
+
+    /* UINT64_MAX - 1 is the sink invalid pts marker */
+    if (pts < UINT64_MAX - 1 && avsync_sim_enabled())
+        avsync_sim_audio_pts(s->sync_session, pts, now_us() +
+                (int64_t)((s->written - s->played) * 1000000 / s->rate) +
+                o->latency_ms * 1000);
+    s->written += frames;
+    if (!s->paused && !s->clock_ref)
+        s->clock_ref = now_us();
+    pthread_mutex_unlock(&s->lock);
+    return bytes;
+}
+
+static int out_get_render_position(const struct audio_stream_out *stream,
+        uint32_t *dsp_frames)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    pthread_mutex_lock(&s->lock);
+    stream_update(s);
+    *dsp_frames = (uint32_t)s->played;
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static int out_pause(struct audio_stream_out *stream)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    pthread_mutex_lock(&s->lock);
+    stream_update(s);
+    s->paused = 1;
+    s->clock_ref = 0;
+    pthread_mutex_unlock(&s->lock);
+    if (s->sync_session >= 0 && avsync_sim_enabled())
+        avsync_sim_audio_pause(s->sync_session, 1);
+    return 0;
+}
+
+static int out_resume(struct audio_stream_out *stream)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    pthread_mutex_lock(&s->lock);
+    s->paused = 0;
+    if (s->written > s->played)
+        s->clock_ref = now_us();
+    pthread_mutex_unlock(&s->lock);
+    if (s->sync_session >= 0 && avsync_sim_enabled())
+        avsync_sim_audio_pause(s->sync_session, 0);
+    return 0;
+}
+
+static int out_flush(struct audio_stream_out *stream)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    pthread_mutex_lock(&s->lock);
+    stream_update(s);
+    s->written = s->played;
+    s->clock_ref = 0;
+    pthread_mutex_unlock(&s->lock);
+    if (s->sync_session >= 0 && avsync_sim_enabled())
+        avsync_sim_audio_flush(s->sync_session);
+    return 0;
+}
+
+static int out_get_presentation_position(const struct audio_stream_out *stream,
+        uint64_t *frames, struct timespec *timestamp)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+    uint64_t delay;
+
+    pthread_mutex_lock(&s->lock);
+    stream_update(s);
+    delay = (uint64_t)s->rate * s->dev->opts.latency_ms / 1000;
+    *frames = s->played > delay ? s->played - delay : 0;
+    pthread_mutex_unlock(&s->lock);
+    clock_gettime(CLOCK_MONOTONIC, timestamp);
+    return 0;
+}
+
+static int dev_init_check(const struct audio_hw_device *dev)
+{
+    (void)dev;
+    return 0;
+}
+
+static int dev_set_master_volume(struct audio_hw_device *dev, float volume)
+{
+    char kv[32];
+
+    snprintf(kv, sizeof(kv), "master_volume=%.3f", volume);
+    params_set(&((struct mock_dev *)dev)->params, kv);
+    return 0;
+}
+
+static int dev_set_parameters(struct audio_hw_device *dev, const char *kv_pairs)
+{
+    params_set(&((struct mock_dev *)dev)->params, kv_pairs);
+    return 0;
+}
+
+static char * dev_get_parameters(const struct audio_hw_device *dev,
+        const char *keys)
+{
+    struct mock_dev *d = (struct mock_dev *)dev;
+    struct mock_stream *s = d->stream;
+    char buf[64];
+
+    if (!strcmp(keys, "dolby_ms12_enable")) {
+        snprintf(buf, sizeof(buf), "%s=%d", keys, d->opts.ms12);
+        return strdup(buf);
+    }
+    if (s && (!strcmp(keys, "main_input_underrun") ||
+                !strcmp(keys, "mock_underruns"))) {
+        int val;
+
+        pthread_mutex_lock(&s->lock);
+        stream_update(s);
+        if (!strcmp(keys, "mock_underruns")) {
+            val = s->underruns;
+        } else {
+            /* also dry right now counts, that is what the HAL reports */
+            val = s->underrun || (!s->paused && s->written == s->played);
+            s->underrun = 0;
+        }
+        pthread_mutex_unlock(&s->lock);
+        snprintf(buf, sizeof(buf), "%s=%d", keys, val);
+        return strdup(buf);
+    }
+    return params_get(&d->params, keys);
+}
+
+static uint32_t frame_size(const struct audio_config *config)
+{
+    uint32_t ch = __builtin_popcount(config->channel_mask);
+
+    if (!ch)
+        ch = 2;
+    switch (config->format) {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return ch * 2;
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        return ch * 3;
+    case AUDIO_FORMAT_PCM_32_BIT:
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+    case AUDIO_FORMAT_PCM_FLOAT:
+        return ch * 4;
+    default:
+        /* compressed, pretend IEC61937 stereo 16 bit */
+        return 4;
+    }
+}
+
+static int dev_open_output_stream(struct audio_hw_device *dev,
+        audio_io_handle_t handle, audio_devices_t devices,
+        audio_output_flags_t flags, struct audio_config *config,
+        struct audio_stream_out **stream_out, const char *address)
+{
+    struct mock_dev *d = (struct mock_dev *)dev;
+    struct mock_stream *s;
+
+    (void)handle;
+    (void)devices;
+    (void)flags;
+    (void)address;
+    if (d->stream)
+        return -EBUSY;
+    if (!config->sample_rate || config->sample_rate > 192000)
+        return -EINVAL;
+
+    s = calloc(1, sizeof(*s));
+    if (!s)
+        return -ENOMEM;
+    s->dev = d;
+    s->rate = config->sample_rate;
+    s->format = config->format;
+    s->frame_size = frame_size(config);
+    s->sync_session = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->params.lock, NULL);
+
+    s->out.common.get_sample_rate = stream_get_sample_rate;
+    s->out.common.set_parameters = stream_set_parameters;
+    s->out.common.get_parameters = stream_get_parameters;
+    s->out.common.standby = stream_standby;
+    s->out.common.get_buffer_size = stream_get_buffer_size;
+    s->out.common.get_format = stream_get_format;
+    s->out.get_latency = out_get_latency;
+    s->out.set_volume = out_set_volume;
+    s->out.write = out_write;
+    s->out.get_render_position = out_get_render_position;
+    s->out.pause = out_pause;
+    s->out.resume = out_resume;
+    s->out.flush = out_flush;
+    s->out.get_presentation_position = out_get_presentation_position;
+
+    d->stream = s;
+    *stream_out = &s->out;
+    return 0;
+}
+
+static void dev_close_output_stream(struct audio_hw_device *dev,
+        struct audio_stream_out *stream_out)
+{
+    struct mock_dev *d = (struct mock_dev *)dev;
+    struct mock_stream *s = (struct mock_stream *)stream_out;
+
+    if (!s)
+        return;
+    if (d->stream == s)
+        d->stream = NULL;
+    pthread_mutex_destroy(&s->lock);
+    pthread_mutex_destroy(&s->params.lock);
+    free(s);
+}
+
+int mock_hal_enabled(void)
+{
+    const char *env = getenv("AMLASINK_MOCK_HAL");
+
+    return env && *env && strcmp(env, "0");
+}
+
+int mock_hal_load(audio_hw_device_t **dev)
+{
+    struct mock_dev *d;
+
+    d = calloc(1, sizeof(*d));
+    if (!d)
+        return -ENOMEM;
+    parse_opts(&d->opts, getenv("AMLASINK_MOCK_HAL"));
+    pthread_mutex_init(&d->params.lock, NULL);
+
+    d->hw.init_check = dev_init_check;
+    d->hw.set_master_volume = dev_set_master_volume;
+    d->hw.set_parameters = dev_set_parameters;
+    d->hw.get_parameters = dev_get_parameters;
+    d->hw.open_output_stream = dev_open_output_stream;
+    d->hw.close_output_stream = dev_close_output_stream;
+    *dev = &d->hw;
+    return 0;
+}
+
+void mock_hal_unload(audio_hw_device_t *dev)
+{
+    struct mock_dev *d = (struct mock_dev *)dev;
+
+    if (!d)
+        return;
+    if (d->stream)
+        dev_close_output_stream(dev, &d->stream->out);
+    pthread_mutex_destroy(&d->params.lock);
+    free(d);
+}
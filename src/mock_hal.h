@@ -0,0 +1,48 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef MOCK_HAL_H_
+#define MOCK_HAL_H_
+
+#include <audio_if_client.h>
+
+/* Software stand-in for the audio HAL so the render path can run on a
+ * host without Amlogic hardware. The device consumes written data in real
+ * time at the stream rate and reports positions from that model.
+ *
+ * Enabled by env AMLASINK_MOCK_HAL, either "1" for defaults or a comma
+ * separated option list, e.g. "latency=40,buffer=100,stall_every=200":
+ *   latency=<ms>      get_latency() and presentation delay (default 30)
+ *   buffer=<ms>       device queue, write blocks while full (default 64)
+ *   block=<0|1>       0 accepts every write at once (default 1)
+ *   stall_every=<n>   every n-th write stalls before queueing (default 0)
+ *   stall_ms=<ms>     stall length, longer than buffer gives underrun (100)
+ *   ms12=<0|1>        answer for dolby_ms12_enable (default 0)
+ * Underruns are counted whenever the queue runs dry while running and are
+ * reported by get_parameters("main_input_underrun") and "mock_underruns".
+ * Once "hw_av_sync" is set the pts of hw sync headers is passed on to the
+ * sync simulation at its presentation time, see avsync_sim.h. */
+
+/* nonzero when AMLASINK_MOCK_HAL is set and not "0" */
+int mock_hal_enabled(void);
+
+/* same contract as audio_hw_load_interface/audio_hw_unload_interface */
+int mock_hal_load(audio_hw_device_t **dev);
+void mock_hal_unload(audio_hw_device_t *dev);
+
+#endif
@@ -0,0 +1,238 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "pcm_convert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_CONVERT_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_CONVERT_SSE2
+#endif
+
+/* all kernels truncate toward -inf like a plain shift, float is rounded
+ * to nearest, ties to even as the SIMD converts do, saturated to the S16
+ * range and NaN is 0 */
+
+static inline int16_t sat_s16(int32_t v)
+{
+    if (v > 32767)
+        return 32767;
+    if (v < -32768)
+        return -32768;
+    return (int16_t)v;
+}
+
+static inline int32_t rd_le32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return (int32_t)v;
+}
+
+static inline float rd_lef32(const uint8_t *p)
+{
+    float v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* S24LE packed: no SIMD variant, 3 byte stride does not map to lanes
+ * cheaply; the top two bytes of every sample already are the S16 value */
+static void s24_to_s16(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+
+    for (; i + 4 <= samples; i += 4, src += 12) {
+        dst[i]     = (int16_t)(src[1] | (src[2] << 8));
+        dst[i + 1] = (int16_t)(src[4] | (src[5] << 8));
+        dst[i + 2] = (int16_t)(src[7] | (src[8] << 8));
+        dst[i + 3] = (int16_t)(src[10] | (src[11] << 8));
+    }
+    for (; i < samples; i++, src += 3)
+        dst[i] = (int16_t)(src[1] | (src[2] << 8));
+}
+
+static void s24_32_to_s16_c(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i;
+
+    /* value is sign extended in 32 bits, saturate in case it is not */
+    for (i = 0; i < samples; i++, src += 4)
+        dst[i] = sat_s16(rd_le32(src) >> 8);
+}
+
+static void s32_to_s16_c(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i;
+
+    for (i = 0; i < samples; i++, src += 4)
+        dst[i] = (int16_t)(rd_le32(src) >> 16);
+}
+
+static void f32_to_s16_c(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i;
+
+    for (i = 0; i < samples; i++, src += 4) {
+        float f = rd_lef32(src) * 32768.0f;
+
+        if (isnan(f))
+            dst[i] = 0;
+        else if (f >= 32767.0f)
+            dst[i] = 32767;
+        else if (f <= -32768.0f)
+            dst[i] = -32768;
+        else
+            dst[i] = (int16_t)lrintf(f);
+    }
+}
+
+#if defined(PCM_CONVERT_NEON)
+static void s24_32_to_s16_simd(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= samples; i += 8, src += 32) {
+        int32x4_t a = vreinterpretq_s32_u8(vld1q_u8(src));
+        int32x4_t b = vreinterpretq_s32_u8(vld1q_u8(src + 16));
+
+        vst1q_s16(dst + i, vcombine_s16(vqshrn_n_s32(a, 8), vqshrn_n_s32(b, 8)));
+    }
+    s24_32_to_s16_c(dst + i, src, samples - i);
+}
+
+static void s32_to_s16_simd(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= samples; i += 8, src += 32) {
+        int32x4_t a = vreinterpretq_s32_u8(vld1q_u8(src));
+        int32x4_t b = vreinterpretq_s32_u8(vld1q_u8(src + 16));
+
+        vst1q_s16(dst + i, vcombine_s16(vshrn_n_s32(a, 16), vshrn_n_s32(b, 16)));
+    }
+    s32_to_s16_c(dst + i, src, samples - i);
+}
+
+static void f32_to_s16_simd(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+    const float32x4_t scale = vdupq_n_f32(32768.0f);
+
+    for (; i + 8 <= samples; i += 8, src += 32) {
+        float32x4_t a = vreinterpretq_f32_u8(vld1q_u8(src));
+        float32x4_t b = vreinterpretq_f32_u8(vld1q_u8(src + 16));
+        /* vcvtn rounds to nearest even and saturates to s32, NaN is 0,
+         * vqmovn saturates to s16 */
+#if defined(__aarch64__)
+        int32x4_t ia = vcvtnq_s32_f32(vmulq_f32(a, scale));
+        int32x4_t ib = vcvtnq_s32_f32(vmulq_f32(b, scale));
+#else
+        /* ARMv7 NEON always rounds to nearest even, adding and taking
+         * away 1.5 * 2^23 leaves the clamped value an exact integer.
+         * vcvt truncates that and makes NaN 0 */
+        const float32x4_t hi = vdupq_n_f32(32767.0f);
+        const float32x4_t lo = vdupq_n_f32(-32768.0f);
+        const float32x4_t magic = vdupq_n_f32(12582912.0f);
+        float32x4_t sa = vmaxq_f32(vminq_f32(vmulq_f32(a, scale), hi), lo);
+        float32x4_t sb = vmaxq_f32(vminq_f32(vmulq_f32(b, scale), hi), lo);
+        int32x4_t ia = vcvtq_s32_f32(vsubq_f32(vaddq_f32(sa, magic), magic));
+        int32x4_t ib = vcvtq_s32_f32(vsubq_f32(vaddq_f32(sb, magic), magic));
+#endif
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(ia), vqmovn_s32(ib)));
+    }
+    f32_to_s16_c(dst + i, src, samples - i);
+}
+#elif defined(PCM_CONVERT_SSE2)
+static void s24_32_to_s16_simd(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= samples; i += 8, src += 32) {
+        __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)src), 8);
+        __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 16)), 8);
+
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+    s24_32_to_s16_c(dst + i, src, samples - i);
+}
+
+static void s32_to_s16_simd(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= samples; i += 8, src += 32) {
+        /* arithmetic shift keeps the value in s16 range, packs never clips */
+        __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)src), 16);
+        __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 16)), 16);
+
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+    s32_to_s16_c(dst + i, src, samples - i);
+}
+
+static void f32_to_s16_simd(int16_t *dst, const uint8_t *src, uint32_t samples)
+{
+    uint32_t i = 0;
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+
+    for (; i + 8 <= samples; i += 8, src += 32) {
+        /* clamp first, cvtps2dq returns 0x80000000 on overflow and NaN.
+         * NaN is zeroed before, min_ps would make it 32767 */
+        __m128 a = _mm_mul_ps(_mm_loadu_ps((const float *)src), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps((const float *)(src + 16)), scale);
+
+        a = _mm_and_ps(a, _mm_cmpord_ps(a, a));
+        b = _mm_and_ps(b, _mm_cmpord_ps(b, b));
+        a = _mm_max_ps(_mm_min_ps(a, hi), lo);
+        b = _mm_max_ps(_mm_min_ps(b, hi), lo);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    f32_to_s16_c(dst + i, src, samples - i);
+}
+#else
+#define s24_32_to_s16_simd s24_32_to_s16_c
+#define s32_to_s16_simd s32_to_s16_c
+#define f32_to_s16_simd f32_to_s16_c
+#endif
+
+pcm_convert_func pcm_convert_get(enum pcm_fmt fmt)
+{
+    switch (fmt) {
+    case PCM_FMT_S24LE:
+        return s24_to_s16;
+    case PCM_FMT_S24_32LE:
+        return s24_32_to_s16_simd;
+    case PCM_FMT_S32LE:
+        return s32_to_s16_simd;
+    case PCM_FMT_F32LE:
+        return f32_to_s16_simd;
+    default:
+        return NULL;
+    }
+}
@@ -0,0 +1,42 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef PCM_CONVERT_H_
+#define PCM_CONVERT_H_
+
+#include <stdint.h>
+
+/* interleaved little endian PCM layouts accepted on the sink pad */
+enum pcm_fmt {
+    PCM_FMT_S16LE,
+    PCM_FMT_S24LE,      /* 3 bytes packed */
+    PCM_FMT_S24_32LE,   /* 24 bits in the low bytes of 32 */
+    PCM_FMT_S32LE,
+    PCM_FMT_F32LE,
+    PCM_FMT_INVALID
+};
+
+/* convert @samples (frames * channels) from @src to S16LE in @dst.
+ * @dst and @src must not overlap */
+typedef void (*pcm_convert_func) (int16_t *dst, const uint8_t *src,
+        uint32_t samples);
+
+/* best kernel for this CPU, NULL for S16LE (no conversion) and invalid */
+pcm_convert_func pcm_convert_get(enum pcm_fmt fmt);
+
+#endif
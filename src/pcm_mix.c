@@ -0,0 +1,142 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdint.h>
+#include <math.h>
+#include "pcm_mix.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_MIX_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_MIX_SSE2
+#endif
+
+static inline int16_t sat_s16(int32_t v)
+{
+    if (v > 32767)
+        return 32767;
+    if (v < -32768)
+        return -32768;
+    return (int16_t)v;
+}
+
+void pcm_mix_add(int16_t *dst, const int16_t *src, int16_t dst_gain,
+        int16_t src_gain, uint32_t n)
+{
+    uint32_t i = 0;
+
+#if defined(PCM_MIX_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t d = vld1q_s16(dst + i);
+        int16x8_t s = vld1q_s16(src + i);
+        int32x4_t lo = vmull_n_s16(vget_low_s16(d), dst_gain);
+        int32x4_t hi = vmull_n_s16(vget_high_s16(d), dst_gain);
+
+        lo = vmlal_n_s16(lo, vget_low_s16(s), src_gain);
+        hi = vmlal_n_s16(hi, vget_high_s16(s), src_gain);
+        vst1q_s16(dst + i, vcombine_s16(vqrshrn_n_s32(lo, 14),
+                vqrshrn_n_s32(hi, 14)));
+    }
+#elif defined(PCM_MIX_SSE2)
+    {
+        /* pairs of (dst, src) samples against (dst_gain, src_gain) */
+        const __m128i g = _mm_set1_epi32(((int32_t)src_gain << 16) |
+                (uint16_t)dst_gain);
+        const __m128i round = _mm_set1_epi32(1 << 13);
+
+        for (; i + 8 <= n; i += 8) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(d, s), g);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(d, s), g);
+
+            lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 14);
+            hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 14);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+        }
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = sat_s16((dst[i] * dst_gain + src[i] * src_gain +
+                    (1 << 13)) >> 14);
+}
+
+void pcm_mix_scale(int16_t *data, int ch, uint32_t frames, int16_t from,
+        int16_t to)
+{
+    int32_t step, g;
+    uint32_t f;
+    int c;
+
+    if (!frames)
+        return;
+    if (from == to) {
+        pcm_mix_add(data, data, from, 0, frames * ch);
+        return;
+    }
+    /* Q16 gain position, whole frames share one gain */
+    step = (int32_t)(((int64_t)(to - from) << 16) / (int32_t)frames);
+    g = (int32_t)from << 16;
+    for (f = 0; f < frames; f++, g += step) {
+        int32_t gf = g >> 16;
+
+        for (c = 0; c < ch; c++, data++)
+            *data = sat_s16((*data * gf + (1 << 13)) >> 14);
+    }
+}
+
+void pcm_mix_spread(int16_t *dst, int dst_ch, const int16_t *src, int src_ch,
+        const int16_t *gain, uint32_t frames)
+{
+    uint32_t f;
+    int c;
+
+    if (src_ch == 1 && dst_ch == 2) {
+        /* the common mono description onto a stereo mix */
+        for (f = 0; f < frames; f++) {
+            dst[2 * f] = sat_s16((src[f] * gain[0] + (1 << 13)) >> 14);
+            dst[2 * f + 1] = sat_s16((src[f] * gain[1] + (1 << 13)) >> 14);
+        }
+        return;
+    }
+
+    for (f = 0; f < frames; f++) {
+        for (c = 0; c < dst_ch; c++) {
+            int32_t v = 0;
+
+            if (src_ch == 1)
+                v = src[0] * gain[c];
+            else if (c < src_ch)
+                v = src[c] * gain[c];
+            dst[c] = sat_s16((v + (1 << 13)) >> 14);
+        }
+        dst += dst_ch;
+        src += src_ch;
+    }
+}
+
+int16_t pcm_mix_gain_db(double db)
+{
+    double g = pow(10.0, db / 20.0) * PCM_MIX_UNITY;
+
+    if (g >= PCM_MIX_GAIN_MAX)
+        return PCM_MIX_GAIN_MAX;
+    return (int16_t)lrint(g);
+}
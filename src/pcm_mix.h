@@ -0,0 +1,48 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef PCM_MIX_H_
+#define PCM_MIX_H_
+
+#include <stdint.h>
+
+#define PCM_MIX_MAX_CH 8
+/* Q14 gain, leaves room for up to +6 dB */
+#define PCM_MIX_UNITY 16384
+#define PCM_MIX_GAIN_MAX 32767
+
+/* dst = sat(dst * dst_gain + src * src_gain) over @n interleaved S16
+ * samples, gains in Q14 */
+void pcm_mix_add(int16_t *dst, const int16_t *src, int16_t dst_gain,
+        int16_t src_gain, uint32_t n);
+
+/* scale @frames of @ch channel PCM in place by a Q14 gain going linearly
+ * from @from to @to across the block */
+void pcm_mix_scale(int16_t *data, int ch, uint32_t frames, int16_t from,
+        int16_t to);
+
+/* lay out @frames of @src_ch channel PCM as @dst_ch channels, output
+ * channel c takes gain[c] of input channel c, or of the only channel for
+ * mono input. Channels the input does not have come out silent */
+void pcm_mix_spread(int16_t *dst, int dst_ch, const int16_t *src, int src_ch,
+        const int16_t *gain, uint32_t frames);
+
+/* Q14 gain for @db, clamped to PCM_MIX_GAIN_MAX */
+int16_t pcm_mix_gain_db(double db);
+
+#endif
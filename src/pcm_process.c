@@ -0,0 +1,427 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdint.h>
+#include <string.h>
+#include "pcm_process.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_PROCESS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_PROCESS_SSE2
+#endif
+
+/* frames of gain computed per round */
+#define BLOCK_FRAMES 256
+
+#define FADE_LUT_BITS 8
+#define FADE_LUT_SIZE (1 << FADE_LUT_BITS)
+#define FADE_POS_END ((uint32_t)FADE_LUT_SIZE << 16)
+
+/* 1 - t^3 in Q15, fade in walks it backwards: 1 - (1 - t)^3 */
+static const uint16_t fade_lut[FADE_LUT_SIZE + 1] = {
+    32768, 32768, 32768, 32768, 32768, 32768, 32768, 32767, 32767, 32767,
+    32766, 32765, 32765, 32764, 32763, 32761, 32760, 32758, 32757, 32755,
+    32752, 32750, 32747, 32744, 32741, 32737, 32734, 32730, 32725, 32720,
+    32715, 32710, 32704, 32698, 32691, 32684, 32677, 32669, 32661, 32652,
+    32643, 32633, 32623, 32613, 32602, 32590, 32578, 32565, 32552, 32538,
+    32524, 32509, 32493, 32477, 32460, 32443, 32425, 32406, 32387, 32367,
+    32346, 32325, 32303, 32280, 32256, 32232, 32206, 32181, 32154, 32126,
+    32098, 32069, 32039, 32008, 31977, 31944, 31911, 31876, 31841, 31805,
+    31768, 31730, 31691, 31651, 31610, 31569, 31526, 31482, 31437, 31391,
+    31344, 31296, 31247, 31197, 31146, 31093, 31040, 30985, 30930, 30873,
+    30815, 30756, 30695, 30634, 30571, 30507, 30442, 30375, 30308, 30239,
+    30168, 30097, 30024, 29950, 29874, 29798, 29719, 29640, 29559, 29477,
+    29393, 29308, 29221, 29133, 29044, 28953, 28861, 28767, 28672, 28575,
+    28477, 28377, 28276, 28173, 28069, 27963, 27855, 27746, 27635, 27523,
+    27409, 27293, 27176, 27057, 26936, 26814, 26690, 26564, 26436, 26307,
+    26176, 26043, 25909, 25773, 25635, 25495, 25353, 25210, 25064, 24917,
+    24768, 24617, 24464, 24310, 24153, 23994, 23834, 23671, 23507, 23341,
+    23172, 23002, 22830, 22655, 22479, 22300, 22120, 21937, 21753, 21566,
+    21377, 21186, 20993, 20798, 20601, 20402, 20200, 19996, 19790, 19582,
+    19372, 19159, 18944, 18727, 18507, 18286, 18062, 17836, 17607, 17376,
+    17143, 16907, 16670, 16429, 16187, 15942, 15694, 15444, 15192, 14937,
+    14680, 14420, 14158, 13894, 13627, 13357, 13085, 12810, 12533, 12253,
+    11971, 11686, 11399, 11109, 10816, 10521, 10223, 9922, 9619, 9313,
+    9004, 8693, 8379, 8062, 7743, 7421, 7096, 6768, 6437, 6104,
+    5768, 5429, 5087, 4743, 4395, 4045, 3692, 3336, 2977, 2615,
+    2250, 1883, 1512, 1139, 762, 383, 0,
+};
+
+static inline int16_t mul_q15(int16_t x, int16_t g)
+{
+    return (int16_t)((x * g + (1 << 14)) >> 15);
+}
+
+#if defined(PCM_PROCESS_NEON)
+typedef int16x8_t vs16;
+#define VLOAD(p) vld1q_s16(p)
+#define VSTORE(p, v) vst1q_s16(p, v)
+#define VDUP(g) vdupq_n_s16(g)
+/* (x * g + 2^14) >> 15, same rounding as mul_q15 */
+#define VMUL(x, g) vqrdmulhq_s16(x, g)
+
+static inline vs16 gvec_2(const int16_t *g)
+{
+    int16x4_t v = vld1_s16(g);
+    int16x4x2_t z = vzip_s16(v, v);
+
+    return vcombine_s16(z.val[0], z.val[1]);
+}
+
+static inline vs16 gvec_4(const int16_t *g)
+{
+    return vcombine_s16(vdup_n_s16(g[0]), vdup_n_s16(g[1]));
+}
+#elif defined(PCM_PROCESS_SSE2)
+typedef __m128i vs16;
+#define VLOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define VSTORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define VDUP(g) _mm_set1_epi16(g)
+
+/* no pmulhrsw before SSSE3, widen and round by hand */
+static inline vs16 VMUL(vs16 x, vs16 g)
+{
+    const __m128i r = _mm_set1_epi32(1 << 14);
+    __m128i lo = _mm_mullo_epi16(x, g);
+    __m128i hi = _mm_mulhi_epi16(x, g);
+    __m128i a = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), r);
+    __m128i b = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), r);
+
+    return _mm_packs_epi32(_mm_srai_epi32(a, 15), _mm_srai_epi32(b, 15));
+}
+
+static inline vs16 gvec_2(const int16_t *g)
+{
+    __m128i v = _mm_loadl_epi64((const __m128i *)g);
+
+    return _mm_unpacklo_epi16(v, v);
+}
+
+static inline vs16 gvec_4(const int16_t *g)
+{
+    return _mm_set_epi16(g[1], g[1], g[1], g[1], g[0], g[0], g[0], g[0]);
+}
+#endif
+
+#define gvec_1(g) VLOAD(g)
+#define gvec_8(g) VDUP((g)[0])
+
+/* gain only, samples stay in place */
+#define DEFINE_GAIN_KERNEL_C(n) \
+static void gain_##n(const struct pcm_process *pp, int16_t *data, \
+        const int16_t *gain, uint32_t frames) \
+{ \
+    uint32_t i; \
+    int c; \
+    (void)pp; \
+    for (i = 0; i < frames; i++, data += n) \
+        for (c = 0; c < n; c++) \
+            data[c] = mul_q15(data[c], gain[i]); \
+}
+
+/* one vector is 8 samples, 8 / n frames */
+#define DEFINE_GAIN_KERNEL_SIMD(n) \
+static void gain_##n(const struct pcm_process *pp, int16_t *data, \
+        const int16_t *gain, uint32_t frames) \
+{ \
+    uint32_t i = 0; \
+    int c; \
+    (void)pp; \
+    for (; i + 8 / n <= frames; i += 8 / n, data += 8) \
+        VSTORE(data, VMUL(VLOAD(data), gvec_##n(gain + i))); \
+    for (; i < frames; i++, data += n) \
+        for (c = 0; c < n; c++) \
+            data[c] = mul_q15(data[c], gain[i]); \
+}
+
+/* channel remap and gain, @gain NULL for unity */
+#define DEFINE_REMAP_KERNEL(n) \
+static void remap_##n(const struct pcm_process *pp, int16_t *data, \
+        const int16_t *gain, uint32_t frames) \
+{ \
+    int16_t f[n]; \
+    uint32_t i; \
+    int c; \
+    for (i = 0; i < frames; i++, data += n) { \
+        memcpy(f, data, sizeof(f)); \
+        if (gain) { \
+            for (c = 0; c < n; c++) \
+                data[c] = mul_q15(f[pp->map[c]], gain[i]); \
+        } else { \
+            for (c = 0; c < n; c++) \
+                data[c] = f[pp->map[c]]; \
+        } \
+    } \
+}
+
+#if defined(PCM_PROCESS_NEON) || defined(PCM_PROCESS_SSE2)
+DEFINE_GAIN_KERNEL_SIMD(1)
+DEFINE_GAIN_KERNEL_SIMD(2)
+DEFINE_GAIN_KERNEL_SIMD(4)
+DEFINE_GAIN_KERNEL_SIMD(8)
+#else
+DEFINE_GAIN_KERNEL_C(1)
+DEFINE_GAIN_KERNEL_C(2)
+DEFINE_GAIN_KERNEL_C(4)
+DEFINE_GAIN_KERNEL_C(8)
+#endif
+DEFINE_GAIN_KERNEL_C(3)
+DEFINE_GAIN_KERNEL_C(5)
+DEFINE_GAIN_KERNEL_C(6)
+DEFINE_GAIN_KERNEL_C(7)
+
+DEFINE_REMAP_KERNEL(2)
+DEFINE_REMAP_KERNEL(3)
+DEFINE_REMAP_KERNEL(4)
+DEFINE_REMAP_KERNEL(5)
+DEFINE_REMAP_KERNEL(6)
+DEFINE_REMAP_KERNEL(7)
+DEFINE_REMAP_KERNEL(8)
+
+static const pcm_process_kernel gain_kernels[PCM_PROCESS_MAX_CH + 1] = {
+    NULL, gain_1, gain_2, gain_3, gain_4, gain_5, gain_6, gain_7, gain_8
+};
+
+static const pcm_process_kernel remap_kernels[PCM_PROCESS_MAX_CH + 1] = {
+    NULL, NULL, remap_2, remap_3, remap_4, remap_5, remap_6, remap_7, remap_8
+};
+
+static void update_target(struct pcm_process *pp)
+{
+    int32_t target = pp->mute ? 0 : pp->volume;
+
+    if (target == pp->target)
+        return;
+    pp->target = target;
+    pp->gain_step = ((target << 8) - pp->gain) / (int32_t)pp->smooth_frames;
+    if (!pp->gain_step)
+        pp->gain = target << 8;
+}
+
+int pcm_process_setup(struct pcm_process *pp, int channels, const int *map,
+        uint32_t smooth_frames)
+{
+    int i;
+
+    if (channels <= 0 || channels > PCM_PROCESS_MAX_CH)
+        return -1;
+
+    memset(pp, 0, sizeof(*pp));
+    pp->channels = channels;
+    for (i = 0; i < channels; i++) {
+        pp->map[i] = map ? map[i] : i;
+        if (pp->map[i] != i)
+            pp->remap = 1;
+    }
+    pp->kernel = pp->remap ? remap_kernels[channels] : gain_kernels[channels];
+    pp->smooth_frames = smooth_frames ? smooth_frames : 1;
+    pp->volume = PCM_PROCESS_UNITY;
+    pp->target = PCM_PROCESS_UNITY;
+    pp->gain = PCM_PROCESS_UNITY << 8;
+    pp->fade = PCM_FADE_NONE;
+    return 0;
+}
+
+void pcm_process_set_volume(struct pcm_process *pp, int32_t volume)
+{
+    if (volume < 0)
+        volume = 0;
+    if (volume > PCM_PROCESS_UNITY)
+        volume = PCM_PROCESS_UNITY;
+    pp->volume = volume;
+    update_target(pp);
+}
+
+void pcm_process_set_mute(struct pcm_process *pp, int mute)
+{
+    pp->mute = !!mute;
+    update_target(pp);
+}
+
+void pcm_process_reset_gain(struct pcm_process *pp)
+{
+    pp->gain = pp->target << 8;
+    pp->gain_step = 0;
+}
+
+void pcm_process_set_silent(struct pcm_process *pp)
+{
+    pp->fade = PCM_FADE_SILENT;
+    pp->fade_pos = 0;
+}
+
+void pcm_process_fade(struct pcm_process *pp, int fade_in, uint32_t frames)
+{
+    uint32_t step = frames ? FADE_POS_END / frames : FADE_POS_END;
+
+    if (!step)
+        step = 1;
+
+    if (fade_in) {
+        switch (pp->fade) {
+        case PCM_FADE_NONE:
+        case PCM_FADE_IN:
+            return;
+        case PCM_FADE_OUT:
+            /* turn around at the current level */
+            pp->fade_pos = FADE_POS_END - pp->fade_pos;
+            break;
+        case PCM_FADE_SILENT:
+            pp->fade_pos = 0;
+            break;
+        }
+        pp->fade = PCM_FADE_IN;
+    } else {
+        switch (pp->fade) {
+        case PCM_FADE_OUT:
+        case PCM_FADE_SILENT:
+            return;
+        case PCM_FADE_IN:
+            pp->fade_pos = FADE_POS_END - pp->fade_pos;
+            break;
+        case PCM_FADE_NONE:
+            pp->fade_pos = 0;
+            break;
+        }
+        pp->fade = PCM_FADE_OUT;
+    }
+    pp->fade_step = step;
+}
+
+uint32_t pcm_process_fade_left(const struct pcm_process *pp)
+{
+    if (pp->fade != PCM_FADE_OUT || !pp->fade_step)
+        return 0;
+    return (FADE_POS_END - pp->fade_pos + pp->fade_step - 1) / pp->fade_step;
+}
+
+int pcm_process_active(const struct pcm_process *pp)
+{
+    return pp->remap || pp->fade != PCM_FADE_NONE ||
+        pp->gain != (PCM_PROCESS_UNITY << 8) ||
+        pp->target != PCM_PROCESS_UNITY;
+}
+
+static inline int32_t fade_level(uint32_t pos)
+{
+    uint32_t idx = pos >> 16;
+    int32_t a, b;
+
+    if (idx >= FADE_LUT_SIZE)
+        return fade_lut[FADE_LUT_SIZE];
+    a = fade_lut[idx];
+    b = fade_lut[idx + 1];
+    return a + (int32_t)(((int64_t)(b - a) * (pos & 0xffff)) >> 16);
+}
+
+/* per frame Q15 gain of volume ramp times fade curve, returns nonzero when
+ * every frame is unity */
+static int fill_gain(struct pcm_process *pp, int16_t *gain, uint32_t frames)
+{
+    int unity = 1;
+    uint32_t i;
+
+    for (i = 0; i < frames; i++) {
+        int32_t g = pp->gain >> 8;
+        int32_t f;
+
+        if (pp->gain_step) {
+            pp->gain += pp->gain_step;
+            if ((pp->gain_step > 0 && pp->gain >= (pp->target << 8)) ||
+                (pp->gain_step < 0 && pp->gain <= (pp->target << 8))) {
+                pp->gain = pp->target << 8;
+                pp->gain_step = 0;
+            }
+        }
+
+        switch (pp->fade) {
+        case PCM_FADE_OUT:
+            f = fade_level(pp->fade_pos);
+            pp->fade_pos += pp->fade_step;
+            if (pp->fade_pos >= FADE_POS_END)
+                pp->fade = PCM_FADE_SILENT;
+            break;
+        case PCM_FADE_IN:
+            f = fade_level(FADE_POS_END - pp->fade_pos);
+            pp->fade_pos += pp->fade_step;
+            if (pp->fade_pos >= FADE_POS_END)
+                pp->fade = PCM_FADE_NONE;
+            break;
+        case PCM_FADE_SILENT:
+            f = 0;
+            break;
+        default:
+            f = PCM_PROCESS_UNITY;
+            break;
+        }
+
+        if (f != PCM_PROCESS_UNITY)
+            g = (g * f + (1 << 14)) >> 15;
+        if (g != PCM_PROCESS_UNITY)
+            unity = 0;
+        /* int16 can not hold unity, one LSB off only while ramping */
+        gain[i] = g >= PCM_PROCESS_UNITY ? PCM_PROCESS_UNITY - 1 : g;
+    }
+    return unity;
+}
+
+void pcm_process_ramp(const struct pcm_process *pp, int16_t *data,
+        uint32_t frames, int fade_in)
+{
+    pcm_process_kernel kernel = gain_kernels[pp->channels];
+    int16_t gain[BLOCK_FRAMES];
+    uint32_t step, pos = 0;
+
+    if (!frames)
+        return;
+    step = FADE_POS_END / frames;
+
+    while (frames) {
+        uint32_t n = frames > BLOCK_FRAMES ? BLOCK_FRAMES : frames;
+        uint32_t i;
+
+        for (i = 0; i < n; i++, pos += step) {
+            int32_t g = fade_level(fade_in ? FADE_POS_END - pos : pos);
+
+            gain[i] = g >= PCM_PROCESS_UNITY ? PCM_PROCESS_UNITY - 1 : g;
+        }
+        kernel(pp, data, gain, n);
+        data += n * pp->channels;
+        frames -= n;
+    }
+}
+
+void pcm_process_run(struct pcm_process *pp, int16_t *data, uint32_t frames)
+{
+    int16_t gain[BLOCK_FRAMES];
+
+    while (frames && pcm_process_active(pp)) {
+        uint32_t n = frames > BLOCK_FRAMES ? BLOCK_FRAMES : frames;
+        int unity = fill_gain(pp, gain, n);
+
+        if (!unity)
+            pp->kernel(pp, data, gain, n);
+        else if (pp->remap)
+            pp->kernel(pp, data, NULL, n);
+        data += n * pp->channels;
+        frames -= n;
+    }
+}
@@ -0,0 +1,90 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef PCM_PROCESS_H_
+#define PCM_PROCESS_H_
+
+#include <stdint.h>
+
+#define PCM_PROCESS_MAX_CH 8
+/* Q15 unity gain */
+#define PCM_PROCESS_UNITY 32768
+
+enum pcm_fade {
+    PCM_FADE_NONE,      /* pass through */
+    PCM_FADE_OUT,       /* ramping to silence */
+    PCM_FADE_SILENT,    /* fade out done, hold silence */
+    PCM_FADE_IN,        /* ramping back to unity */
+};
+
+struct pcm_process;
+typedef void (*pcm_process_kernel) (const struct pcm_process *pp,
+        int16_t *data, const int16_t *gain, uint32_t frames);
+
+/* in place post processing of interleaved S16 PCM right before it goes to
+ * HAL: smoothed gain, mute, fade curves and channel remap in one pass */
+struct pcm_process {
+    int channels;
+    int remap;                      /* map is not identity */
+    int map[PCM_PROCESS_MAX_CH];    /* output channel i takes input map[i] */
+    pcm_process_kernel kernel;      /* picked by channel count */
+
+    /* gain in Q23 so small steps do not vanish, target is Q15 */
+    int32_t gain;
+    int32_t gain_step;
+    int32_t target;
+    int32_t volume;
+    int mute;
+    uint32_t smooth_frames;
+
+    enum pcm_fade fade;
+    uint32_t fade_pos;              /* Q16 index into the fade table */
+    uint32_t fade_step;
+};
+
+/* @map can be NULL for identity, @smooth_frames is the gain ramp length.
+ * Returns 0 on success, -1 for unsupported channel count */
+int pcm_process_setup(struct pcm_process *pp, int channels, const int *map,
+        uint32_t smooth_frames);
+
+/* Q15 volume, PCM_PROCESS_UNITY is 0 dB, ramps over smooth_frames */
+void pcm_process_set_volume(struct pcm_process *pp, int32_t volume);
+void pcm_process_set_mute(struct pcm_process *pp, int mute);
+/* jump to the target gain, for when nothing has been played yet */
+void pcm_process_reset_gain(struct pcm_process *pp);
+
+/* cut to PCM_FADE_SILENT right away, e.g. before fading in after a flush */
+void pcm_process_set_silent(struct pcm_process *pp);
+
+/* start a cubic fade over @frames, fade in also leaves PCM_FADE_SILENT */
+void pcm_process_fade(struct pcm_process *pp, int fade_in, uint32_t frames);
+
+/* one shot cubic ramp across exactly @frames, independent of the fade and
+ * gain state, channel order is left alone */
+void pcm_process_ramp(const struct pcm_process *pp, int16_t *data,
+        uint32_t frames, int fade_in);
+
+/* frames until a running fade out reaches PCM_FADE_SILENT, 0 if none */
+uint32_t pcm_process_fade_left(const struct pcm_process *pp);
+
+/* nonzero when run would modify samples */
+int pcm_process_active(const struct pcm_process *pp);
+
+void pcm_process_run(struct pcm_process *pp, int16_t *data, uint32_t frames);
+
+#endif
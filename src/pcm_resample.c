@@ -0,0 +1,287 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pcm_resample.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_RESAMPLE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_RESAMPLE_SSE2
+#endif
+
+/* phase table is taps * L coefficients, 1024 covers 11025 -> 48000 */
+#define MAX_PHASES 1024
+/* input frames deinterleaved per round */
+#define CHUNK_FRAMES 512
+
+struct pcm_resample {
+    uint32_t up;        /* L */
+    uint32_t down;      /* M */
+    int channels;
+    int taps;           /* multiple of 8 */
+
+    int16_t *coef;      /* [up][taps] */
+
+    /* planar history, per channel (taps - 1 + CHUNK_FRAMES) frames */
+    int16_t *hist;
+    uint32_t hist_stride;
+    uint32_t frames;    /* valid frames in history */
+    uint32_t pos;       /* newest input frame of next output */
+    uint32_t phase;
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static inline int16_t sat_s16(int32_t v)
+{
+    if (v > 32767)
+        return 32767;
+    if (v < -32768)
+        return -32768;
+    return (int16_t)v;
+}
+
+#if defined(PCM_RESAMPLE_NEON)
+static inline int32_t dot_s16(const int16_t *a, const int16_t *b, int n)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    int i;
+
+    for (i = 0; i < n; i += 8) {
+        int16x8_t va = vld1q_s16(a + i);
+        int16x8_t vb = vld1q_s16(b + i);
+
+        acc = vmlal_s16(acc, vget_low_s16(va), vget_low_s16(vb));
+        acc = vmlal_s16(acc, vget_high_s16(va), vget_high_s16(vb));
+    }
+#if defined(__aarch64__)
+    return vaddvq_s32(acc);
+#else
+    {
+        int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+        return vget_lane_s32(vpadd_s32(s, s), 0);
+    }
+#endif
+}
+#elif defined(PCM_RESAMPLE_SSE2)
+static inline int32_t dot_s16(const int16_t *a, const int16_t *b, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i < n; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+#else
+static inline int32_t dot_s16(const int16_t *a, const int16_t *b, int n)
+{
+    int32_t acc = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        acc += a[i] * b[i];
+    return acc;
+}
+#endif
+
+/* Blackman windowed sinc, cut off a bit below the lower Nyquist, each
+ * phase normalized to unity DC gain so no ripple on constant input */
+static void design_filter(struct pcm_resample *rs)
+{
+    uint32_t n_total = rs->taps * rs->up;
+    double fc = 0.46 / (rs->up > rs->down ? rs->up : rs->down);
+    double center = (n_total - 1) / 2.0;
+    double *proto;
+    uint32_t p, k;
+
+    proto = malloc(n_total * sizeof(double));
+    if (!proto)
+        return;
+
+    for (k = 0; k < n_total; k++) {
+        double x = k - center;
+        double w = 0.42 - 0.5 * cos(2 * M_PI * k / (n_total - 1)) +
+            0.08 * cos(4 * M_PI * k / (n_total - 1));
+        double s = (x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+
+        proto[k] = s * w;
+    }
+
+    for (p = 0; p < rs->up; p++) {
+        int16_t *c = rs->coef + p * rs->taps;
+        double sum = 0;
+        int32_t isum = 0;
+        int j, peak = 0;
+
+        for (j = 0; j < rs->taps; j++)
+            sum += proto[p + (rs->taps - 1 - j) * rs->up];
+        for (j = 0; j < rs->taps; j++) {
+            double v = proto[p + (rs->taps - 1 - j) * rs->up] / sum;
+
+            c[j] = sat_s16((int32_t)lrint(v * 32768.0));
+            isum += c[j];
+            if (abs(c[j]) > abs(c[peak]))
+                peak = j;
+        }
+        /* put rounding residue on the largest tap */
+        c[peak] = sat_s16(c[peak] + 32768 - isum);
+    }
+    free(proto);
+}
+
+struct pcm_resample * pcm_resample_new(uint32_t in_rate, uint32_t out_rate,
+        int channels, int quality)
+{
+    struct pcm_resample *rs;
+    uint32_t g;
+
+    if (!in_rate || !out_rate || channels <= 0)
+        return NULL;
+    if (quality < PCM_RESAMPLE_QUALITY_MIN)
+        quality = PCM_RESAMPLE_QUALITY_MIN;
+    if (quality > PCM_RESAMPLE_QUALITY_MAX)
+        quality = PCM_RESAMPLE_QUALITY_MAX;
+
+    g = gcd(in_rate, out_rate);
+    if (out_rate / g > MAX_PHASES)
+        return NULL;
+
+    rs = calloc(1, sizeof(*rs));
+    if (!rs)
+        return NULL;
+
+    rs->up = out_rate / g;
+    rs->down = in_rate / g;
+    rs->channels = channels;
+    rs->taps = 16 + 8 * quality;
+    rs->hist_stride = rs->taps - 1 + CHUNK_FRAMES;
+
+    rs->coef = malloc(rs->taps * rs->up * sizeof(int16_t));
+    rs->hist = malloc(rs->hist_stride * channels * sizeof(int16_t));
+    if (!rs->coef || !rs->hist) {
+        pcm_resample_free(rs);
+        return NULL;
+    }
+    design_filter(rs);
+    pcm_resample_reset(rs);
+    return rs;
+}
+
+void pcm_resample_free(struct pcm_resample *rs)
+{
+    if (!rs)
+        return;
+    free(rs->coef);
+    free(rs->hist);
+    free(rs);
+}
+
+void pcm_resample_reset(struct pcm_resample *rs)
+{
+    /* prime with taps - 1 frames of silence */
+    memset(rs->hist, 0, rs->hist_stride * rs->channels * sizeof(int16_t));
+    rs->frames = rs->taps - 1;
+    rs->pos = rs->taps - 1;
+    rs->phase = 0;
+}
+
+uint32_t pcm_resample_max_out(struct pcm_resample *rs, uint32_t in_frames)
+{
+    return (uint32_t)(((uint64_t)in_frames * rs->up) / rs->down) + 2;
+}
+
+uint32_t pcm_resample_process(struct pcm_resample *rs, const int16_t *in,
+        uint32_t in_frames, int16_t *out)
+{
+    const int ch_num = rs->channels;
+    uint32_t out_frames = 0;
+
+    while (in_frames) {
+        uint32_t n = rs->hist_stride - rs->frames;
+        uint32_t i, shift;
+        int ch;
+
+        if (n > in_frames)
+            n = in_frames;
+
+        /* deinterleave into planar history */
+        for (ch = 0; ch < ch_num; ch++) {
+            int16_t *h = rs->hist + ch * rs->hist_stride + rs->frames;
+            const int16_t *s = in + ch;
+
+            for (i = 0; i < n; i++, s += ch_num)
+                h[i] = *s;
+        }
+        rs->frames += n;
+        in += n * ch_num;
+        in_frames -= n;
+
+        while (rs->pos < rs->frames) {
+            const int16_t *c = rs->coef + rs->phase * rs->taps;
+            uint32_t start = rs->pos + 1 - rs->taps;
+
+            for (ch = 0; ch < ch_num; ch++) {
+                int32_t acc = dot_s16(c, rs->hist + ch * rs->hist_stride + start,
+                        rs->taps);
+
+                *out++ = sat_s16((acc + (1 << 14)) >> 15);
+            }
+            out_frames++;
+
+            rs->phase += rs->down;
+            rs->pos += rs->phase / rs->up;
+            rs->phase %= rs->up;
+        }
+
+        /* keep the last taps - 1 frames before pos */
+        shift = rs->pos + 1 - rs->taps;
+        if (shift > rs->frames)
+            shift = rs->frames;
+        if (shift) {
+            for (ch = 0; ch < ch_num; ch++) {
+                int16_t *h = rs->hist + ch * rs->hist_stride;
+
+                memmove(h, h + shift, (rs->frames - shift) * sizeof(int16_t));
+            }
+            rs->frames -= shift;
+            rs->pos -= shift;
+        }
+    }
+    return out_frames;
+}
@@ -0,0 +1,47 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef PCM_RESAMPLE_H_
+#define PCM_RESAMPLE_H_
+
+#include <stdint.h>
+
+#define PCM_RESAMPLE_QUALITY_MIN 0
+#define PCM_RESAMPLE_QUALITY_MAX 10
+#define PCM_RESAMPLE_QUALITY_DEFAULT 4
+
+/* Q15 polyphase FIR resampler for interleaved S16 PCM.
+ * quality selects the filter length, 16 taps at 0 up to 96 taps at 10 */
+struct pcm_resample;
+
+/* NULL if the rate ratio can not be reduced to a usable phase count */
+struct pcm_resample * pcm_resample_new(uint32_t in_rate, uint32_t out_rate,
+        int channels, int quality);
+void pcm_resample_free(struct pcm_resample *rs);
+
+/* drop history, use on flush/discontinuity */
+void pcm_resample_reset(struct pcm_resample *rs);
+
+/* upper bound of output frames for @in_frames input frames */
+uint32_t pcm_resample_max_out(struct pcm_resample *rs, uint32_t in_frames);
+
+/* returns output frames written to @out */
+uint32_t pcm_resample_process(struct pcm_resample *rs, const int16_t *in,
+        uint32_t in_frames, int16_t *out);
+
+#endif
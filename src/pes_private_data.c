@@ -19,12 +19,16 @@
 #include <gst/gstinfo.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "pes_private_data.h"
 
 GST_DEBUG_CATEGORY_EXTERN(gst_aml_hal_asink_debug_category);
 #define GST_CAT_DEFAULT gst_aml_hal_asink_debug_category
 
-static const uint8_t* get_private_data(const uint8_t *header, int size)
+/* private data bytes the descriptor can live in */
+#define PRIVATE_DATA_LEN PES_PRIVATE_DATA_LEN
+
+static int get_private_offset(const uint8_t *header, int size)
 {
   uint8_t stream_id;
   //uint16_t len;
@@ -32,9 +36,9 @@ static const uint8_t* get_private_data(const uint8_t *header, int size)
   uint8_t offset;
 
   if (size < 8)
-    return NULL;
+    return -1;
   if (header[0] != 0 || header[1] != 0 || header[2] != 1)
-    return NULL;
+    return -1;
   stream_id = header[3];
   //len = (header[4] << 8 | header[5]);
 
@@ -43,11 +47,11 @@ static const uint8_t* get_private_data(const uint8_t *header, int size)
       stream_id == 0xf0 || stream_id == 0xf1 || /* ECM, EMM */
       stream_id == 0xff || stream_id == 0xf2 || /* program_stream_directory, DSMCC_stream */
       stream_id == 0xf8) /* ITU-T Rec. H.222.1 type E stream */
-    return NULL;
+    return -1;
 
   flags = header[7];
   if (!(flags & 0x1))
-    return NULL;
+    return -1;
 
   offset = 9; /* skip the pes header data length */
   if ((flags & 0xc0) == 0x80)
@@ -68,32 +72,29 @@ static const uint8_t* get_private_data(const uint8_t *header, int size)
 
   offset += 1; /* skip private header */
   if (offset > size)
-    return NULL;
+    return -1;
 
   /* no PES_private_data_flag */
   if (!(header[offset] & 0x80))
-    return NULL;
+    return -1;
 
-  if (offset + 16 > size) {
+  if (offset + PRIVATE_DATA_LEN > size) {
     GST_ERROR("pes too short %d/%d", offset, size);
-    return NULL;
+    return -1;
   }
-  return header + offset;
+  return offset;
 }
 
-
-int pes_get_ad_des(const uint8_t *header, int size, struct ad_des *des)
+static const uint8_t* get_private_data(const uint8_t *header, int size)
 {
-  const uint8_t* p_ad_des;
-  int len;
+  int offset = get_private_offset(header, size);
 
-  if (!header || !des)
-    return -1;
-
-  p_ad_des = get_private_data(header, size);
+  return offset < 0 ? NULL : header + offset;
+}
 
-  if (!p_ad_des)
-    return -2;
+static int parse_ad_des(const uint8_t *p_ad_des, struct ad_des *des)
+{
+  int len;
 
   if ((p_ad_des[0] & 0xF0) != 0xF0)
     return -3;
@@ -118,3 +119,70 @@ int pes_get_ad_des(const uint8_t *header, int size, struct ad_des *des)
   }
   return 0;
 }
+
+int pes_get_ad_des(const uint8_t *header, int size, struct ad_des *des)
+{
+  const uint8_t* p_ad_des;
+
+  if (!header || !des)
+    return -1;
+
+  p_ad_des = get_private_data(header, size);
+
+  if (!p_ad_des)
+    return -2;
+
+  return parse_ad_des(p_ad_des, des);
+}
+
+void pes_ad_des_cache_reset(struct ad_des_cache *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+int pes_ad_des_update(struct ad_des_cache *c, const uint8_t *header,
+    int size, struct ad_des *des)
+{
+  struct ad_des tmp;
+  int ret;
+
+  if (!header || !des || size < 8)
+    return -1;
+
+  /* the offset only depends on the stream id and the flag bytes */
+  if (!c->valid || size != c->size ||
+      header[3] != c->stream_id || header[7] != c->flags) {
+    c->valid = 1;
+    c->size = size;
+    c->stream_id = header[3];
+    c->flags = header[7];
+    c->offset = -1;
+  }
+
+  if (c->offset >= 0 &&
+      !memcmp(header + c->offset, c->data, PRIVATE_DATA_LEN))
+    return c->ret < 0 ? c->ret : 0;
+
+  /* layout changed or the bytes did, walk the header again */
+  c->offset = get_private_offset(header, size);
+  if (c->offset < 0)
+    return -2;
+  memcpy(c->data, header + c->offset, PRIVATE_DATA_LEN);
+
+  memset(&tmp, 0, sizeof(tmp));
+  ret = parse_ad_des(header + c->offset, &tmp);
+  if (ret) {
+    c->ret = ret;
+    return ret;
+  }
+  /* other private bytes moved, the descriptor itself did not */
+  if (c->has_des && !memcmp(&c->des, &tmp, sizeof(tmp))) {
+    c->ret = 0;
+    return 0;
+  }
+  c->ret = 0;
+  c->has_des = 1;
+  c->des = tmp;
+  *des = tmp;
+  return 1;
+}
@@ -28,3 +28,26 @@ struct ad_des {
 };
 
 int pes_get_ad_des(const uint8_t *header, int size, struct ad_des *des);
+
+#define PES_PRIVATE_DATA_LEN 16
+
+/* remembers where the private data of the last header sits and its bytes,
+ * so a stream repeating the same descriptor is not reparsed */
+struct ad_des_cache {
+  int valid;
+  int size;             /* header length the layout below is for */
+  uint8_t stream_id;
+  uint8_t flags;        /* PES header flags deciding the offset */
+  int offset;           /* of the private data, -1 for none */
+  uint8_t data[PES_PRIVATE_DATA_LEN];
+  int ret;              /* pes_get_ad_des result for those bytes */
+  int has_des;
+  struct ad_des des;    /* last descriptor reported */
+};
+
+void pes_ad_des_cache_reset(struct ad_des_cache *c);
+
+/* 1 and @des filled when the descriptor changed, 0 when it did not,
+ * negative like pes_get_ad_des when the header carries none */
+int pes_ad_des_update(struct ad_des_cache *c, const uint8_t *header,
+    int size, struct ad_des *des);
@@ -0,0 +1,151 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include "thread_sched.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/* mask the calling thread was last pinned to, 0 when never pinned */
+static __thread uint64_t pinned_mask;
+
+/* libc does not wrap sched_setattr, layout from the kernel uapi */
+struct sched_attr_compat {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+static int set_deadline(const struct thread_sched *ts)
+{
+#ifdef SYS_sched_setattr
+    struct sched_attr_compat attr;
+
+    if (!ts->runtime_ns || ts->runtime_ns > ts->period_ns)
+        return -EINVAL;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE;
+    attr.sched_runtime = ts->runtime_ns;
+    attr.sched_deadline = ts->period_ns;
+    attr.sched_period = ts->period_ns;
+    if (syscall(SYS_sched_setattr, 0, &attr, 0))
+        return -errno;
+    return 0;
+#else
+    (void)ts;
+    return -ENOSYS;
+#endif
+}
+
+static int set_policy(const struct thread_sched *ts)
+{
+    struct sched_param param;
+    int policy;
+    int rc;
+
+    memset(&param, 0, sizeof(param));
+    switch (ts->policy) {
+    case THREAD_SCHED_FIFO:
+    case THREAD_SCHED_RR:
+        policy = ts->policy == THREAD_SCHED_FIFO ? SCHED_FIFO : SCHED_RR;
+        param.sched_priority = ts->priority;
+        if (param.sched_priority < sched_get_priority_min(policy))
+            param.sched_priority = sched_get_priority_min(policy);
+        if (param.sched_priority > sched_get_priority_max(policy))
+            param.sched_priority = sched_get_priority_max(policy);
+        break;
+    case THREAD_SCHED_DEADLINE:
+        return set_deadline(ts);
+    case THREAD_SCHED_OTHER:
+    default:
+        policy = SCHED_OTHER;
+        break;
+    }
+    rc = pthread_setschedparam(pthread_self(), policy, &param);
+    return -rc;
+}
+
+/* @mask 0 allows every configured cpu again */
+static int set_affinity(uint64_t mask)
+{
+    cpu_set_t set;
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    int cpu, rc;
+
+    CPU_ZERO(&set);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (mask ? (cpu < 64 && (mask & (1ULL << cpu))) : cpu < n)
+            CPU_SET(cpu, &set);
+    }
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (!rc)
+        pinned_mask = mask;
+    return -rc;
+}
+
+int thread_sched_apply(const struct thread_sched *ts, const char *name)
+{
+    int ret = 0;
+    int rc;
+
+    if (name)
+        prctl(PR_SET_NAME, name);
+
+    rc = set_policy(ts);
+    if (rc && !ret)
+        ret = rc;
+
+    if (ts->cpu_mask || pinned_mask) {
+        rc = set_affinity(ts->cpu_mask);
+        if (rc && !ret)
+            ret = rc;
+    }
+    return ret;
+}
+
+const char * thread_sched_policy_name(enum thread_sched_policy policy)
+{
+    switch (policy) {
+    case THREAD_SCHED_OTHER:
+        return "SCHED_OTHER";
+    case THREAD_SCHED_FIFO:
+        return "SCHED_FIFO";
+    case THREAD_SCHED_RR:
+        return "SCHED_RR";
+    case THREAD_SCHED_DEADLINE:
+        return "SCHED_DEADLINE";
+    default:
+        return "unknown";
+    }
+}
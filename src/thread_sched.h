@@ -0,0 +1,48 @@
+/* GStreamer
+ * Copyright (C) 2020 Amlogic, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free SoftwareFoundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+#ifndef THREAD_SCHED_H_
+#define THREAD_SCHED_H_
+
+#include <stdint.h>
+
+enum thread_sched_policy {
+    THREAD_SCHED_OTHER,
+    THREAD_SCHED_FIFO,
+    THREAD_SCHED_RR,
+    THREAD_SCHED_DEADLINE,
+};
+
+/* scheduling setup shared by every thread the sink runs audio on */
+struct thread_sched {
+    enum thread_sched_policy policy;
+    int priority;           /* 1..99 for FIFO/RR, ignored otherwise */
+    uint64_t runtime_ns;    /* DEADLINE budget per period */
+    uint64_t period_ns;     /* DEADLINE period, also used as deadline */
+    uint64_t cpu_mask;      /* bit n allows cpu n, 0 for every cpu */
+};
+
+/* apply @ts to the calling thread, @name is set with PR_SET_NAME when not
+ * NULL. A zero cpu_mask unpins a thread pinned here before and leaves
+ * others alone. Returns 0 or a negative errno of the first step that
+ * failed, the remaining steps are still tried */
+int thread_sched_apply(const struct thread_sched *ts, const char *name);
+
+const char * thread_sched_policy_name(enum thread_sched_policy policy);
+
+#endif